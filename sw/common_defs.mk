@@ -38,6 +38,7 @@ endif
 OBJ_DIR = ../obj
 INC_DIR = ../lib
 TEST_DIR = ../test
+DRV_DIR = ../drv
 
 # The library is actual handling Serial Parallel I/O.
 # Let's call it SPIO to get a short and simple name.
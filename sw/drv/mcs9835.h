@@ -14,31 +14,272 @@
 
 #include <linux/pci.h>
 #include <linux/cdev.h>
+#include <linux/kref.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/kfifo.h>
+#include <linux/hrtimer.h>
+#include <linux/version.h>
+#include <linux/uio.h>
+#include <asm/uaccess.h>
+
+#include "mcs9835_user.h"
+
+#ifdef MCS9835_FAKE_HW
+#include "mcs9835_fake.h"
+#endif
 
 /****************************************************************************
  *
  * Macros
  *
  ****************************************************************************/
+/* Kernel compatibility */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,16,0)
+#define MCS9835_HAVE_ITER /* read_iter/write_iter, copy_to/from_iter */
+#endif
+#if IS_ENABLED(CONFIG_GPIOLIB) && \
+    LINUX_VERSION_CODE >= KERNEL_VERSION(4,15,0)
+#define MCS9835_HAVE_GPIO /* gpio_chip with get_multiple/set_multiple */
+#include <linux/gpio/driver.h>
+#endif
+
+/*
+ * Define a read/write file operation for the kernel's buffer type,
+ * calling a transfer function taking a struct mcs9835_ubuf.
+ */
+#ifdef MCS9835_HAVE_ITER
+#define __MCS9835_DEFINE_FOP(name, xfer, type)				\
+  static ssize_t name(struct kiocb *iocb,				\
+		      struct iov_iter *iter)				\
+  {									\
+    struct mcs9835_ubuf ub = { .iter = iter };				\
+    return xfer(iocb->ki_filp, &ub, iocb->ki_pos);			\
+  }
+#else
+#define __MCS9835_DEFINE_FOP(name, xfer, type)				\
+  static ssize_t name(struct file *file,				\
+		      type __user *buf,					\
+		      size_t count,					\
+		      loff_t *pos)					\
+  {									\
+    struct mcs9835_ubuf ub = { .buf = (char __user *)buf,		\
+			       .count = count };			\
+    return xfer(file, &ub, *pos);					\
+  }
+#endif
+
+#define MCS9835_DEFINE_READ_FOP(name, xfer)	\
+  __MCS9835_DEFINE_FOP(name, xfer, char)
+#define MCS9835_DEFINE_WRITE_FOP(name, xfer)	\
+  __MCS9835_DEFINE_FOP(name, xfer, const char)
+
 /* Max supported devices */
-#define MCS9835_MAX_DEVICES  1
+#define MCS9835_MAX_DEVICES  32
 
 /* Character devices */
-#define MCS9835_MAX_CDEVS  3
+#define MCS9835_MAX_CDEVS  4
+
+#define MCS9835_CDEV_IDX_UART_A       0
+#define MCS9835_CDEV_IDX_UART_B       1
+#define MCS9835_CDEV_IDX_PARPORT      2
+#define MCS9835_CDEV_IDX_PARPORT_EVT  3
+
+/* Character device minor numbers, all devices */
+#define MCS9835_MAX_MINORS  (MCS9835_MAX_DEVICES * MCS9835_MAX_CDEVS)
+
+/* Parallel port transfer buffer size, per open file (bytes) */
+#define MCS9835_PARPORT_BUF_SIZE  MCS9835_PARPORT_ATOMIC_SIZE
+
+/* Parallel port status event FIFO size (records, power of 2) */
+#define MCS9835_PARPORT_EVENTS  1024
+
+/* Parallel port status events copied to user at a time (records) */
+#define MCS9835_PARPORT_EVENT_BATCH  16
+
+/* Parallel port playback steps queued (records, power of 2) */
+#define MCS9835_PLAY_STEPS  4096
+
+/* Parallel port FIFO handshake timeout, without progress (jiffies) */
+#define MCS9835_PARPORT_FIFO_TIMEOUT  (HZ / 10)
+
+/* Register operation delays from this long sleep, shorter ones busy wait */
+#define MCS9835_REG_SLEEP_MIN_NS  10000
+
+/* UARTs */
+#define MCS9835_MAX_UARTS  2
+
+#define MCS9835_UART_IDX_A  0
+#define MCS9835_UART_IDX_B  1
+
+/* UART ring buffer sizes (bytes, power of 2) */
+#define MCS9835_UART_RX_BUF_SIZE  8192
+#define MCS9835_UART_TX_BUF_SIZE  8192
+
+/* UART copy to/from user, bytes at a time (stack buffer) */
+#define MCS9835_UART_COPY_SIZE  256
 
-#define MCS9835_CDEV_IDX_UART_A   0
-#define MCS9835_CDEV_IDX_UART_B   1
-#define MCS9835_CDEV_IDX_PARPORT  2
+/*
+ * Hybrid interrupt/polling, defaults of the sysfs settings.
+ * A source switches to polling when the work done by its interrupts
+ * within a window reaches its enter threshold. UART receive counts
+ * bytes over a window of character times, it polls from half the
+ * line rate at any baudrate. The parallel port counts status events.
+ */
+#define MCS9835_HYBRID_EXIT_POLLS         32 /* Idle polls to interrupts  */
+#define MCS9835_HYBRID_UART_WINDOW_CHARS  32 /* Window, character times   */
+#define MCS9835_HYBRID_UART_ENTER_BYTES   16 /* Bytes per window to poll  */
+#define MCS9835_HYBRID_PARPORT_WINDOW_NS  1000000
+#define MCS9835_HYBRID_PARPORT_ENTER      16 /* Events per window to poll */
+
+/* Parallel port status poll period (ns) */
+#define MCS9835_PARPORT_POLL_NS  50000
 
 /****************************************************************************
  *
  * Support types
  *
  ****************************************************************************/
+struct mcs9835_dev;
+struct mcs9835_stats;
+struct mcs9835_ring;
+struct dentry;
+
+/*
+ * User buffer of a read/write call.
+ * An iov_iter where the kernel has read_iter/write_iter, which lets
+ * transfers be submitted asynchronously (AIO, io_uring).
+ */
+struct mcs9835_ubuf {
+#ifdef MCS9835_HAVE_ITER
+  struct iov_iter *iter;
+#else
+  char __user *buf;
+  size_t       count; /* Bytes left */
+#endif
+};
+
+/*
+ * Hybrid interrupt/polling of one interrupt source.
+ * A source taking interrupts at a sustained high rate masks its
+ * interrupt and is polled by a timer, until it has been idle for
+ * a number of polls and gets its interrupt back.
+ */
+struct mcs9835_hybrid;
+
+typedef int (*mcs9835_hybrid_poll_t)(struct mcs9835_hybrid *hy);
+typedef void (*mcs9835_hybrid_unmask_t)(struct mcs9835_hybrid *hy);
+
+struct mcs9835_hybrid {
+  struct mcs9835_dev      *dev;    /* Settings of the device         */
+  mcs9835_hybrid_poll_t   poll;    /* Returns events handled         */
+  mcs9835_hybrid_unmask_t unmask;  /* Gives the source its interrupt */
+  struct hrtimer          timer;
+  u64                     poll_ns;
+  int                     polling; /* Interrupt masked, timer polls  */
+  u64                     window_ns;
+  unsigned                enter_work; /* Work per window, 0 never polls */
+  s64                     window_start_ns;
+  unsigned                window_work;
+  unsigned                idle_polls;
+
+  /* Counters, in sysfs */
+  unsigned long irqs;    /* Interrupts handled   */
+  unsigned long polls;   /* Timer polls          */
+  unsigned long to_poll; /* Switches to polling  */
+  unsigned long to_irq;  /* Switches back        */
+};
+
+/*
+ * Open parallel port device file.
+ * Transfers through the file are serialized by its own mutex,
+ * only the port access itself takes the device parport mutex.
+ */
+struct mcs9835_parport_file {
+  struct mcs9835_dev        *dev;
+  struct mutex              mutex; /* Serializes transfers of this file */
+  u8                        *buf;  /* Kernel side transfer buffer       */
+  struct mcs9835_file_stats stats;
+  struct mcs9835_ring       *ring; /* Submission rings, or NULL        */
+};
+
 struct mcs9835_char {
   struct cdev cdev;
   dev_t       cdevno;
   int         have_cdev;
+  void        *private_data; /* Owner data for file operations */
+  struct mcs9835_stats __percpu *stats;
+};
+
+struct mcs9835_uart {
+  struct mcs9835_dev *dev;
+  void __iomem       *base;     /* BAR0 or BAR1 */
+  int                 idx;      /* MCS9835_UART_IDX_x */
+  int                 cdev_idx; /* MCS9835_CDEV_IDX_UART_x */
+  unsigned            baudrate;
+  unsigned long       in_use;   /* Bit 0 set while open */
+
+  spinlock_t lock; /* Serializes register access with ISR */
+  u8         ier;  /* Shadow of interrupt enable register */
+  u8         ier_masked; /* Bits kept off while polling     */
+  u8         fcr;  /* FIFO control register setting       */
+  u8         mcr;  /* Shadow of modem control register    */
+  struct mcs9835_hybrid rx_hybrid;
+
+  /* Reader wake-up, see struct mcs9835_uart_tuning */
+  unsigned       rx_wake;     /* Bytes in receive ring          */
+  u64            rx_idle_ns;  /* Idle time, 0 waits for rx_wake */
+  int            low_latency;
+  int            rx_idle;     /* Idle time passed, set by timer */
+  struct hrtimer rx_idle_timer;
+
+  /* Forwarding to the other UART, see struct mcs9835_uart_bridge */
+  int           bridge;
+  int           bridge_mirror;
+  int           bridge_kick;      /* Other UART needs THRI, set by ISR */
+  unsigned long bridge_forwarded;
+  unsigned long bridge_dropped;
+
+  /* Receive framing, see struct mcs9835_uart_framing */
+  int           frame_mode;     /* MCS9835_UART_FRAME_x           */
+  u8            frame_delim;
+  unsigned      frame_offset;   /* Bytes before length prefix     */
+  unsigned      frame_size;     /* Length prefix bytes            */
+  int           frame_be;
+  u64           frame_idle_ns;
+  unsigned      frame_max;
+  unsigned      frame_len;      /* Bytes of frame being received  */
+  unsigned      frame_expect;   /* Frame length, 0 until known    */
+  unsigned      frame_value;    /* Length prefix so far           */
+  unsigned long frames;
+  unsigned long frame_errors;
+
+  /* RS-485 direction control, see struct mcs9835_uart_rs485 */
+  unsigned       rs485;         /* MCS9835_UART_RS485_x, 0 when off */
+  int            rs485_txing;   /* Driver enabled for transmit     */
+  u64            rs485_char_ns; /* One character on the line       */
+  u64            rs485_delay_ns;
+  struct hrtimer rs485_timer;   /* Times out the last character    */
+
+  /*
+   * Ring buffers, one consumer each. The transmit ring has two
+   * producers, the writer and the bridge of the other UART,
+   * serialized by tx_in_lock.
+   */
+  DECLARE_KFIFO_PTR(rx_fifo, u8);
+  DECLARE_KFIFO_PTR(rx_frames, u16); /* Lengths of framed data in rx_fifo */
+  DECLARE_KFIFO_PTR(tx_fifo, u8);
+  spinlock_t        tx_in_lock;
+  wait_queue_head_t rx_wq;
+  wait_queue_head_t tx_wq;
+  struct mutex      read_mutex;
+  struct mutex      write_mutex;
+
+  /* Error counters */
+  unsigned long rx_overruns; /* Receive ring full   */
+  unsigned long hw_overruns; /* Receive FIFO overrun */
+  unsigned long rx_errors;   /* Parity/framing/break */
 };
 
 /****************************************************************************
@@ -49,7 +290,12 @@ struct mcs9835_char {
 struct mcs9835_dev {
 
   /* PCI */
-  struct pci_dev *pci_dev;
+  struct pci_dev *pci_dev;  /* NULL for an emulated device  */
+  struct device  *parent;   /* Parent of character devices */
+  unsigned int   irq;
+#ifdef MCS9835_FAKE_HW
+  struct mcs9835_fake *fake; /* Emulated hardware, or NULL */
+#endif
 
   void __iomem *vmem_bar0; /* UART-A             */
   void __iomem *vmem_bar1; /* UART-B             */
@@ -57,13 +303,153 @@ struct mcs9835_dev {
   void __iomem *vmem_bar3; /* Config A/B and ECR */
 
   /* Character devices */
-  struct class *class;
-
   struct mcs9835_char chr[MCS9835_MAX_CDEVS];
 
+  /* UARTs */
+  struct mcs9835_uart uart[MCS9835_MAX_UARTS];
+
+  /* Parallel port */
+  struct mutex parport_mutex; /* Serializes port access          */
+  spinlock_t   parport_dcr_lock; /* Control register updates     */
+  u8           parport_dpr;   /* Last written data register      */
+  u8           parport_dcr;   /* Last written control register   */
+  int          parport_mode;  /* MCS9835_PARPORT_MODE_x          */
+  int          parport_ecr;   /* Extended control register found */
+
+  /* Parallel port open files */
+  spinlock_t   parport_open_lock;
+  int          parport_users; /* Open files                      */
+  struct file  *parport_excl; /* File with exclusive use, or NULL */
+
+  /*
+   * Parallel port status events. Recorded by every status register
+   * read that finds a nAck interrupt pending, the read clears it.
+   */
+  DECLARE_KFIFO_PTR(parport_events, struct mcs9835_parport_event);
+  wait_queue_head_t parport_event_wq;
+  struct mutex      parport_event_mutex; /* Serializes readers   */
+  spinlock_t        parport_event_lock;  /* Serializes producers */
+  u8                parport_last_dsr;    /* Last recorded status */
+  atomic_t          parport_irq_taken;   /* Pending bit read, for ISR */
+  unsigned long     parport_event_overruns;
+  struct mcs9835_hybrid parport_hybrid;
+
+  /* Hybrid interrupt/polling, enter thresholds are per source */
+  unsigned          hybrid_exit_polls;
+
+  /* Parallel port playback, steps clocked out by timer */
+  struct hrtimer    play_timer;
+  DECLARE_KFIFO_PTR(play_steps, struct mcs9835_play_step);
+  wait_queue_head_t play_wq;
+  struct mutex      play_mutex;     /* Serializes queueing        */
+  struct file       *play_owner;    /* File that started playback */
+  u32               play_period_ns; /* Fixed period, or 0         */
+  int               play_running;
+  unsigned long     play_late;
+
+  /* Parallel port status sampling, timer into mmap ring */
+  struct hrtimer             sample_timer;
+  struct mutex               sample_mutex;     /* Serializes control */
+  struct mcs9835_sample_ring *sample_ring;     /* Header, vmalloc    */
+  u8                         *sample_data;     /* Samples after hdr  */
+  u32                        sample_period_ns;
+  int                        sample_running;
+
+#ifdef MCS9835_HAVE_GPIO
+  /* Parallel port pins as GPIO lines */
+  struct gpio_chip gpio;
+  int              have_gpio;
+#endif
+
+  /* Statistics */
+  struct mcs9835_stats __percpu *reg_stats; /* Register access */
+  struct dentry                 *debugfs_dir;
+
   /* Misc */
+  struct kref kref; /* Held by probe and each open file */
   int dev_idx;
   int init_done;
 };
 
+/****************************************************************************
+ * 
+ * Exported functions
+ *
+ ****************************************************************************/
+
+extern void mcs9835_dev_get(struct mcs9835_dev *dev);
+
+extern void mcs9835_dev_put(struct mcs9835_dev *dev);
+
+extern int mcs9835_reg_op_check(struct mcs9835_dev *dev,
+				const struct mcs9835_reg_op *op);
+
+extern u8 mcs9835_parport_read_dsr(struct mcs9835_dev *dev);
+
+extern void mcs9835_reg_op_execute(struct mcs9835_dev *dev,
+				   struct mcs9835_reg_op *op);
+
+/****************************************************************************
+ * 
+ * Inline functions, user buffer access
+ *
+ ****************************************************************************/
+
+static inline size_t mcs9835_ubuf_count(const struct mcs9835_ubuf *ub)
+{
+#ifdef MCS9835_HAVE_ITER
+  return iov_iter_count(ub->iter);
+#else
+  return ub->count;
+#endif
+}
+
+/****************************************************************************/
+
+/*
+ * Copy to user buffer and advance it.
+ * Returns 0, or -EFAULT.
+ */
+static inline int mcs9835_ubuf_to_user(struct mcs9835_ubuf *ub,
+				       const void *kbuf,
+				       size_t len)
+{
+#ifdef MCS9835_HAVE_ITER
+  if (copy_to_iter(kbuf, len, ub->iter) != len) {
+    return -EFAULT;
+  }
+#else
+  if (copy_to_user(ub->buf, kbuf, len)) {
+    return -EFAULT;
+  }
+  ub->buf   += len;
+  ub->count -= len;
+#endif
+  return 0;
+}
+
+/****************************************************************************/
+
+/*
+ * Copy from user buffer and advance it.
+ * Returns 0, or -EFAULT.
+ */
+static inline int mcs9835_ubuf_from_user(struct mcs9835_ubuf *ub,
+					 void *kbuf,
+					 size_t len)
+{
+#ifdef MCS9835_HAVE_ITER
+  if (copy_from_iter(kbuf, len, ub->iter) != len) {
+    return -EFAULT;
+  }
+#else
+  if (copy_from_user(kbuf, ub->buf, len)) {
+    return -EFAULT;
+  }
+  ub->buf   += len;
+  ub->count -= len;
+#endif
+  return 0;
+}
+
 #endif /* __MCS9835_H__ */
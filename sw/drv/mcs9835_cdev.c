@@ -12,10 +12,23 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/device.h>
+#include <linux/version.h>
 
 #include "mcs9835_cdev.h"
 #include "mcs9835_log.h"
 
+/****************************************************************************
+ *
+ * Global variables
+ *
+ ****************************************************************************/
+
+/* Device class shared by all devices */
+static struct class *mcs9835_class = NULL;
+
+/* Character device region shared by all devices */
+static dev_t mcs9835_devno;
+
 /****************************************************************************
  *
  * Exported functions
@@ -24,24 +37,39 @@
 
 /****************************************************************************/
 
-int mcs9835_cdev_initialize(struct mcs9835_dev *dev,
-			    int dev_idx)
+int mcs9835_cdev_initialize(void)
 {
   int rc = 0;
 
-  char class_name[50];
+  /* 
+   * Allocate cdev region for all devices.
+   * Minor number according to: <dev_idx> * MCS9835_MAX_CDEVS + <cdev_idx>
+   */
+  LOG(MCS_CDV, "alloc_chrdev_region, %d minors\n", MCS9835_MAX_MINORS);
+  rc = alloc_chrdev_region(&mcs9835_devno,
+			   0,
+			   MCS9835_MAX_MINORS,
+			   DRV_NAME);
+  if (rc) {
+    LOG(MCS_ERR, "alloc_chrdev_region failed\n");
+    return rc;
+  }
 
   /* 
    * Create device class.
-   * Listed in sysfs according to: /sys/class/mcs9835_c<dev_idx>
+   * Listed in sysfs according to: /sys/class/mcs9835
    */
-  sprintf(class_name, "%s_c%d", DRV_NAME, dev_idx);
-
-  LOG(MCS_CDV, "create device class %s\n", class_name);
-  dev->class = class_create(THIS_MODULE, class_name);
-  if (IS_ERR(dev->class)) {
-    LOG(MCS_ERR, "class_create failed for %s\n", class_name);
-    rc = PTR_ERR(dev->class);
+  LOG(MCS_CDV, "create device class %s\n", DRV_NAME);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,4,0)
+  mcs9835_class = class_create(DRV_NAME);
+#else
+  mcs9835_class = class_create(THIS_MODULE, DRV_NAME);
+#endif
+  if (IS_ERR(mcs9835_class)) {
+    LOG(MCS_ERR, "class_create failed for %s\n", DRV_NAME);
+    rc = PTR_ERR(mcs9835_class);
+    mcs9835_class = NULL;
+    unregister_chrdev_region(mcs9835_devno, MCS9835_MAX_MINORS);
   }
 
   return rc;
@@ -49,15 +77,18 @@ int mcs9835_cdev_initialize(struct mcs9835_dev *dev,
 
 /****************************************************************************/
 
-void mcs9835_cdev_finalize(struct mcs9835_dev *dev)
+void mcs9835_cdev_finalize(void)
 {
   /* 
    * Remove device class.
    */
-  if (dev->class) {
+  if (mcs9835_class) {
     LOG(MCS_CDV, "destroy device class\n");
-    class_destroy(dev->class);    
-    dev->class = NULL;
+    class_destroy(mcs9835_class);    
+    mcs9835_class = NULL;
+
+    LOG(MCS_CDV, "unregister_cdev_region\n");
+    unregister_chrdev_region(mcs9835_devno, MCS9835_MAX_MINORS);
   }
 }
 
@@ -70,33 +101,18 @@ int mcs9835_cdev_create(struct mcs9835_dev *dev,
 {
   int rc = -1;
   
-  int major  = 0;
-  int minor  = 0;
-
   const int count = 1;
 
   struct device *device = NULL;
 
-  if (dev->class == NULL) {
+  if (mcs9835_class == NULL) {
     LOG(MCS_ERR, "CDEV class must be initialized before adding devices\n");
-    goto cdev_err_alloc_region;
-  }
-
-  /* 
-   * Allocate cdev region. 
-   */
-  LOG(MCS_CDV, "alloc_chrdev_region, idx:%d\n", cdev_idx);
-  rc = alloc_chrdev_region(&(dev->chr[cdev_idx].cdevno), 
-			   minor,
-			   count,
-			   DRV_NAME);
-  if (rc) {
-    LOG(MCS_ERR, "alloc_chrdev_region failed, idx:%d\n", cdev_idx);
-    goto cdev_err_alloc_region;
+    goto cdev_err_add;
   }
 
-  /* Fetch allocated MAJOR number */
-  major = MAJOR(dev->chr[cdev_idx].cdevno); 
+  dev->chr[cdev_idx].cdevno = MKDEV(MAJOR(mcs9835_devno),
+				    MINOR(mcs9835_devno) +
+				    dev_idx * MCS9835_MAX_CDEVS + cdev_idx);
 
   /* 
    * Initialize cdev.
@@ -124,9 +140,9 @@ int mcs9835_cdev_create(struct mcs9835_dev *dev,
    */
   LOG(MCS_CDV, "device_create, %s_%d_%d\n",
       DRV_NAME, dev_idx, cdev_idx);
-  device = device_create(dev->class,
-			 NULL,
-			 MKDEV(major, minor),
+  device = device_create(mcs9835_class,
+			 dev->parent,
+			 dev->chr[cdev_idx].cdevno,
 			 NULL, 
 			 DRV_NAME "_%d_%d", dev_idx, cdev_idx);
   if (IS_ERR(device)) {
@@ -150,10 +166,6 @@ int mcs9835_cdev_create(struct mcs9835_dev *dev,
   cdev_del(&(dev->chr[cdev_idx].cdev));
 
  cdev_err_add:
-  unregister_chrdev_region(dev->chr[cdev_idx].cdevno,
-			   count);
-
- cdev_err_alloc_region:
   
   /* 
    * Indicate cdev not initialized.
@@ -168,18 +180,13 @@ int mcs9835_cdev_create(struct mcs9835_dev *dev,
 void mcs9835_cdev_destroy(struct mcs9835_dev *dev,
 			  int cdev_idx)
 {
-  int major  = MAJOR(dev->chr[cdev_idx].cdevno);
-  int minor  = 0;
-
-  const int count = 1;
-
   if (dev) {
     /* 
      * Remove device node file. 
      */
-    if (dev->class && dev->chr[cdev_idx].have_cdev) {
+    if (mcs9835_class && dev->chr[cdev_idx].have_cdev) {
       LOG(MCS_CDV, "device_destroy, idx:%d\n", cdev_idx); 
-      device_destroy(dev->class, MKDEV(major, minor));      
+      device_destroy(mcs9835_class, dev->chr[cdev_idx].cdevno);
     }
     
     /* 
@@ -189,14 +196,6 @@ void mcs9835_cdev_destroy(struct mcs9835_dev *dev,
       LOG(MCS_CDV, "cdev_del\n");
       cdev_del(&(dev->chr[cdev_idx].cdev));  
     }
-
-    /* 
-     * Unregister cdev.
-     */
-    if (dev->chr[cdev_idx].have_cdev) {
-      LOG(MCS_CDV, "unregister_cdev_region\n");
-      unregister_chrdev_region(dev->chr[cdev_idx].cdevno, count);  
-    }
     dev->chr[cdev_idx].have_cdev = 0;
 
   } else {
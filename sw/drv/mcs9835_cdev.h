@@ -22,10 +22,9 @@
  *
  ****************************************************************************/
 
-extern int mcs9835_cdev_initialize(struct mcs9835_dev *dev,
-				   int dev_idx);
+extern int mcs9835_cdev_initialize(void);
 
-extern void mcs9835_cdev_finalize(struct mcs9835_dev *dev);
+extern void mcs9835_cdev_finalize(void);
 
 extern int mcs9835_cdev_create(struct mcs9835_dev *dev,
 			       int dev_idx,
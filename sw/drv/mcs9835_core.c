@@ -19,13 +19,32 @@
 #include <linux/version.h>
 #include <linux/module.h>
 #include <linux/moduleparam.h>
+#include <linux/sched.h>
+#include <linux/interrupt.h>
+#include <linux/ktime.h>
+#include <linux/poll.h>
+#include <linux/delay.h>
+#include <linux/idr.h>
+#include <linux/debugfs.h>
+#include <linux/err.h>
+#include <linux/sysfs.h>
 #include <asm/uaccess.h>
 
 #include "mcs9835.h"
 #include "mcs9835_product_info.h"
 #include "mcs9835_log.h"
 #include "mcs9835_cdev.h"
+#include "mcs9835_uart.h"
 #include "mcs9835_hw.h"
+#include "mcs9835_stats.h"
+#include "mcs9835_play.h"
+#include "mcs9835_sample.h"
+#include "mcs9835_gpio.h"
+#include "mcs9835_ring.h"
+#include "mcs9835_hybrid.h"
+
+#define CREATE_TRACE_POINTS
+#include "mcs9835_trace.h"
 
 /****************************************************************************
  *
@@ -50,6 +69,24 @@ u32 loglevel;
 module_param(loglevel, int, 0);
 MODULE_PARM_DESC(loglevel, "Bitmask (32bit) enabling loglevels");
 
+/*
+ * baudrate: UART-A/UART-B baudrate, 8N1.
+ *           [115200] by default
+ */
+static uint baudrate = MCS9835_UART_BASE_BAUD;
+module_param(baudrate, uint, 0);
+MODULE_PARM_DESC(baudrate, "UART baudrate (divides 115200)");
+
+#ifdef MCS9835_FAKE_HW
+/*
+ * fake_devices: Emulated devices added at load, besides PCI devices.
+ *               [1] by default
+ */
+static uint fake_devices = 1;
+module_param(fake_devices, uint, 0);
+MODULE_PARM_DESC(fake_devices, "Emulated devices to add");
+#endif
+
 /****************************************************************************
  *
  * Function prototypes
@@ -72,21 +109,63 @@ static int mcs9835_open_parport(struct inode *inode,
 				struct file  *file);
 static int mcs9835_close_parport(struct inode *inode, 
 				 struct file  *file);
-static ssize_t mcs9835_read_parport(const struct file *file,
-				    const char __user *buf, 
-				    size_t count,
-				    loff_t *pos);
-
-static ssize_t mcs9835_write_parport(const struct file *file,
-				     const char __user *buf, 
-				    size_t count,
-				    loff_t *pos);
+static ssize_t mcs9835_read_parport(struct file *file,
+				    struct mcs9835_ubuf *ub,
+				    loff_t pos);
+static ssize_t mcs9835_write_parport(struct file *file,
+				     struct mcs9835_ubuf *ub,
+				     loff_t pos);
+
+static unsigned int mcs9835_poll_parport(struct file *file,
+					 poll_table *wait);
+static long mcs9835_ioctl_parport(struct file *file,
+				  unsigned int cmd,
+				  unsigned long arg);
+static int mcs9835_mmap_parport(struct file *file,
+				struct vm_area_struct *vma);
+
+static int mcs9835_open_parport_events(struct inode *inode, 
+				       struct file  *file);
+static int mcs9835_close_parport_events(struct inode *inode, 
+					struct file  *file);
+static ssize_t mcs9835_read_parport_events(struct file *file,
+					   struct mcs9835_ubuf *ub,
+					   loff_t pos);
+static unsigned int mcs9835_poll_parport_events(struct file *file,
+						poll_table *wait);
+
+static irqreturn_t mcs9835_isr(int irq, 
+			       void *dev_id);
 
 static int __init mcs9835_initialize(void);
 static void __exit mcs9835_finalize(void);
 
 static void initialize_dev_data(struct mcs9835_dev *dev);
 
+static struct mcs9835_dev *dev_create(void);
+
+static void dev_destroy(struct mcs9835_dev *mcs_dev);
+
+static int dev_attach(struct mcs9835_dev *mcs_dev);
+
+static void dev_detach(struct mcs9835_dev *mcs_dev);
+
+static int dev_request_irq(struct mcs9835_dev *mcs_dev);
+
+static void dev_free_irq(struct mcs9835_dev *mcs_dev);
+
+#ifdef MCS9835_FAKE_HW
+static int fake_dev_add(void);
+
+static void fake_dev_remove_all(void);
+#endif
+
+static void release_dev_data(struct kref *kref);
+
+static int dev_idx_get(void);
+
+static void dev_idx_put(int dev_idx);
+
 static void parport_write_reg(struct mcs9835_dev *dev,
 			      unsigned bar_offset,
 			      u8 value);
@@ -94,6 +173,124 @@ static void parport_write_reg(struct mcs9835_dev *dev,
 static u8 parport_read_reg(struct mcs9835_dev *dev,
 			   unsigned bar_offset);
 
+static void parport_write_data(struct mcs9835_dev *dev,
+			       const u8 *buf,
+			       size_t count);
+
+static void parport_read_status(struct mcs9835_dev *dev,
+				u8 *buf,
+				size_t count);
+
+static void parport_enable_irq(struct mcs9835_dev *dev,
+			       int enable);
+
+static u8 parport_modify_dcr(struct mcs9835_dev *dev,
+			     u8 clear,
+			     u8 set);
+
+static int parport_probe_ecr(struct mcs9835_dev *dev);
+
+static int parport_set_mode(struct mcs9835_dev *dev,
+			    int mode);
+
+static int parport_wait_ecr(struct mcs9835_dev *dev,
+			    u8 mask,
+			    u8 value);
+
+static ssize_t parport_write_fifo(struct mcs9835_dev *dev,
+				  const u8 *buf,
+				  size_t count);
+
+static ssize_t parport_epp_xfer(struct mcs9835_dev *dev,
+				u8 *buf,
+				size_t count,
+				int cycle,
+				int write);
+
+static void parport_epp_clear_timeout(struct mcs9835_dev *dev);
+
+static ssize_t parport_write(struct mcs9835_dev *dev,
+			     const u8 *buf,
+			     size_t count,
+			     int cycle);
+
+static ssize_t parport_read(struct mcs9835_dev *dev,
+			    u8 *buf,
+			    size_t count,
+			    int cycle);
+
+static int parport_xfer_check(struct mcs9835_dev *dev,
+			      loff_t pos,
+			      int write);
+
+static void parport_file_stats(struct mcs9835_parport_file *pfile,
+			       int write,
+			       ssize_t rc);
+
+static void __iomem *bar_base(struct mcs9835_dev *dev,
+			      unsigned bar);
+
+static resource_size_t bar_len(struct mcs9835_dev *dev,
+			       unsigned bar);
+
+static struct mcs9835_uart *bar_uart(struct mcs9835_dev *dev,
+				     unsigned bar);
+
+static void bar_write_reg(struct mcs9835_dev *dev,
+			  unsigned bar,
+			  unsigned offset,
+			  u8 value);
+
+static u8 bar_read_reg(struct mcs9835_dev *dev,
+		       unsigned bar,
+		       unsigned offset);
+
+static long ioctl_reg_batch(struct mcs9835_dev *dev,
+			    void __user *arg);
+
+static ssize_t regs_window_xfer(struct kobject *kobj,
+				char *buf,
+				loff_t off,
+				size_t count,
+				int write);
+
+static long ioctl_set_mode(struct mcs9835_dev *dev,
+			   __u32 __user *arg);
+
+static long ioctl_set_excl(struct mcs9835_dev *dev,
+			   struct file *file,
+			   __u32 __user *arg);
+
+static long ioctl_file_stats(struct mcs9835_parport_file *pfile,
+			     void __user *arg);
+
+static long ioctl_pin_op(struct mcs9835_dev *dev,
+			 unsigned int cmd,
+			 void __user *arg);
+
+static u8 pin_op_value(unsigned int cmd,
+		       u8 value,
+		       u8 mask);
+
+static int parport_isr(struct mcs9835_dev *dev);
+
+static void parport_event(struct mcs9835_dev *dev,
+			  s64 timestamp_ns,
+			  u8 dsr);
+
+static void parport_status_seen(struct mcs9835_dev *dev,
+				s64 timestamp_ns,
+				const u8 *dsr,
+				size_t count);
+
+static int parport_poll(struct mcs9835_hybrid *hy);
+
+static void parport_unmask(struct mcs9835_hybrid *hy);
+
+static void dump_bar_registers(const char *name,
+			       void __iomem *base,
+			       const u8 *regs,
+			       int nregs);
 static void dump_dev_registers(struct mcs9835_dev *dev);
 
 /****************************************************************************
@@ -123,12 +320,77 @@ static struct pci_driver mcs9835_pci_driver = {
  * Char driver infrastructure
  *
  ****************************************************************************/
+MCS9835_DEFINE_READ_FOP(mcs9835_fop_read_parport, mcs9835_read_parport)
+MCS9835_DEFINE_WRITE_FOP(mcs9835_fop_write_parport, mcs9835_write_parport)
+MCS9835_DEFINE_READ_FOP(mcs9835_fop_read_parport_events, 
+			mcs9835_read_parport_events)
+
 struct file_operations mcs9835_fops_parport = {
   .owner   = THIS_MODULE,
   .open    = mcs9835_open_parport,
   .release = mcs9835_close_parport,
-  .read    = (void *)mcs9835_read_parport,
-  .write   = (void *)mcs9835_write_parport,
+#ifdef MCS9835_HAVE_ITER
+  .read_iter  = mcs9835_fop_read_parport,
+  .write_iter = mcs9835_fop_write_parport,
+  .splice_write = iter_file_splice_write, /* splice() and sendfile() */
+#else
+  .read    = mcs9835_fop_read_parport,
+  .write   = mcs9835_fop_write_parport,
+#endif
+  .poll    = mcs9835_poll_parport,
+  .unlocked_ioctl = mcs9835_ioctl_parport,
+  .compat_ioctl   = mcs9835_ioctl_parport,
+  .mmap    = mcs9835_mmap_parport,
+};
+
+struct file_operations mcs9835_fops_parport_events = {
+  .owner   = THIS_MODULE,
+  .open    = mcs9835_open_parport_events,
+  .release = mcs9835_close_parport_events,
+#ifdef MCS9835_HAVE_ITER
+  .read_iter = mcs9835_fop_read_parport_events,
+#else
+  .read    = mcs9835_fop_read_parport_events,
+#endif
+  .poll    = mcs9835_poll_parport_events,
+};
+
+/****************************************************************************
+ *
+ * Sysfs register window
+ *
+ ****************************************************************************/
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,16,0)
+#define MCS9835_BIN_ATTR_CONST const
+#else
+#define MCS9835_BIN_ATTR_CONST
+#endif
+
+static ssize_t regs_window_read(struct file *filp,
+				struct kobject *kobj,
+				MCS9835_BIN_ATTR_CONST struct bin_attribute *attr,
+				char *buf,
+				loff_t off,
+				size_t count)
+{
+  return regs_window_xfer(kobj, buf, off, count, 0);
+}
+
+static ssize_t regs_window_write(struct file *filp,
+				 struct kobject *kobj,
+				 MCS9835_BIN_ATTR_CONST struct bin_attribute *attr,
+				 char *buf,
+				 loff_t off,
+				 size_t count)
+{
+  return regs_window_xfer(kobj, buf, off, count, 1);
+}
+
+static struct bin_attribute mcs9835_regs_attr = {
+  .attr  = { .name = "regs", .mode = S_IRUSR | S_IWUSR },
+  .size  = MCS9835_NUM_BARS * MCS9835_REG_WINDOW_STRIDE,
+  .read  = regs_window_read,
+  .write = regs_window_write,
 };
 
 /****************************************************************************
@@ -137,11 +399,20 @@ struct file_operations mcs9835_fops_parport = {
  *
  ****************************************************************************/
 
-/* Device private data, allocated in mcs9835_initialize() */
-static struct mcs9835_dev *mcs9835_devices = NULL;
+/* Debugfs root directory, NULL if debugfs is not available */
+static struct dentry *mcs9835_debugfs = NULL;
 
-/* Keep track of devices */
-static int mcs9835_dev_idx = 0;
+/* Device index allocation, one index per probed device */
+static DEFINE_IDA(mcs9835_ida);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,19,0)
+static DEFINE_MUTEX(mcs9835_ida_mutex);
+#endif
+
+#ifdef MCS9835_FAKE_HW
+/* Emulated devices, added and removed at module load/unload */
+static struct mcs9835_dev *mcs9835_fake_devs[MCS9835_MAX_DEVICES];
+static unsigned mcs9835_fake_count = 0;
+#endif
 
 /****************************************************************************
  *
@@ -166,13 +437,12 @@ static int DEVINIT_MARK mcs9835_probe(struct pci_dev *dev,
   LOG(MCS_INF, "initialize PCI device 0x%x:0x%x\n", 
       dev->vendor, dev->device);
 
-  /* Check if maximum supported devices reached */
-  if (mcs9835_dev_idx >= MCS9835_MAX_DEVICES) {
-    LOG(MCS_ERR, "maximum supported devices reached (%d)\n", MCS9835_MAX_DEVICES);
-    rc = -EBUSY;
-    goto probe_fail_1;
+  /* Allocate device data, index and statistics */
+  mcs_dev = dev_create();
+  if (IS_ERR(mcs_dev)) {
+    return PTR_ERR(mcs_dev);
   }
-  mcs_dev = &mcs9835_devices[mcs9835_dev_idx];
+  mcs_dev->pci_dev = dev;
 
   /* Enable this device */
   rc = pci_enable_device(dev);
@@ -231,65 +501,16 @@ static int DEVINIT_MARK mcs9835_probe(struct pci_dev *dev,
     goto probe_fail_3;
   }
 
-  /* Initialize cdev class */
-  rc = mcs9835_cdev_initialize(mcs_dev, mcs9835_dev_idx);
-  if (rc) {    
-    goto probe_fail_3;
-  }
-
-  /* Add character device UART-A */
-  rc = mcs9835_cdev_create(mcs_dev,
-			   mcs9835_dev_idx,
-			   MCS9835_CDEV_IDX_UART_A,
-			   NULL);
-  if (rc) {
-    LOG(MCS_ERR, "add character device UART-A failed\n");
-    goto probe_fail_4;
-  }
-
-  /* Add character device UART-B */
-  rc = mcs9835_cdev_create(mcs_dev,
-			   mcs9835_dev_idx,
-			   MCS9835_CDEV_IDX_UART_B,
-			   NULL);
-  if (rc) {
-    LOG(MCS_ERR, "add character device UART-B failed\n");
-    goto probe_fail_5;
-  }
-
-  /* Add character device PARPORT */
-  rc = mcs9835_cdev_create(mcs_dev,
-			   mcs9835_dev_idx,
-			   MCS9835_CDEV_IDX_PARPORT,
-			   &mcs9835_fops_parport);
+  /* Hardware independent part */
+  mcs_dev->parent = &dev->dev;
+  mcs_dev->irq    = dev->irq;
+  rc = dev_attach(mcs_dev);
   if (rc) {
-    LOG(MCS_ERR, "add character device PARPORT failed\n");
-    goto probe_fail_6;
+    goto probe_fail_3;
   }
 
-  /* Set private driver data pointer*/
-  pci_set_drvdata(dev, (void *)mcs_dev);
-  mcs_dev->pci_dev = dev;
-
-  /* Another device has been initialized */
-  mcs_dev->dev_idx   = mcs9835_dev_idx++;
-  mcs_dev->init_done = 1;
-  LOG(MCS_INI, "initialize PCI device %d/%d done\n",
-      mcs9835_dev_idx, MCS9835_MAX_DEVICES);
-
-  dump_dev_registers(mcs_dev);
-
   return 0;
 
-probe_fail_6:
-  mcs9835_cdev_destroy(mcs_dev, MCS9835_CDEV_IDX_UART_B);
-
- probe_fail_5:
-  mcs9835_cdev_destroy(mcs_dev, MCS9835_CDEV_IDX_UART_A);
-
- probe_fail_4:
-  mcs9835_cdev_finalize(mcs_dev);
-
  probe_fail_3:
   if (mcs_dev->vmem_bar0 != NULL) {
     pci_iounmap(dev, mcs_dev->vmem_bar0);
@@ -309,6 +530,8 @@ probe_fail_6:
   pci_disable_device(dev); /* Disable this device */
 
  probe_fail_1:
+  dev_destroy(mcs_dev);
+
   return rc;
 }
 
@@ -330,11 +553,8 @@ static void DEVEXIT_MARK mcs9835_remove(struct pci_dev *dev)
   if ( (mcs_dev != NULL) &&
        (mcs_dev-> init_done) ) {
 
-    /* Remove character devices */
-    mcs9835_cdev_destroy(mcs_dev, MCS9835_CDEV_IDX_UART_A);
-    mcs9835_cdev_destroy(mcs_dev, MCS9835_CDEV_IDX_UART_B);
-    mcs9835_cdev_destroy(mcs_dev, MCS9835_CDEV_IDX_PARPORT);
-    mcs9835_cdev_finalize(mcs_dev);
+    /* Hardware independent part */
+    dev_detach(mcs_dev);
 
     /* Unmap all BARs */
     pci_iounmap(dev, mcs_dev->vmem_bar0);
@@ -348,293 +568,2346 @@ static void DEVEXIT_MARK mcs9835_remove(struct pci_dev *dev)
     /* Disable this device */
     pci_disable_device(dev);
 
-    LOG(MCS_INI, "finalize PCI device %d/%d done\n",
-	mcs9835_dev_idx, MCS9835_MAX_DEVICES);
+    LOG(MCS_INI, "finalize PCI device %d done\n", mcs_dev->dev_idx);
 
-    mcs_dev-> init_done = 0;
-    mcs9835_dev_idx--;
+    pci_set_drvdata(dev, NULL);
+    dev_destroy(mcs_dev);
   }
 }
 
 /****************************************************************************
  *
- * File operation functions
+ * Device functions, independent of the bus
  *
  ****************************************************************************/
 
 /****************************************************************************/
 
-static int mcs9835_open_parport(struct inode *inode, 
-				struct file  *file)
+/*
+ * Allocate device data, device index and statistics.
+ * Returns device data, or ERR_PTR.
+ */
+static struct mcs9835_dev *dev_create(void)
 {
   struct mcs9835_dev *mcs_dev = NULL;
+  int rc;
 
-  /*
-   * Get device private data
-   * and check that device is ok.
-   */
-  mcs_dev = container_of(inode->i_cdev, 
-			 struct mcs9835_dev, 
-			 chr[MCS9835_CDEV_IDX_PARPORT].cdev);
-  if (mcs_dev == NULL) {    
-    return -ENODEV;
+  /* Allocate device data */
+  mcs_dev = kzalloc(sizeof(struct mcs9835_dev), GFP_KERNEL);
+  if (mcs_dev == NULL) {
+    LOG(MCS_ERR, "allocate device data failed\n");
+    return ERR_PTR(-ENOMEM);
   }
+  initialize_dev_data(mcs_dev);
 
-  if (!mcs_dev->init_done) {
-    return -ENODEV;
+  /* Check if maximum supported devices reached */
+  rc = dev_idx_get();
+  if (rc < 0) {
+    LOG(MCS_ERR, "maximum supported devices reached (%d)\n", MCS9835_MAX_DEVICES);
+    goto create_fail_1;
   }
+  mcs_dev->dev_idx = rc;
 
-  /* Store device data for other methods */
-  file->private_data = mcs_dev;
+  /* Statistics, per CPU counters freed with device data */
+  rc = mcs9835_stats_dev_initialize(mcs_dev, mcs9835_debugfs);
+  if (rc) {
+    LOG(MCS_ERR, "allocate statistics failed\n");
+    goto create_fail_2;
+  }
 
-  LOG(MCS_CDV, "open /dev/%s_%d_%d\n",
-      DRV_NAME, mcs_dev->dev_idx, MCS9835_CDEV_IDX_PARPORT);
+  return mcs_dev;
 
-  return 0;
+ create_fail_2:
+  mcs9835_stats_dev_remove(mcs_dev);
+  dev_idx_put(mcs_dev->dev_idx);
+
+ create_fail_1:
+  mcs9835_dev_put(mcs_dev); /* Free device data */
+
+  return ERR_PTR(rc);
 }
 
 /****************************************************************************/
 
-static int mcs9835_close_parport(struct inode *inode, 
-				 struct file  *file)
+/*
+ * Undo dev_create, device data is kept until the last file is closed.
+ */
+static void dev_destroy(struct mcs9835_dev *mcs_dev)
 {
-  struct mcs9835_dev *mcs_dev = NULL;
-
-  /* Get device private data */
-  mcs_dev = file->private_data;
-  if (mcs_dev == NULL) {    
-    return -ENODEV;
-  }
-
-  LOG(MCS_CDV, "close /dev/%s_%d_%d\n",
-      DRV_NAME, mcs_dev->dev_idx, MCS9835_CDEV_IDX_PARPORT);
-
-  return 0;
+  mcs9835_stats_dev_remove(mcs_dev);
+  dev_idx_put(mcs_dev->dev_idx);
+  mcs9835_dev_put(mcs_dev);
 }
 
 /****************************************************************************/
 
-static ssize_t mcs9835_read_parport(const struct file *file,
-				    const char __user *buf, 
-				    size_t count,
-				    loff_t *pos)
+/*
+ * Bring up a device with mapped BARs, parent device and IRQ set.
+ * Initializes ports, installs the interrupt handler and adds
+ * the character devices.
+ */
+static int dev_attach(struct mcs9835_dev *mcs_dev)
 {
-  struct mcs9835_dev *mcs_dev = NULL;
-  u8 data;
+  int rc;
 
-  /* Get device private data */
-  mcs_dev = file->private_data;
-  if (mcs_dev == NULL) {    
-    return -ENODEV;
+  /* Registers as found, before the interrupt handler and users */
+  if (mcs_log_level & MCS_INF) {
+    dump_dev_registers(mcs_dev);
   }
 
-  /* Check user input */
-  if (count != 1) {
+  /* Output register copies start from the hardware state */
+  mcs_dev->parport_dpr = parport_read_reg(mcs_dev, MCS9835_PARPORT_REG_DPR);
+  mcs_dev->parport_dcr = parport_read_reg(mcs_dev, MCS9835_PARPORT_REG_DCR);
+
+  /* Parallel port starts in standard mode */
+  mcs_dev->parport_ecr = parport_probe_ecr(mcs_dev);
+  LOG(MCS_INI, "parallel port ECR %s\n", 
+      (mcs_dev->parport_ecr ? "found" : "not found"));
+
+  /* Initialize UARTs */
+  if ( (baudrate == 0) || (baudrate > MCS9835_UART_BASE_BAUD) ) {
+    LOG(MCS_ERR, "unsupported baudrate %u\n", baudrate);
     return -EINVAL;
   }
+  rc = mcs9835_uart_initialize(mcs_dev, 
+			       MCS9835_UART_IDX_A,
+			       MCS9835_CDEV_IDX_UART_A,
+			       mcs_dev->vmem_bar0,
+			       baudrate);
+  if (rc) {
+    return rc;
+  }
+  rc = mcs9835_uart_initialize(mcs_dev, 
+			       MCS9835_UART_IDX_B,
+			       MCS9835_CDEV_IDX_UART_B,
+			       mcs_dev->vmem_bar1,
+			       baudrate);
+  if (rc) {
+    return rc;
+  }
 
-  /* Read data from port */
-  data = parport_read_reg(mcs_dev, MCS9835_PARPORT_REG_DSR);
-
-  /* Return data to user */
-  if (copy_to_user((u8 *)buf, &data, 1)) {
-    return -EFAULT;
+  /* Allocate parallel port status event FIFO */
+  rc = kfifo_alloc(&mcs_dev->parport_events, 
+		   MCS9835_PARPORT_EVENTS, 
+		   GFP_KERNEL);
+  if (rc) {
+    LOG(MCS_ERR, "allocate parallel port event FIFO failed\n");
+    return rc;
   }
 
-  return 1;
-}
+  /* Parallel port playback */
+  rc = mcs9835_play_initialize(mcs_dev);
+  if (rc) {
+    return rc;
+  }
 
-/****************************************************************************/
+  /* Parallel port status sampling */
+  mcs9835_sample_initialize(mcs_dev);
+
+  /* Status capture polled under sustained interrupt load */
+  mcs9835_hybrid_initialize(&mcs_dev->parport_hybrid, mcs_dev,
+			    parport_poll, parport_unmask,
+			    MCS9835_PARPORT_POLL_NS,
+			    MCS9835_HYBRID_PARPORT_WINDOW_NS,
+			    MCS9835_HYBRID_PARPORT_ENTER);
+
+  /* Install interrupt handler, the IRQ line may be shared */
+  LOG(MCS_INI, "request IRQ %u\n", mcs_dev->irq);
+  mcs_dev->parport_last_dsr = (parport_read_reg(mcs_dev,
+						MCS9835_PARPORT_REG_DSR) |
+			       MCS9835_PARPORT_DSR_NIRQ);
+  rc = dev_request_irq(mcs_dev);
+  if (rc) {
+    LOG(MCS_ERR, "request_irq failed for IRQ %u\n", mcs_dev->irq);
+    return rc;
+  }
+  parport_enable_irq(mcs_dev, 1);
 
-static ssize_t mcs9835_write_parport(const struct file *file,
-				     const char __user *buf, 
-				     size_t count,
-				     loff_t *pos)
-{
-  struct mcs9835_dev *mcs_dev = NULL;
-  u8 data;
+  /* Add character device UART-A */
+  rc = mcs9835_cdev_create(mcs_dev,
+			   mcs_dev->dev_idx,
+			   MCS9835_CDEV_IDX_UART_A,
+			   &mcs9835_fops_uart);
+  if (rc) {
+    LOG(MCS_ERR, "add character device UART-A failed\n");
+    goto attach_fail_1;
+  }
 
-  /* Get device private data */
-  mcs_dev = file->private_data;
-  if (mcs_dev == NULL) {    
-    return -ENODEV;
+  /* Add character device UART-B */
+  rc = mcs9835_cdev_create(mcs_dev,
+			   mcs_dev->dev_idx,
+			   MCS9835_CDEV_IDX_UART_B,
+			   &mcs9835_fops_uart);
+  if (rc) {
+    LOG(MCS_ERR, "add character device UART-B failed\n");
+    goto attach_fail_2;
   }
 
-  /* Check user input */
-  if (count != 1) {
-    return -EINVAL;
+  /* Add character device PARPORT */
+  rc = mcs9835_cdev_create(mcs_dev,
+			   mcs_dev->dev_idx,
+			   MCS9835_CDEV_IDX_PARPORT,
+			   &mcs9835_fops_parport);
+  if (rc) {
+    LOG(MCS_ERR, "add character device PARPORT failed\n");
+    goto attach_fail_3;
   }
-  
-  /* Get data from user */
-  if (copy_from_user(&data, (u8 *)buf, 1)) {
-    return -EFAULT;
+
+  /* Add character device PARPORT events */
+  rc = mcs9835_cdev_create(mcs_dev,
+			   mcs_dev->dev_idx,
+			   MCS9835_CDEV_IDX_PARPORT_EVT,
+			   &mcs9835_fops_parport_events);
+  if (rc) {
+    LOG(MCS_ERR, "add character device PARPORT events failed\n");
+    goto attach_fail_4;
   }
 
-  /* Write data to port */
-  parport_write_reg(mcs_dev,
-		    MCS9835_PARPORT_REG_DPR,
-		    data);
-  return 1;
-}
+  /* Set private driver data pointer*/
+  dev_set_drvdata(mcs_dev->parent, (void *)mcs_dev);
 
-/****************************************************************************
- *
- * Module load/unload functions
- *
- ****************************************************************************/
-module_init(mcs9835_initialize);
-module_exit(mcs9835_finalize);
+  /* Another device has been initialized */
+  mcs_dev->init_done = 1;
+  LOG(MCS_INI, "initialize device %d done\n", mcs_dev->dev_idx);
 
-/****************************************************************************/
+  /* Register window, for diagnostics the device works without it */
+  if (sysfs_create_bin_file(&mcs_dev->parent->kobj, &mcs9835_regs_attr)) {
+    LOG(MCS_WRN, "create register window failed\n");
+  }
 
-/*
- * Initialize this kernel module.
- * Executed when the module is loaded.
- */
-static int __init mcs9835_initialize(void)
-{
-  int i;
-  int rc;
+  /* Parallel port pins for GPIO consumers */
+  mcs9835_gpio_initialize(mcs_dev);
 
-  printk(KERN_INFO DRV_NAME " loading driver %s-%s\n",
-	 DRV_PRODUCT_NUMBER, DRV_RSTATE);
+  /* Hybrid interrupt/polling settings and counters */
+  mcs9835_hybrid_sysfs_create(mcs_dev);
 
-  /* Update initial loglevel list with current settings */
-  mcs_set_log_level(mcs_log_level, MCS_ENABLE);
-  if (loglevel) {
-    mcs_set_log_level(loglevel, MCS_ENABLE);
-  }
+  return 0;
 
-  /* Display current loglevel configuration in syslog */
-  mcs_display_log_levels();
+ attach_fail_4:
+  mcs9835_cdev_destroy(mcs_dev, MCS9835_CDEV_IDX_PARPORT);
 
-  /* Allocate device data */
-  mcs9835_devices = kmalloc(MCS9835_MAX_DEVICES * sizeof(struct mcs9835_dev), GFP_KERNEL);
-  if (mcs9835_devices == NULL) {
-    LOG(MCS_ERR, "allocate device data failed\n");
-    rc = -ENOMEM;
-    goto init_fail;
-  }
-  memset(mcs9835_devices, 0, MCS9835_MAX_DEVICES * sizeof(struct mcs9835_dev));
+ attach_fail_3:
+  mcs9835_cdev_destroy(mcs_dev, MCS9835_CDEV_IDX_UART_B);
 
-  /* Initialize device data */
-  for (i=0; i < MCS9835_MAX_DEVICES; i++) {
-    initialize_dev_data(&mcs9835_devices[i]);
-  }
+ attach_fail_2:
+  mcs9835_cdev_destroy(mcs_dev, MCS9835_CDEV_IDX_UART_A);
 
-  /* Register driver with PCI core */
-  return pci_register_driver(&mcs9835_pci_driver);
+ attach_fail_1:
+  parport_enable_irq(mcs_dev, 0);
+  dev_free_irq(mcs_dev);
 
- init_fail:
   return rc;
 }
 
 /****************************************************************************/
 
 /*
- * Finalize this kernel module.
- * Executed when the module is unloaded.
+ * Take down an attached device, the BARs are still mapped on return
+ * but no longer accessed.
  */
-static void __exit mcs9835_finalize(void)
+static void dev_detach(struct mcs9835_dev *mcs_dev)
 {
-  LOG(MCS_INF, "unloading driver\n");
+  /* Remove GPIO chip and sysfs files, waits for ongoing access */
+  mcs9835_hybrid_sysfs_remove(mcs_dev);
+  mcs9835_gpio_remove(mcs_dev);
+  sysfs_remove_bin_file(&mcs_dev->parent->kobj, &mcs9835_regs_attr);
 
-  /* Unregister driver from PCI core */
-  pci_unregister_driver(&mcs9835_pci_driver);
+  /* Remove character devices */
+  mcs9835_cdev_destroy(mcs_dev, MCS9835_CDEV_IDX_UART_A);
+  mcs9835_cdev_destroy(mcs_dev, MCS9835_CDEV_IDX_UART_B);
+  mcs9835_cdev_destroy(mcs_dev, MCS9835_CDEV_IDX_PARPORT);
+  mcs9835_cdev_destroy(mcs_dev, MCS9835_CDEV_IDX_PARPORT_EVT);
+  mcs9835_stats_dev_remove(mcs_dev);
+
+  /* 
+   * Stop hardware access from files still open.
+   * Device data is kept until the last file is closed.
+   */
+  mutex_lock(&mcs_dev->parport_mutex);
+  mcs_dev-> init_done = 0;
+  mutex_unlock(&mcs_dev->parport_mutex);
+  wake_up_interruptible(&mcs_dev->parport_event_wq);
+  mcs9835_play_stop(mcs_dev);
+  mcs9835_sample_stop(mcs_dev);
+  mcs9835_hybrid_stop(&mcs_dev->parport_hybrid);
+
+  /* Leave parallel port in standard mode */
+  mutex_lock(&mcs_dev->parport_mutex);
+  parport_set_mode(mcs_dev, MCS9835_PARPORT_MODE_SPP);
+  mutex_unlock(&mcs_dev->parport_mutex);
+
+  mcs9835_uart_remove(mcs_dev, MCS9835_UART_IDX_A);
+  mcs9835_uart_remove(mcs_dev, MCS9835_UART_IDX_B);
+
+  /* Remove interrupt handler */
+  parport_enable_irq(mcs_dev, 0);
+  dev_free_irq(mcs_dev);
+}
+
+/****************************************************************************/
+
+static int dev_request_irq(struct mcs9835_dev *mcs_dev)
+{
+#ifdef MCS9835_FAKE_HW
+  if (mcs_dev->fake != NULL) {
+    return mcs9835_fake_request_irq(mcs_dev->fake, mcs9835_isr, mcs_dev);
+  }
+#endif
+  return request_irq(mcs_dev->irq,
+		     mcs9835_isr,
+		     IRQF_SHARED,
+		     DRV_NAME,
+		     mcs_dev);
+}
+
+/****************************************************************************/
 
-  /* Free all device data */
-  if (mcs9835_devices != NULL) {
-    kfree(mcs9835_devices);
+static void dev_free_irq(struct mcs9835_dev *mcs_dev)
+{
+#ifdef MCS9835_FAKE_HW
+  if (mcs_dev->fake != NULL) {
+    mcs9835_fake_free_irq(mcs_dev->fake);
+    return;
   }
+#endif
+  free_irq(mcs_dev->irq, mcs_dev);
 }
 
+#ifdef MCS9835_FAKE_HW
 /****************************************************************************
  *
- * Support functions
+ * Emulated devices
  *
  ****************************************************************************/
 
 /****************************************************************************/
 
-static void initialize_dev_data(struct mcs9835_dev *dev)
+/*
+ * Add an emulated device, as probe for a PCI device.
+ */
+static int fake_dev_add(void)
 {
-  int i;
+  struct mcs9835_dev *mcs_dev = NULL;
+  struct mcs9835_fake *fake;
+  int rc;
 
-  /* PCI */
-  dev->pci_dev = NULL;
+  /* Allocate device data, index and statistics */
+  mcs_dev = dev_create();
+  if (IS_ERR(mcs_dev)) {
+    return PTR_ERR(mcs_dev);
+  }
 
-  dev->vmem_bar0 = NULL;
-  dev->vmem_bar1 = NULL;
-  dev->vmem_bar2 = NULL;
-  dev->vmem_bar3 = NULL;
+  fake = mcs9835_fake_create(mcs_dev->dev_idx);
+  if (IS_ERR(fake)) {
+    LOG(MCS_ERR, "create emulated device failed\n");
+    rc = PTR_ERR(fake);
+    goto fake_fail_1;
+  }
+  mcs_dev->fake = fake;
 
-  /* Character devices */
-  dev->class = NULL;
-  for (i=0; i < MCS9835_MAX_CDEVS; i++) {
-    memset(&dev->chr[i], 0, sizeof(struct mcs9835_char));   
+  mcs_dev->vmem_bar0 = mcs9835_fake_bar(fake, MCS9835_BAR_UART_A);
+  mcs_dev->vmem_bar1 = mcs9835_fake_bar(fake, MCS9835_BAR_UART_B);
+  mcs_dev->vmem_bar2 = mcs9835_fake_bar(fake, MCS9835_BAR_PARPORT);
+  mcs_dev->vmem_bar3 = mcs9835_fake_bar(fake, MCS9835_BAR_CONFIG);
+
+  /* Hardware independent part */
+  mcs_dev->parent = mcs9835_fake_device(fake);
+  mcs_dev->irq    = 0;
+  rc = dev_attach(mcs_dev);
+  if (rc) {
+    goto fake_fail_2;
   }
 
-  /* Misc */
-  dev->dev_idx   = 0;
-  dev->init_done = 0;
+  mcs9835_fake_devs[mcs9835_fake_count++] = mcs_dev;
+
+  return 0;
+
+ fake_fail_2:
+  mcs9835_fake_destroy(fake);
+
+ fake_fail_1:
+  dev_destroy(mcs_dev);
+
+  return rc;
 }
 
 /****************************************************************************/
 
-static void parport_write_reg(struct mcs9835_dev *dev,
-			      unsigned bar_offset,
-			      u8 value)
+static void fake_dev_remove_all(void)
 {
-  LOG(MCS_REG, "PARPORT[%u] <- 0x%02x\n", bar_offset, value);
+  struct mcs9835_dev *mcs_dev;
 
-  /* Parallel port is at BAR2 */
-  iowrite8(value, dev->vmem_bar2 + bar_offset);
+  while (mcs9835_fake_count > 0) {
+    mcs_dev = mcs9835_fake_devs[--mcs9835_fake_count];
+
+    dev_detach(mcs_dev);
+    dev_set_drvdata(mcs_dev->parent, NULL);
+    mcs9835_fake_destroy(mcs_dev->fake);
+
+    LOG(MCS_INI, "finalize emulated device %d done\n", mcs_dev->dev_idx);
+
+    dev_destroy(mcs_dev);
+  }
+}
+#endif /* MCS9835_FAKE_HW */
+
+/****************************************************************************
+ *
+ * Exported functions
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+void mcs9835_dev_get(struct mcs9835_dev *dev)
+{
+  kref_get(&dev->kref);
 }
 
 /****************************************************************************/
 
-static u8 parport_read_reg(struct mcs9835_dev *dev,
-			   unsigned bar_offset)
+void mcs9835_dev_put(struct mcs9835_dev *dev)
 {
-  u8 value;
+  kref_put(&dev->kref, release_dev_data);
+}
 
-  /* Parallel port is at BAR2 */
-  value = ioread8(dev->vmem_bar2 + bar_offset);
+/****************************************************************************/
+
+/*
+ * Check one register operation.
+ * Returns 0, or -EINVAL.
+ */
+int mcs9835_reg_op_check(struct mcs9835_dev *dev,
+			 const struct mcs9835_reg_op *op)
+{
+  if ( (op->bar >= MCS9835_NUM_BARS) ||
+       (op->offset >= bar_len(dev, op->bar)) ||
+       (op->op > MCS9835_REG_OP_WRITE) ||
+       (op->delay_ns > MCS9835_REG_DELAY_MAX_NS) ) {
+    return -EINVAL;
+  }
+  return 0;
+}
 
-  LOG(MCS_REG, "PARPORT[%u] -> 0x%02x\n", bar_offset, value);
+/****************************************************************************/
 
-  return value;
+/*
+ * Read the status register, recording a pending nAck interrupt.
+ * All status reads outside this file go through here.
+ */
+u8 mcs9835_parport_read_dsr(struct mcs9835_dev *dev)
+{
+  return parport_read_reg(dev, MCS9835_PARPORT_REG_DSR);
+}
+
+/****************************************************************************/
+
+/*
+ * Execute one checked register operation, value read is returned
+ * in the operation. Called with parport mutex held, UART registers
+ * are accessed under the UART lock. Long delays sleep, a full batch
+ * would otherwise spin the CPU for tens of milliseconds.
+ */
+void mcs9835_reg_op_execute(struct mcs9835_dev *dev,
+			    struct mcs9835_reg_op *op)
+{
+  unsigned long us;
+
+  if (op->op == MCS9835_REG_OP_WRITE) {
+    bar_write_reg(dev, op->bar, op->offset, op->value);
+  } else {
+    op->value = bar_read_reg(dev, op->bar, op->offset);
+  }
+
+  if (op->delay_ns >= MCS9835_REG_SLEEP_MIN_NS) {
+    us = DIV_ROUND_UP(op->delay_ns, 1000);
+    usleep_range(us, us + us / 4);
+    return;
+  }
+  if (op->delay_ns >= 1000) {
+    udelay(op->delay_ns / 1000);
+  }
+  if (op->delay_ns % 1000) {
+    ndelay(op->delay_ns % 1000);
+  }
 }
 
+/****************************************************************************
+ *
+ * File operation functions
+ *
+ ****************************************************************************/
 
 /****************************************************************************/
 
-static void dump_dev_registers(struct mcs9835_dev *dev)
+static int mcs9835_open_parport(struct inode *inode, 
+				struct file  *file)
 {
-  int i;
-  u8 reg_data;
+  struct mcs9835_dev *mcs_dev = NULL;
+  struct mcs9835_parport_file *pfile = NULL;
+  int rc = 0;
+
+  /*
+   * Get device private data
+   * and check that device is ok.
+   */
+  mcs_dev = container_of(inode->i_cdev, 
+			 struct mcs9835_dev, 
+			 chr[MCS9835_CDEV_IDX_PARPORT].cdev);
+  if (mcs_dev == NULL) {    
+    return -ENODEV;
+  }
+
+  if (!mcs_dev->init_done) {
+    return -ENODEV;
+  }
 
-  LOG(MCS_INF, "BAR0 - UART-A\n");
-  for (i=0; i < 8; i++) {
-    reg_data = ioread8(dev->vmem_bar0 + i);
-    LOG(MCS_INF, "  [%d] = 0x%02x\n", i, reg_data);
+  /* Allocate open file data */
+  pfile = kzalloc(sizeof(struct mcs9835_parport_file), GFP_KERNEL);
+  if (pfile == NULL) {
+    return -ENOMEM;
   }
+  pfile->buf = kmalloc(MCS9835_PARPORT_BUF_SIZE, GFP_KERNEL);
+  if (pfile->buf == NULL) {
+    rc = -ENOMEM;
+    goto open_fail;
+  }
+  mutex_init(&pfile->mutex);
+  pfile->dev = mcs_dev;
+
+  /* Exclusive use keeps others out */
+  spin_lock(&mcs_dev->parport_open_lock);
+  if ( (mcs_dev->parport_excl != NULL) ||
+       ((file->f_flags & O_EXCL) && (mcs_dev->parport_users > 0)) ) {
+    spin_unlock(&mcs_dev->parport_open_lock);
+    rc = -EBUSY;
+    goto open_fail;
+  }
+  if (file->f_flags & O_EXCL) {
+    mcs_dev->parport_excl = file;
+  }
+  mcs_dev->parport_users++;
+  spin_unlock(&mcs_dev->parport_open_lock);
+
+  /* Keep device data until closed */
+  mcs9835_dev_get(mcs_dev);
+
+  /* Store open file data for other methods */
+  file->private_data = pfile;
+
+  LOG(MCS_CDV, "open /dev/%s_%d_%d%s\n",
+      DRV_NAME, mcs_dev->dev_idx, MCS9835_CDEV_IDX_PARPORT,
+      (file->f_flags & O_EXCL ? " (exclusive)" : ""));
+
+  return 0;
+
+ open_fail:
+  kfree(pfile->buf);
+  kfree(pfile);
+
+  return rc;
+}
+
+/****************************************************************************/
+
+static int mcs9835_close_parport(struct inode *inode, 
+				 struct file  *file)
+{
+  struct mcs9835_parport_file *pfile = NULL;
+  struct mcs9835_dev *mcs_dev = NULL;
+
+  /* Get open file data */
+  pfile = file->private_data;
+  if (pfile == NULL) {    
+    return -ENODEV;
+  }
+  mcs_dev = pfile->dev;
+
+  LOG(MCS_CDV, "close /dev/%s_%d_%d\n",
+      DRV_NAME, mcs_dev->dev_idx, MCS9835_CDEV_IDX_PARPORT);
+
+  /* Playback ends with the file that started it */
+  if (mcs_dev->play_owner == file) {
+    mcs9835_play_stop(mcs_dev);
+  }
+
+  spin_lock(&mcs_dev->parport_open_lock);
+  mcs_dev->parport_users--;
+  if (mcs_dev->parport_excl == file) {
+    mcs_dev->parport_excl = NULL;
+  }
+  spin_unlock(&mcs_dev->parport_open_lock);
+
+  file->private_data = NULL;
+  mcs9835_ring_release(pfile);
+  kfree(pfile->buf);
+  kfree(pfile);
+
+  mcs9835_dev_put(mcs_dev);
+
+  return 0;
+}
+
+/****************************************************************************/
+
+/*
+ * Read transfer, for read() and asynchronous submission.
+ */
+static ssize_t mcs9835_read_parport(struct file *file,
+				    struct mcs9835_ubuf *ub,
+				    loff_t pos)
+{
+  struct mcs9835_parport_file *pfile = NULL;
+  struct mcs9835_dev *mcs_dev = NULL;
+  size_t count = mcs9835_ubuf_count(ub);
+  ssize_t rc = 0;
+  size_t done = 0;
+  size_t len;
+  ssize_t nread = 0;
+  s64 start_ns = mcs9835_stats_start();
+
+  /* Get open file data */
+  pfile = file->private_data;
+  if (pfile == NULL) {    
+    return -ENODEV;
+  }
+  mcs_dev = pfile->dev;
+
+  if (count == 0) {
+    return 0;
+  }
+
+  if (mutex_lock_interruptible(&pfile->mutex)) {
+    return -ERESTARTSYS;
+  }
+
+  /*
+   * Read from port into the transfer buffer,
+   * one buffer at a time, and return it to user.
+   * The port is held for one buffer, not while copying.
+   */
+  while (done < count) {
+    len = min_t(size_t, count - done, MCS9835_PARPORT_BUF_SIZE);
+
+    if (mutex_lock_interruptible(&mcs_dev->parport_mutex)) {
+      rc = -ERESTARTSYS;
+      break;
+    }
+    rc = parport_xfer_check(mcs_dev, pos, 0);
+    if (rc == 0) {
+      /* Read data from port, in current mode */
+      nread = parport_read(mcs_dev, pfile->buf, len, pos);
+    }
+    mutex_unlock(&mcs_dev->parport_mutex);
+    if (rc) {
+      break;
+    }
+    if (nread < 0) {
+      rc = nread;
+      break;
+    }
+
+    /* Return data to user */
+    rc = mcs9835_ubuf_to_user(ub, pfile->buf, len);
+    if (rc) {
+      break;
+    }
+    done += len;
+
+    /* Large transfers, let others in between buffers */
+    if (done < count) {
+      if (signal_pending(current)) {
+	rc = -ERESTARTSYS;
+	break;
+      }
+      cond_resched();
+    }
+  }
+
+  rc = (done ? done : rc);
+  parport_file_stats(pfile, 0, rc);
+
+  mutex_unlock(&pfile->mutex);
+
+  mcs9835_stats_io(mcs_dev->chr[MCS9835_CDEV_IDX_PARPORT].stats,
+		   MCS9835_HIST_READ, rc, start_ns);
 
-  LOG(MCS_INF, "BAR1 - UART-B\n");
-  for (i=0; i < 8; i++) {
-    reg_data = ioread8(dev->vmem_bar1 + i);
-    LOG(MCS_INF, "  [%d] = 0x%02x\n", i, reg_data);
+  return rc;
+}
+
+/****************************************************************************/
+
+/*
+ * Write transfer, for write() and asynchronous submission.
+ */
+static ssize_t mcs9835_write_parport(struct file *file,
+				     struct mcs9835_ubuf *ub,
+				     loff_t pos)
+{
+  struct mcs9835_parport_file *pfile = NULL;
+  struct mcs9835_dev *mcs_dev = NULL;
+  size_t count = mcs9835_ubuf_count(ub);
+  ssize_t rc = 0;
+  size_t done = 0;
+  size_t len;
+  ssize_t written = 0;
+  s64 start_ns = mcs9835_stats_start();
+
+  /* Get open file data */
+  pfile = file->private_data;
+  if (pfile == NULL) {    
+    return -ENODEV;
+  }
+  mcs_dev = pfile->dev;
+
+  if (count == 0) {
+    return 0;
+  }
+
+  if (mutex_lock_interruptible(&pfile->mutex)) {
+    return -ERESTARTSYS;
+  }
+
+  /*
+   * Get data from user into the transfer buffer, 
+   * one buffer at a time, and stream it to the port.
+   * The port is held for one buffer, not while copying.
+   */
+  while (done < count) {
+    len = min_t(size_t, count - done, MCS9835_PARPORT_BUF_SIZE);
+
+    /* Get data from user */
+    rc = mcs9835_ubuf_from_user(ub, pfile->buf, len);
+    if (rc) {
+      break;
+    }
+
+    if (mutex_lock_interruptible(&mcs_dev->parport_mutex)) {
+      rc = -ERESTARTSYS;
+      break;
+    }
+    rc = parport_xfer_check(mcs_dev, pos, 1);
+    if (rc == 0) {
+      /* Write data to port, in current mode */
+      written = parport_write(mcs_dev, pfile->buf, len, pos);
+    }
+    mutex_unlock(&mcs_dev->parport_mutex);
+    if (rc) {
+      break;
+    }
+    if (written < 0) {
+      rc = written;
+      break;
+    }
+    done += written;
+    if ((size_t)written < len) {
+      break; /* Peripheral stopped handshaking */
+    }
+
+    /* Large transfers, let others in between buffers */
+    if (done < count) {
+      if (signal_pending(current)) {
+	rc = -ERESTARTSYS;
+	break;
+      }
+      cond_resched();
+    }
+  }
+
+  rc = (done ? done : rc);
+  parport_file_stats(pfile, 1, rc);
+
+  mutex_unlock(&pfile->mutex);
+
+  mcs9835_stats_io(mcs_dev->chr[MCS9835_CDEV_IDX_PARPORT].stats,
+		   MCS9835_HIST_WRITE, rc, start_ns);
+
+  return rc;
+}
+
+/****************************************************************************/
+
+/*
+ * Sampling the status register and writing the data register
+ * never wait for the hardware, the port is always readable and
+ * writable. Pending status events are signaled as priority data.
+ */
+static unsigned int mcs9835_poll_parport(struct file *file,
+					 poll_table *wait)
+{
+  struct mcs9835_parport_file *pfile = NULL;
+  struct mcs9835_dev *mcs_dev = NULL;
+  unsigned int mask = POLLIN | POLLRDNORM | POLLOUT | POLLWRNORM;
+
+  /* Get open file data */
+  pfile = file->private_data;
+  if (pfile == NULL) {    
+    return POLLERR;
+  }
+  mcs_dev = pfile->dev;
+
+  poll_wait(file, &mcs_dev->parport_event_wq, wait);
+
+  if (!mcs_dev->init_done) {
+    return POLLERR | POLLHUP;
+  }
+
+  if (!kfifo_is_empty(&mcs_dev->parport_events)) {
+    mask |= POLLPRI;
   }
 
-  LOG(MCS_INF, "BAR2 - SPPR\n");
-  for (i=0; i < 8; i++) {
-    reg_data = ioread8(dev->vmem_bar2 + i);
-    LOG(MCS_INF, "  [%d] = 0x%02x\n", i, reg_data);
+  return mask;
+}
+
+/****************************************************************************/
+
+static long mcs9835_ioctl_parport(struct file *file,
+				  unsigned int cmd,
+				  unsigned long arg)
+{
+  struct mcs9835_parport_file *pfile = NULL;
+  struct mcs9835_dev *mcs_dev = NULL;
+  long rc;
+
+  /* Get open file data */
+  pfile = file->private_data;
+  if (pfile == NULL) {    
+    return -ENODEV;
+  }
+  mcs_dev = pfile->dev;
+
+  switch (cmd) {
+  case MCS9835_IOC_REG_BATCH:
+    rc = ioctl_reg_batch(mcs_dev, (void __user *)arg);
+    break;
+  case MCS9835_IOC_SET_MODE:
+    rc = ioctl_set_mode(mcs_dev, (__u32 __user *)arg);
+    break;
+  case MCS9835_IOC_GET_MODE:
+    rc = put_user((__u32)mcs_dev->parport_mode, (__u32 __user *)arg);
+    break;
+  case MCS9835_IOC_PLAY_QUEUE:
+  case MCS9835_IOC_PLAY_START:
+  case MCS9835_IOC_PLAY_STOP:
+  case MCS9835_IOC_PLAY_STATUS:
+    rc = mcs9835_play_ioctl(mcs_dev, file, cmd, arg);
+    break;
+  case MCS9835_IOC_SAMPLE_START:
+  case MCS9835_IOC_SAMPLE_STOP:
+    rc = mcs9835_sample_ioctl(mcs_dev, cmd, arg);
+    break;
+  case MCS9835_IOC_SET_EXCL:
+    rc = ioctl_set_excl(mcs_dev, file, (__u32 __user *)arg);
+    break;
+  case MCS9835_IOC_FILE_STATS:
+    rc = ioctl_file_stats(pfile, (void __user *)arg);
+    break;
+  case MCS9835_IOC_PIN_SET:
+  case MCS9835_IOC_PIN_CLEAR:
+  case MCS9835_IOC_PIN_TOGGLE:
+    rc = ioctl_pin_op(mcs_dev, cmd, (void __user *)arg);
+    break;
+  case MCS9835_IOC_RING_SETUP:
+  case MCS9835_IOC_RING_ENTER:
+    rc = mcs9835_ring_ioctl(pfile, cmd, arg);
+    break;
+  default:
+    return -ENOTTY;
   }
 
-  LOG(MCS_INF, "BAR3\n");
-  for (i=0; i < 3; i++) {
-    reg_data = ioread8(dev->vmem_bar3 + i);
-    LOG(MCS_INF, "  [%d] = 0x%02x\n", i, reg_data);
+  if (rc < 0) {
+    mcs9835_stats_error(mcs_dev->chr[MCS9835_CDEV_IDX_PARPORT].stats, rc);
   }
+
+  return rc;
+}
+
+/****************************************************************************/
+
+/*
+ * Map the status sample ring, or the submission rings of the file.
+ * The sample ring is kept with the device data, mappings stay valid
+ * after the device is removed but no more samples are added.
+ */
+static int mcs9835_mmap_parport(struct file *file,
+				struct vm_area_struct *vma)
+{
+  struct mcs9835_parport_file *pfile = NULL;
+
+  /* Get open file data */
+  pfile = file->private_data;
+  if (pfile == NULL) {    
+    return -ENODEV;
+  }
+
+  if (vma->vm_pgoff == (MCS9835_RING_MMAP_OFFSET >> PAGE_SHIFT)) {
+    return mcs9835_ring_mmap(pfile, vma);
+  }
+  return mcs9835_sample_mmap(pfile->dev, vma);
+}
+
+/****************************************************************************/
+
+static int mcs9835_open_parport_events(struct inode *inode, 
+				       struct file  *file)
+{
+  struct mcs9835_dev *mcs_dev = NULL;
+
+  /*
+   * Get device private data
+   * and check that device is ok.
+   */
+  mcs_dev = container_of(inode->i_cdev, 
+			 struct mcs9835_dev, 
+			 chr[MCS9835_CDEV_IDX_PARPORT_EVT].cdev);
+  if (mcs_dev == NULL) {    
+    return -ENODEV;
+  }
+
+  if (!mcs_dev->init_done) {
+    return -ENODEV;
+  }
+
+  /* Keep device data until closed */
+  mcs9835_dev_get(mcs_dev);
+
+  /* Store device data for other methods */
+  file->private_data = mcs_dev;
+
+  LOG(MCS_CDV, "open /dev/%s_%d_%d\n",
+      DRV_NAME, mcs_dev->dev_idx, MCS9835_CDEV_IDX_PARPORT_EVT);
+
+  return 0;
+}
+
+/****************************************************************************/
+
+static int mcs9835_close_parport_events(struct inode *inode, 
+					struct file  *file)
+{
+  struct mcs9835_dev *mcs_dev = NULL;
+
+  /* Get device private data */
+  mcs_dev = file->private_data;
+  if (mcs_dev == NULL) {    
+    return -ENODEV;
+  }
+
+  LOG(MCS_CDV, "close /dev/%s_%d_%d\n",
+      DRV_NAME, mcs_dev->dev_idx, MCS9835_CDEV_IDX_PARPORT_EVT);
+
+  mcs9835_dev_put(mcs_dev);
+
+  return 0;
+}
+
+/****************************************************************************/
+
+/*
+ * Drain recorded status events.
+ * Returns as many whole records as are available and fit in the
+ * user buffer, blocks until at least one record is available.
+ */
+static ssize_t mcs9835_read_parport_events(struct file *file,
+					   struct mcs9835_ubuf *ub,
+					   loff_t pos)
+{
+  struct mcs9835_parport_event events[MCS9835_PARPORT_EVENT_BATCH];
+  struct mcs9835_dev *mcs_dev = NULL;
+  size_t count = mcs9835_ubuf_count(ub);
+  size_t done = 0;
+  unsigned int n;
+  ssize_t rc = 0;
+  s64 start_ns = mcs9835_stats_start();
+
+  /* Get device private data */
+  mcs_dev = file->private_data;
+  if (mcs_dev == NULL) {    
+    return -ENODEV;
+  }
+
+  /* Check user input */
+  if (count < sizeof(struct mcs9835_parport_event)) {
+    mcs9835_stats_error(mcs_dev->chr[MCS9835_CDEV_IDX_PARPORT_EVT].stats,
+			-EINVAL);
+    return -EINVAL;
+  }
+
+  if (mutex_lock_interruptible(&mcs_dev->parport_event_mutex)) {
+    return -ERESTARTSYS;
+  }
+
+  /* Wait for status events */
+  while (kfifo_is_empty(&mcs_dev->parport_events)) {
+    mutex_unlock(&mcs_dev->parport_event_mutex);
+
+    if (!mcs_dev->init_done) {
+      return -ENODEV;
+    }
+    if (file->f_flags & O_NONBLOCK) {
+      return -EAGAIN;
+    }
+    if (wait_event_interruptible(mcs_dev->parport_event_wq,
+				 !kfifo_is_empty(&mcs_dev->parport_events) ||
+				 !mcs_dev->init_done)) {
+      return -ERESTARTSYS;
+    }
+
+    if (mutex_lock_interruptible(&mcs_dev->parport_event_mutex)) {
+      return -ERESTARTSYS;
+    }
+  }
+
+  /* Return all available records that fit, a batch at a time */
+  while (count - done >= sizeof(events[0])) {
+    n = min_t(size_t, 
+	      ARRAY_SIZE(events), 
+	      (count - done) / sizeof(events[0]));
+    n = kfifo_out_peek(&mcs_dev->parport_events, events, n);
+    if (n == 0) {
+      break;
+    }
+    rc = mcs9835_ubuf_to_user(ub, events, n * sizeof(events[0]));
+    if (rc) {
+      break;
+    }
+
+    /* Remove records only when delivered */
+    kfifo_out(&mcs_dev->parport_events, events, n);
+    done += n * sizeof(events[0]);
+  }
+
+  mutex_unlock(&mcs_dev->parport_event_mutex);
+
+  rc = (done ? done : rc);
+  mcs9835_stats_io(mcs_dev->chr[MCS9835_CDEV_IDX_PARPORT_EVT].stats,
+		   MCS9835_HIST_READ, rc, start_ns);
+
+  return rc;
+}
+
+/****************************************************************************/
+
+static unsigned int mcs9835_poll_parport_events(struct file *file,
+						poll_table *wait)
+{
+  struct mcs9835_dev *mcs_dev = NULL;
+  unsigned int mask = 0;
+
+  /* Get device private data */
+  mcs_dev = file->private_data;
+  if (mcs_dev == NULL) {    
+    return POLLERR;
+  }
+
+  poll_wait(file, &mcs_dev->parport_event_wq, wait);
+
+  if (!mcs_dev->init_done) {
+    return POLLERR | POLLHUP;
+  }
+
+  if (!kfifo_is_empty(&mcs_dev->parport_events)) {
+    mask |= POLLIN | POLLRDNORM;
+  }
+
+  return mask;
+}
+
+/****************************************************************************
+ *
+ * Interrupt handling
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+/* 
+ * Device interrupt handler.
+ * The IRQ line may be shared with other devices.
+ */
+static irqreturn_t mcs9835_isr(int irq, 
+			       void *dev_id)
+{
+  struct mcs9835_dev *mcs_dev = dev_id;
+  int handled = 0;
+
+  handled |= mcs9835_uart_isr(&mcs_dev->uart[MCS9835_UART_IDX_A]);
+  handled |= mcs9835_uart_isr(&mcs_dev->uart[MCS9835_UART_IDX_B]);
+
+  /* Status capture is left to the timer while polled */
+  if ( !mcs_dev->parport_hybrid.polling &&
+       parport_isr(mcs_dev) ) {
+    handled = 1;
+    if (mcs9835_hybrid_irq(&mcs_dev->parport_hybrid, 1)) {
+      parport_modify_dcr(mcs_dev, MCS9835_PARPORT_DCR_IRQ_EN, 0);
+    }
+  }
+
+  return IRQ_RETVAL(handled);
+}
+
+/****************************************************************************
+ *
+ * Module load/unload functions
+ *
+ ****************************************************************************/
+module_init(mcs9835_initialize);
+module_exit(mcs9835_finalize);
+
+/****************************************************************************/
+
+/*
+ * Initialize this kernel module.
+ * Executed when the module is loaded.
+ */
+static int __init mcs9835_initialize(void)
+{
+  int rc;
+
+  printk(KERN_INFO DRV_NAME " loading driver %s-%s\n",
+	 DRV_PRODUCT_NUMBER, DRV_RSTATE);
+
+  /* Update initial loglevel list with current settings */
+  mcs_set_log_level(mcs_log_level, MCS_ENABLE);
+  if (loglevel) {
+    mcs_set_log_level(loglevel, MCS_ENABLE);
+  }
+
+  /* Display current loglevel configuration in syslog */
+  mcs_display_log_levels();
+
+  /* Debugfs is optional, devices work without it */
+  mcs9835_debugfs = debugfs_create_dir(DRV_NAME, NULL);
+  if (IS_ERR(mcs9835_debugfs)) {
+    mcs9835_debugfs = NULL;
+  }
+  mcs_log_debugfs_create(mcs9835_debugfs);
+
+  /* Character device class and region, shared by all devices */
+  rc = mcs9835_cdev_initialize();
+  if (rc) {
+    goto init_fail_1;
+  }
+
+  /* Register driver with PCI core, devices are allocated in probe */
+  rc = pci_register_driver(&mcs9835_pci_driver);
+  if (rc) {
+    LOG(MCS_ERR, "pci_register_driver failed\n");
+    goto init_fail_2;
+  }
+
+#ifdef MCS9835_FAKE_HW
+  /* Emulated devices, for use without hardware */
+  while (mcs9835_fake_count < fake_devices) {
+    rc = fake_dev_add();
+    if (rc) {
+      LOG(MCS_ERR, "add emulated device failed\n");
+      goto init_fail_3;
+    }
+  }
+#endif
+
+  return 0;
+
+#ifdef MCS9835_FAKE_HW
+ init_fail_3:
+  fake_dev_remove_all();
+  pci_unregister_driver(&mcs9835_pci_driver);
+#endif
+
+ init_fail_2:
+  mcs9835_cdev_finalize();
+
+ init_fail_1:
+  debugfs_remove_recursive(mcs9835_debugfs);
+
+  return rc;
+}
+
+/****************************************************************************/
+
+/*
+ * Finalize this kernel module.
+ * Executed when the module is unloaded.
+ */
+static void __exit mcs9835_finalize(void)
+{
+  LOG(MCS_INF, "unloading driver\n");
+
+#ifdef MCS9835_FAKE_HW
+  fake_dev_remove_all();
+#endif
+
+  /* Unregister driver from PCI core */
+  pci_unregister_driver(&mcs9835_pci_driver);
+
+  /* Remove character device class and region */
+  mcs9835_cdev_finalize();
+
+  debugfs_remove_recursive(mcs9835_debugfs);
+
+  ida_destroy(&mcs9835_ida);
+}
+
+/****************************************************************************
+ *
+ * Support functions
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+static void initialize_dev_data(struct mcs9835_dev *dev)
+{
+  int i;
+
+  /* PCI */
+  dev->pci_dev = NULL;
+  dev->parent  = NULL;
+  dev->irq     = 0;
+#ifdef MCS9835_FAKE_HW
+  dev->fake    = NULL;
+#endif
+
+  dev->vmem_bar0 = NULL;
+  dev->vmem_bar1 = NULL;
+  dev->vmem_bar2 = NULL;
+  dev->vmem_bar3 = NULL;
+
+  /* Character devices */
+  for (i=0; i < MCS9835_MAX_CDEVS; i++) {
+    memset(&dev->chr[i], 0, sizeof(struct mcs9835_char));   
+  }
+
+  /* UARTs */
+  for (i=0; i < MCS9835_MAX_UARTS; i++) {
+    memset(&dev->uart[i], 0, sizeof(struct mcs9835_uart));   
+  }
+
+  /* Parallel port */
+  mutex_init(&dev->parport_mutex);
+  spin_lock_init(&dev->parport_dcr_lock);
+  dev->parport_dpr = 0;
+  dev->parport_dcr = 0;
+  dev->parport_mode = MCS9835_PARPORT_MODE_SPP;
+  dev->parport_ecr  = 0;
+
+  spin_lock_init(&dev->parport_open_lock);
+  dev->parport_users = 0;
+  dev->parport_excl  = NULL;
+
+  init_waitqueue_head(&dev->parport_event_wq);
+  mutex_init(&dev->parport_event_mutex);
+  spin_lock_init(&dev->parport_event_lock);
+  atomic_set(&dev->parport_irq_taken, 0);
+  dev->parport_last_dsr       = 0;
+  dev->parport_event_overruns = 0;
+
+  dev->hybrid_exit_polls = MCS9835_HYBRID_EXIT_POLLS;
+
+  /* Misc */
+  kref_init(&dev->kref);
+  dev->dev_idx   = 0;
+  dev->init_done = 0;
+}
+
+/****************************************************************************/
+
+/*
+ * Free device data.
+ * Called when the last reference is gone, the device is removed
+ * and all files are closed.
+ */
+static void release_dev_data(struct kref *kref)
+{
+  struct mcs9835_dev *dev = container_of(kref, struct mcs9835_dev, kref);
+
+  LOG(MCS_INI, "release device data %d\n", dev->dev_idx);
+
+  mcs9835_uart_finalize(dev, MCS9835_UART_IDX_A);
+  mcs9835_uart_finalize(dev, MCS9835_UART_IDX_B);
+
+  kfifo_free(&dev->parport_events);
+  mcs9835_play_finalize(dev);
+  mcs9835_sample_finalize(dev);
+
+  mcs9835_stats_dev_finalize(dev);
+
+  kfree(dev);
+}
+
+/****************************************************************************/
+
+/* Kernel compatibility */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,19,0)
+
+static int dev_idx_get(void)
+{
+  return ida_alloc_max(&mcs9835_ida, MCS9835_MAX_DEVICES - 1, GFP_KERNEL);
+}
+
+static void dev_idx_put(int dev_idx)
+{
+  ida_free(&mcs9835_ida, dev_idx);
+}
+
+#else
+
+static int dev_idx_get(void)
+{
+  int rc;
+  int dev_idx;
+
+  do {
+    if (!ida_pre_get(&mcs9835_ida, GFP_KERNEL)) {
+      return -ENOMEM;
+    }
+    mutex_lock(&mcs9835_ida_mutex);
+    rc = ida_get_new(&mcs9835_ida, &dev_idx);
+    mutex_unlock(&mcs9835_ida_mutex);
+  } while (rc == -EAGAIN);
+
+  if (rc) {
+    return rc;
+  }
+
+  if (dev_idx >= MCS9835_MAX_DEVICES) {
+    dev_idx_put(dev_idx);
+    return -EBUSY;
+  }
+
+  return dev_idx;
+}
+
+static void dev_idx_put(int dev_idx)
+{
+  mutex_lock(&mcs9835_ida_mutex);
+  ida_remove(&mcs9835_ida, dev_idx);
+  mutex_unlock(&mcs9835_ida_mutex);
+}
+
+#endif
+
+/****************************************************************************/
+
+static void parport_write_reg(struct mcs9835_dev *dev,
+			      unsigned bar_offset,
+			      u8 value)
+{
+  s64 start_ns;
+
+  trace_mcs9835_reg_write(dev->dev_idx, MCS9835_BAR_PARPORT, bar_offset, value);
+
+  /* Parallel port is at BAR2 */
+  start_ns = mcs9835_stats_start();
+  iowrite8(value, dev->vmem_bar2 + bar_offset);
+  mcs9835_stats_hist(dev->reg_stats, MCS9835_HIST_REG_WRITE, start_ns);
+
+  /* Output registers are not read back, keep a copy */
+  if (bar_offset == MCS9835_PARPORT_REG_DPR) {
+    dev->parport_dpr = value;
+  } else if (bar_offset == MCS9835_PARPORT_REG_DCR) {
+    dev->parport_dcr = value;
+  }
+}
+
+/****************************************************************************/
+
+/*
+ * Read a parallel port register.
+ * A status register read clears the nAck interrupt pending bit,
+ * an interrupt it finds pending is recorded here.
+ */
+static u8 parport_read_reg(struct mcs9835_dev *dev,
+			   unsigned bar_offset)
+{
+  u8 value;
+  s64 start_ns;
+
+  /* Parallel port is at BAR2 */
+  start_ns = mcs9835_stats_start();
+  value = ioread8(dev->vmem_bar2 + bar_offset);
+  mcs9835_stats_hist(dev->reg_stats, MCS9835_HIST_REG_READ, start_ns);
+
+  trace_mcs9835_reg_read(dev->dev_idx, MCS9835_BAR_PARPORT, bar_offset, value);
+
+  if (bar_offset == MCS9835_PARPORT_REG_DSR) {
+    parport_status_seen(dev, ktime_to_ns(ktime_get()), &value, 1);
+  }
+
+  return value;
+}
+
+/****************************************************************************/
+
+static void parport_write_data(struct mcs9835_dev *dev,
+			       const u8 *buf,
+			       size_t count)
+{
+  trace_mcs9835_reg_write_rep(dev->dev_idx, MCS9835_BAR_PARPORT,
+			      MCS9835_PARPORT_REG_DPR, count);
+
+  /* Back to back writes to the data register */
+  iowrite8_rep(dev->vmem_bar2 + MCS9835_PARPORT_REG_DPR, buf, count);
+  if (count) {
+    dev->parport_dpr = buf[count - 1];
+  }
+}
+
+/****************************************************************************/
+
+static void parport_read_status(struct mcs9835_dev *dev,
+				u8 *buf,
+				size_t count)
+{
+  /* Back to back reads from the status register */
+  ioread8_rep(dev->vmem_bar2 + MCS9835_PARPORT_REG_DSR, buf, count);
+
+  trace_mcs9835_reg_read_rep(dev->dev_idx, MCS9835_BAR_PARPORT,
+			     MCS9835_PARPORT_REG_DSR, count);
+
+  /* Timestamped at the end of the block */
+  parport_status_seen(dev, ktime_to_ns(ktime_get()), buf, count);
+}
+
+
+/****************************************************************************/
+
+static void parport_enable_irq(struct mcs9835_dev *dev,
+			       int enable)
+{
+  if (enable) {
+    parport_modify_dcr(dev, 0, MCS9835_PARPORT_DCR_IRQ_EN);
+  } else {
+    parport_modify_dcr(dev, MCS9835_PARPORT_DCR_IRQ_EN, 0);
+  }
+}
+
+/****************************************************************************/
+
+/*
+ * Update of the control register, from its copy.
+ * Mode changes, transfers, pin operations and interrupt enable
+ * all update some of its bits, possibly from different contexts.
+ */
+static u8 parport_modify_dcr(struct mcs9835_dev *dev,
+			     u8 clear,
+			     u8 set)
+{
+  unsigned long flags;
+  u8 dcr;
+
+  spin_lock_irqsave(&dev->parport_dcr_lock, flags);
+  dcr = (dev->parport_dcr & ~clear) | set;
+  parport_write_reg(dev, MCS9835_PARPORT_REG_DCR, dcr);
+  spin_unlock_irqrestore(&dev->parport_dcr_lock, flags);
+
+  return dcr;
+}
+
+/****************************************************************************/
+
+/*
+ * Check for an extended control register, leaving it in standard mode.
+ * Standard mode reads back an empty FIFO.
+ */
+static int parport_probe_ecr(struct mcs9835_dev *dev)
+{
+  const u8 ecr = (MCS9835_ECR_MODE_SPP |
+		  MCS9835_ECR_N_ERR_INTR_EN |
+		  MCS9835_ECR_SERVICE_INTR);
+
+  bar_write_reg(dev, MCS9835_BAR_CONFIG, MCS9835_ECP_REG_ECR, ecr);
+
+  return (bar_read_reg(dev, MCS9835_BAR_CONFIG, MCS9835_ECP_REG_ECR) ==
+	  (ecr | MCS9835_ECR_FIFO_EMPTY));
+}
+
+/****************************************************************************/
+
+/*
+ * Switch parallel port mode, called with parport mutex held.
+ * The ECR must pass standard mode before entering another mode,
+ * which also resets the FIFO.
+ */
+static int parport_set_mode(struct mcs9835_dev *dev,
+			    int mode)
+{
+  u8 ecr_mode;
+
+  switch (mode) {
+  case MCS9835_PARPORT_MODE_SPP:
+    ecr_mode = MCS9835_ECR_MODE_SPP;
+    break;
+  case MCS9835_PARPORT_MODE_FIFO:
+    ecr_mode = MCS9835_ECR_MODE_FIFO;
+    break;
+  case MCS9835_PARPORT_MODE_EPP:
+    ecr_mode = MCS9835_ECR_MODE_EPP;
+    break;
+  default:
+    return -EINVAL;
+  }
+
+  if (!dev->parport_ecr) {
+    return (mode == MCS9835_PARPORT_MODE_SPP ? 0 : -EOPNOTSUPP);
+  }
+
+  /* Playback needs standard mode */
+  if (dev->play_running) {
+    return -EBUSY;
+  }
+
+  /* Let the peripheral take data still in FIFO */
+  if (dev->parport_mode == MCS9835_PARPORT_MODE_FIFO) {
+    if (parport_wait_ecr(dev, 
+			 MCS9835_ECR_FIFO_EMPTY, 
+			 MCS9835_ECR_FIFO_EMPTY) < 0) {
+      LOG(MCS_WRN, "parallel port FIFO not empty, data dropped\n");
+    }
+  }
+
+  bar_write_reg(dev, MCS9835_BAR_CONFIG, MCS9835_ECP_REG_ECR,
+		MCS9835_ECR_MODE_SPP |
+		MCS9835_ECR_N_ERR_INTR_EN |
+		MCS9835_ECR_SERVICE_INTR);
+
+  if (mode != MCS9835_PARPORT_MODE_SPP) {
+    if (mode == MCS9835_PARPORT_MODE_EPP) {
+      /* Strobes driven by hardware, keep them inactive */
+      parport_modify_dcr(dev, 
+			 (u8)~MCS9835_PARPORT_DCR_IRQ_EN, 
+			 MCS9835_PARPORT_DCR_NINIT);
+      parport_epp_clear_timeout(dev);
+    } else {
+      /* FIFO mode is output only */
+      parport_modify_dcr(dev, MCS9835_PARPORT_DCR_DIR, 0);
+    }
+
+    bar_write_reg(dev, MCS9835_BAR_CONFIG, MCS9835_ECP_REG_ECR,
+		  ecr_mode |
+		  MCS9835_ECR_N_ERR_INTR_EN |
+		  MCS9835_ECR_SERVICE_INTR);
+  }
+
+  dev->parport_mode = mode;
+
+  LOG(MCS_CDV, "parallel port mode %d\n", mode);
+
+  return 0;
+}
+
+/****************************************************************************/
+
+/*
+ * Busy wait for ECR FIFO status. The FIFO drains at the peripheral
+ * handshake rate, waits are short while the peripheral makes progress.
+ * Returns ECR value, or negative on timeout.
+ */
+static int parport_wait_ecr(struct mcs9835_dev *dev,
+			    u8 mask,
+			    u8 value)
+{
+  unsigned long timeout = jiffies + MCS9835_PARPORT_FIFO_TIMEOUT;
+  u8 ecr;
+
+  for (;;) {
+    ecr = bar_read_reg(dev, MCS9835_BAR_CONFIG, MCS9835_ECP_REG_ECR);
+    if ((ecr & mask) == value) {
+      return ecr;
+    }
+    if (time_after(jiffies, timeout)) {
+      return -ETIMEDOUT;
+    }
+    cond_resched();
+  }
+}
+
+/****************************************************************************/
+
+/*
+ * Fill the parallel port FIFO, called with parport mutex held.
+ * An empty FIFO takes a full burst, otherwise one byte at a time.
+ * Returns bytes written, or negative on timeout before any byte.
+ */
+static ssize_t parport_write_fifo(struct mcs9835_dev *dev,
+				  const u8 *buf,
+				  size_t count)
+{
+  size_t done = 0;
+  size_t n;
+  int ecr;
+
+  while (done < count) {
+    ecr = parport_wait_ecr(dev, MCS9835_ECR_FIFO_FULL, 0);
+    if (ecr < 0) {
+      return (done ? done : ecr);
+    }
+
+    n = 1;
+    if (ecr & MCS9835_ECR_FIFO_EMPTY) {
+      n = min_t(size_t, count - done, MCS9835_ECP_FIFO_SIZE);
+    }
+
+    iowrite8_rep(dev->vmem_bar3 + MCS9835_ECP_REG_FIFO, buf + done, n);
+    trace_mcs9835_reg_write_rep(dev->dev_idx, MCS9835_BAR_CONFIG,
+				MCS9835_ECP_REG_FIFO, n);
+    done += n;
+  }
+
+  return done;
+}
+
+/****************************************************************************/
+
+/*
+ * Write data in current parallel port mode.
+ * Returns bytes written, or negative on error.
+ */
+static ssize_t parport_write(struct mcs9835_dev *dev,
+			     const u8 *buf,
+			     size_t count,
+			     int cycle)
+{
+  switch (dev->parport_mode) {
+  case MCS9835_PARPORT_MODE_FIFO:
+    return parport_write_fifo(dev, buf, count);
+  case MCS9835_PARPORT_MODE_EPP:
+    return parport_epp_xfer(dev, (u8 *)buf, count, cycle, 1);
+  default:
+    parport_write_data(dev, buf, count);
+    return count;
+  }
+}
+
+/****************************************************************************/
+
+/*
+ * Read data in current parallel port mode.
+ * Standard and FIFO mode sample the status register.
+ * Returns bytes read, or negative on error.
+ */
+static ssize_t parport_read(struct mcs9835_dev *dev,
+			    u8 *buf,
+			    size_t count,
+			    int cycle)
+{
+  switch (dev->parport_mode) {
+  case MCS9835_PARPORT_MODE_EPP:
+    return parport_epp_xfer(dev, buf, count, cycle, 0);
+  default:
+    parport_read_status(dev, buf, count);
+    return count;
+  }
+}
+
+/****************************************************************************/
+
+/*
+ * Check that a block can be transferred, called with parport mutex held.
+ * The mode may change between the blocks of one read/write call.
+ */
+static int parport_xfer_check(struct mcs9835_dev *dev,
+			      loff_t pos,
+			      int write)
+{
+  /* Device removed */
+  if (!dev->init_done) {
+    return -ENODEV;
+  }
+
+  /* Playback owns the data register */
+  if (write && dev->play_running) {
+    return -EBUSY;
+  }
+
+  /* EPP mode, offset selects address or data cycles */
+  if ( (dev->parport_mode == MCS9835_PARPORT_MODE_EPP) &&
+       (pos != MCS9835_EPP_CYCLE_DATA) &&
+       (pos != MCS9835_EPP_CYCLE_ADDR) ) {
+    return -EINVAL;
+  }
+
+  return 0;
+}
+
+/****************************************************************************/
+
+/*
+ * Account one read/write call of an open file, with file mutex held.
+ */
+static void parport_file_stats(struct mcs9835_parport_file *pfile,
+			       int write,
+			       ssize_t rc)
+{
+  if (rc < 0) {
+    pfile->stats.errors++;
+  } else if (write) {
+    pfile->stats.write_calls++;
+    pfile->stats.write_bytes += rc;
+  } else {
+    pfile->stats.read_calls++;
+    pfile->stats.read_bytes += rc;
+  }
+}
+
+/****************************************************************************/
+
+/*
+ * Block of EPP address or data cycles, called with parport mutex held.
+ * Each access to the EPP registers runs one complete hardware cycle.
+ * A cycle not acknowledged by the peripheral sets the EPP timeout
+ * bit, the whole block is failed since the failing cycle is unknown.
+ */
+static ssize_t parport_epp_xfer(struct mcs9835_dev *dev,
+				u8 *buf,
+				size_t count,
+				int cycle,
+				int write)
+{
+  unsigned offset;
+  u8 dsr;
+
+  offset = (cycle == MCS9835_EPP_CYCLE_ADDR ?
+	    MCS9835_PARPORT_REG_EPP_ADDR :
+	    MCS9835_PARPORT_REG_EPP_DATA);
+
+  /* Data line direction follows transfer direction */
+  if (write) {
+    parport_modify_dcr(dev, MCS9835_PARPORT_DCR_DIR, 0);
+  } else {
+    parport_modify_dcr(dev, 0, MCS9835_PARPORT_DCR_DIR);
+  }
+
+  if (write) {
+    iowrite8_rep(dev->vmem_bar2 + offset, buf, count);
+    trace_mcs9835_reg_write_rep(dev->dev_idx, MCS9835_BAR_PARPORT,
+				offset, count);
+  } else {
+    ioread8_rep(dev->vmem_bar2 + offset, buf, count);
+    trace_mcs9835_reg_read_rep(dev->dev_idx, MCS9835_BAR_PARPORT,
+			       offset, count);
+  }
+
+  dsr = parport_read_reg(dev, MCS9835_PARPORT_REG_DSR);
+  if (dsr & MCS9835_PARPORT_DSR_EPP_TIMEOUT) {
+    parport_epp_clear_timeout(dev);
+    return -ETIMEDOUT;
+  }
+
+  return count;
+}
+
+/****************************************************************************/
+
+/*
+ * Clear EPP timeout.
+ * Cleared by reading status on some implementations,
+ * by writing one to the bit on others.
+ */
+static void parport_epp_clear_timeout(struct mcs9835_dev *dev)
+{
+  parport_read_reg(dev, MCS9835_PARPORT_REG_DSR);
+  parport_write_reg(dev, MCS9835_PARPORT_REG_DSR, 
+		    MCS9835_PARPORT_DSR_EPP_TIMEOUT);
+}
+
+/****************************************************************************/
+
+/*
+ * Handle a nAck interrupt, the only status interrupt of the port.
+ * The nAck pulse has normally ended when the status is read, the
+ * pending bit tells that the port interrupted. Any read of the status
+ * register clears it, and the interrupt request with it. The read
+ * that found it pending, here or in a concurrent transfer, sampling
+ * or register access, recorded the event.
+ * Returns non-zero if the parallel port had a pending interrupt.
+ */
+static int parport_isr(struct mcs9835_dev *dev)
+{
+  if (!(dev->parport_dcr & MCS9835_PARPORT_DCR_IRQ_EN)) {
+    return 0;
+  }
+  parport_read_reg(dev, MCS9835_PARPORT_REG_DSR);
+
+  return atomic_xchg(&dev->parport_irq_taken, 0);
+}
+
+/****************************************************************************/
+
+/*
+ * Push a status record to readers.
+ * Producers are any status register read, in interrupt, timer
+ * or process context, serialized by the event lock.
+ */
+static void parport_event(struct mcs9835_dev *dev,
+			  s64 timestamp_ns,
+			  u8 dsr)
+{
+  struct mcs9835_parport_event event;
+  unsigned long flags;
+
+  event.timestamp_ns = timestamp_ns;
+  event.dsr          = dsr;
+  memset(event.reserved, 0, sizeof(event.reserved));
+
+  trace_mcs9835_parport_event(dev->dev_idx, event.dsr);
+
+  spin_lock_irqsave(&dev->parport_event_lock, flags);
+  /* Compared by the poll timer, without the pending bit */
+  dev->parport_last_dsr = dsr | MCS9835_PARPORT_DSR_NIRQ;
+  if (kfifo_in(&dev->parport_events, &event, 1) != 1) {
+    dev->parport_event_overruns++;
+  }
+  spin_unlock_irqrestore(&dev->parport_event_lock, flags);
+
+  wake_up_interruptible(&dev->parport_event_wq);
+}
+
+/****************************************************************************/
+
+/*
+ * Record the nAck interrupts found pending in status values read.
+ * With the interrupt enabled, the next handler run claims it.
+ */
+static void parport_status_seen(struct mcs9835_dev *dev,
+				s64 timestamp_ns,
+				const u8 *dsr,
+				size_t count)
+{
+  size_t i;
+
+  for (i=0; i < count; i++) {
+    if (dsr[i] & MCS9835_PARPORT_DSR_NIRQ) {
+      continue;
+    }
+    parport_event(dev, timestamp_ns, dsr[i]);
+    if (dev->parport_dcr & MCS9835_PARPORT_DCR_IRQ_EN) {
+      atomic_set(&dev->parport_irq_taken, 1);
+    }
+  }
+}
+
+/****************************************************************************/
+
+/*
+ * Poll for a status change, status interrupt masked.
+ * A nAck pulse shorter than the poll period is seen only
+ * if the port latched it. Events are timestamped at the poll.
+ */
+static int parport_poll(struct mcs9835_hybrid *hy)
+{
+  struct mcs9835_dev *dev = container_of(hy, 
+					 struct mcs9835_dev, 
+					 parport_hybrid);
+  s64 timestamp_ns = ktime_to_ns(ktime_get());
+  u8 dsr;
+
+  /* A latched nAck is recorded by the read */
+  dsr = parport_read_reg(dev, MCS9835_PARPORT_REG_DSR);
+  if (!(dsr & MCS9835_PARPORT_DSR_NIRQ)) {
+    return 1;
+  }
+  if (dsr == dev->parport_last_dsr) {
+    return 0;
+  }
+
+  parport_event(dev, timestamp_ns, dsr);
+
+  return 1;
+}
+
+/****************************************************************************/
+
+/*
+ * Status changes drained, back to interrupts.
+ * Not after the device is removed, its interrupt stays off.
+ */
+static void parport_unmask(struct mcs9835_hybrid *hy)
+{
+  struct mcs9835_dev *dev = container_of(hy, 
+					 struct mcs9835_dev, 
+					 parport_hybrid);
+
+  if (dev->init_done) {
+    parport_enable_irq(dev, 1);
+  }
+}
+
+/****************************************************************************/
+
+static void __iomem *bar_base(struct mcs9835_dev *dev,
+			      unsigned bar)
+{
+  switch (bar) {
+  case MCS9835_BAR_UART_A:
+    return dev->vmem_bar0;
+  case MCS9835_BAR_UART_B:
+    return dev->vmem_bar1;
+  case MCS9835_BAR_PARPORT:
+    return dev->vmem_bar2;
+  case MCS9835_BAR_CONFIG:
+    return dev->vmem_bar3;
+  default:
+    return NULL;
+  }
+}
+
+/****************************************************************************/
+
+static resource_size_t bar_len(struct mcs9835_dev *dev,
+			       unsigned bar)
+{
+#ifdef MCS9835_FAKE_HW
+  if (dev->fake != NULL) {
+    return MCS9835_FAKE_BAR_SIZE;
+  }
+#endif
+  return pci_resource_len(dev->pci_dev, bar);
+}
+
+/****************************************************************************/
+
+/*
+ * UART owning a BAR, NULL for the parallel port BARs.
+ */
+static struct mcs9835_uart *bar_uart(struct mcs9835_dev *dev,
+				     unsigned bar)
+{
+  switch (bar) {
+  case MCS9835_BAR_UART_A:
+    return &dev->uart[MCS9835_UART_IDX_A];
+  case MCS9835_BAR_UART_B:
+    return &dev->uart[MCS9835_UART_IDX_B];
+  default:
+    return NULL;
+  }
+}
+
+/****************************************************************************/
+
+/*
+ * Raw register write. UART registers are written under the UART lock,
+ * not between the register accesses of its interrupt handler.
+ */
+static void bar_write_reg(struct mcs9835_dev *dev,
+			  unsigned bar,
+			  unsigned offset,
+			  u8 value)
+{
+  struct mcs9835_uart *uart = bar_uart(dev, bar);
+  unsigned long flags = 0;
+  s64 start_ns;
+
+  if (bar == MCS9835_BAR_PARPORT) {
+    if (offset == MCS9835_PARPORT_REG_DCR) {
+      /* Not between read and write of a control register update */
+      parport_modify_dcr(dev, 0xff, value);
+    } else {
+      parport_write_reg(dev, offset, value);
+    }
+    return;
+  }
+
+  trace_mcs9835_reg_write(dev->dev_idx, bar, offset, value);
+
+  if (uart != NULL) {
+    spin_lock_irqsave(&uart->lock, flags);
+  }
+  start_ns = mcs9835_stats_start();
+  iowrite8(value, bar_base(dev, bar) + offset);
+  mcs9835_stats_hist(dev->reg_stats, MCS9835_HIST_REG_WRITE, start_ns);
+  if (uart != NULL) {
+    spin_unlock_irqrestore(&uart->lock, flags);
+  }
+}
+
+/****************************************************************************/
+
+/*
+ * Raw register read, UART registers under the UART lock.
+ * Reading a UART data or status register consumes what the
+ * interrupt handler would have seen.
+ */
+static u8 bar_read_reg(struct mcs9835_dev *dev,
+		       unsigned bar,
+		       unsigned offset)
+{
+  struct mcs9835_uart *uart = bar_uart(dev, bar);
+  unsigned long flags = 0;
+  u8 value;
+  s64 start_ns;
+
+  if (bar == MCS9835_BAR_PARPORT) {
+    return parport_read_reg(dev, offset);
+  }
+
+  if (uart != NULL) {
+    spin_lock_irqsave(&uart->lock, flags);
+  }
+  start_ns = mcs9835_stats_start();
+  value = ioread8(bar_base(dev, bar) + offset);
+  mcs9835_stats_hist(dev->reg_stats, MCS9835_HIST_REG_READ, start_ns);
+  if (uart != NULL) {
+    spin_unlock_irqrestore(&uart->lock, flags);
+  }
+
+  trace_mcs9835_reg_read(dev->dev_idx, bar, offset, value);
+
+  return value;
+}
+
+/****************************************************************************/
+
+/*
+ * Execute a batch of register operations.
+ * The whole batch is checked before any operation is executed.
+ */
+static long ioctl_reg_batch(struct mcs9835_dev *dev,
+			    void __user *arg)
+{
+  struct mcs9835_reg_batch batch;
+  struct mcs9835_reg_op *ops = NULL;
+  size_t size;
+  unsigned i;
+  long rc = 0;
+
+  if (copy_from_user(&batch, arg, sizeof(batch))) {
+    return -EFAULT;
+  }
+
+  /* Check user input */
+  if ( (batch.count == 0) ||
+       (batch.count > MCS9835_REG_BATCH_MAX) ) {
+    return -EINVAL;
+  }
+
+  size = batch.count * sizeof(struct mcs9835_reg_op);
+  ops = kmalloc(size, GFP_KERNEL);
+  if (ops == NULL) {
+    return -ENOMEM;
+  }
+
+  if (copy_from_user(ops, (void __user *)(unsigned long)batch.ops, size)) {
+    rc = -EFAULT;
+    goto batch_out;
+  }
+
+  for (i=0; i < batch.count; i++) {
+    rc = mcs9835_reg_op_check(dev, &ops[i]);
+    if (rc) {
+      goto batch_out;
+    }
+  }
+
+  /* Don't interleave with read/write transfers */
+  if (mutex_lock_interruptible(&dev->parport_mutex)) {
+    rc = -ERESTARTSYS;
+    goto batch_out;
+  }
+
+  /* Device removed */
+  if (!dev->init_done) {
+    mutex_unlock(&dev->parport_mutex);
+    rc = -ENODEV;
+    goto batch_out;
+  }
+
+  for (i=0; i < batch.count; i++) {
+    mcs9835_reg_op_execute(dev, &ops[i]);
+  }
+
+  mutex_unlock(&dev->parport_mutex);
+
+  /* Return all read values in one copy */
+  if (copy_to_user((void __user *)(unsigned long)batch.ops, ops, size)) {
+    rc = -EFAULT;
+  }
+
+ batch_out:
+  kfree(ops);
+
+  return rc;
+}
+
+/****************************************************************************/
+
+/*
+ * Register window access, may span BARs.
+ * Offsets past the end of a BAR within its stride read as zero and
+ * ignore writes, so the window reads sequentially as one file.
+ * Serialized with parallel port transfers and register batches.
+ */
+static ssize_t regs_window_xfer(struct kobject *kobj,
+				char *buf,
+				loff_t off,
+				size_t count,
+				int write)
+{
+  struct device *device = container_of(kobj, struct device, kobj);
+  struct mcs9835_dev *dev = NULL;
+  unsigned bar;
+  unsigned offset;
+  size_t i;
+
+  dev = dev_get_drvdata(device);
+  if (dev == NULL) {
+    return -ENODEV;
+  }
+
+  if (off >= MCS9835_NUM_BARS * MCS9835_REG_WINDOW_STRIDE) {
+    return 0;
+  }
+  count = min_t(size_t, count,
+		MCS9835_NUM_BARS * MCS9835_REG_WINDOW_STRIDE - off);
+
+  if (mutex_lock_interruptible(&dev->parport_mutex)) {
+    return -ERESTARTSYS;
+  }
+
+  /* Device removed */
+  if (!dev->init_done) {
+    mutex_unlock(&dev->parport_mutex);
+    return -ENODEV;
+  }
+
+  for (i=0; i < count; i++) {
+    bar    = (off + i) / MCS9835_REG_WINDOW_STRIDE;
+    offset = (off + i) % MCS9835_REG_WINDOW_STRIDE;
+
+    if (offset >= bar_len(dev, bar)) {
+      /* Gap up to the next BAR */
+      if (!write) {
+	buf[i] = 0;
+      }
+    } else if (write) {
+      bar_write_reg(dev, bar, offset, buf[i]);
+    } else {
+      buf[i] = bar_read_reg(dev, bar, offset);
+    }
+  }
+
+  mutex_unlock(&dev->parport_mutex);
+
+  return count;
+}
+
+/****************************************************************************/
+
+static long ioctl_set_mode(struct mcs9835_dev *dev,
+			   __u32 __user *arg)
+{
+  __u32 mode;
+  long rc;
+
+  if (get_user(mode, arg)) {
+    return -EFAULT;
+  }
+
+  if (mutex_lock_interruptible(&dev->parport_mutex)) {
+    return -ERESTARTSYS;
+  }
+
+  /* Device removed */
+  if (!dev->init_done) {
+    mutex_unlock(&dev->parport_mutex);
+    return -ENODEV;
+  }
+
+  rc = parport_set_mode(dev, mode);
+
+  mutex_unlock(&dev->parport_mutex);
+
+  return rc;
+}
+
+/****************************************************************************/
+
+/*
+ * Take or give up exclusive use of the parallel port device.
+ * Taking it needs this file to be the only one open.
+ */
+static long ioctl_set_excl(struct mcs9835_dev *dev,
+			   struct file *file,
+			   __u32 __user *arg)
+{
+  __u32 excl;
+  long rc = 0;
+
+  if (get_user(excl, arg)) {
+    return -EFAULT;
+  }
+
+  spin_lock(&dev->parport_open_lock);
+  if (excl) {
+    if (dev->parport_excl == NULL && dev->parport_users == 1) {
+      dev->parport_excl = file;
+    } else if (dev->parport_excl != file) {
+      rc = -EBUSY;
+    }
+  } else if (dev->parport_excl == file) {
+    dev->parport_excl = NULL;
+  }
+  spin_unlock(&dev->parport_open_lock);
+
+  return rc;
+}
+
+/****************************************************************************/
+
+static long ioctl_file_stats(struct mcs9835_parport_file *pfile,
+			     void __user *arg)
+{
+  struct mcs9835_file_stats stats;
+
+  if (mutex_lock_interruptible(&pfile->mutex)) {
+    return -ERESTARTSYS;
+  }
+  stats = pfile->stats;
+  mutex_unlock(&pfile->mutex);
+
+  if (copy_to_user(arg, &stats, sizeof(stats))) {
+    return -EFAULT;
+  }
+
+  return 0;
+}
+
+/****************************************************************************/
+
+/*
+ * Set, clear or toggle data or control register bits.
+ * The new value comes from the register copy, one register write
+ * and no read of the port.
+ */
+static long ioctl_pin_op(struct mcs9835_dev *dev,
+			 unsigned int cmd,
+			 void __user *arg)
+{
+  struct mcs9835_pin_op op;
+  unsigned long flags;
+  u8 value;
+  u8 mask;
+  long rc = 0;
+
+  if (copy_from_user(&op, arg, sizeof(op))) {
+    return -EFAULT;
+  }
+
+  /* Check user input */
+  if ( (op.reg > MCS9835_PIN_REG_CONTROL) ||
+       (op.mask > 0xff) ||
+       ((op.reg == MCS9835_PIN_REG_CONTROL) && 
+	(op.mask & ~MCS9835_PIN_CONTROL_MASK)) ) {
+    return -EINVAL;
+  }
+  mask = op.mask;
+
+  if (mutex_lock_interruptible(&dev->parport_mutex)) {
+    return -ERESTARTSYS;
+  }
+
+  /* Device removed */
+  if (!dev->init_done) {
+    rc = -ENODEV;
+    goto pin_out;
+  }
+
+  if (op.reg == MCS9835_PIN_REG_DATA) {
+    /* Playback owns the data register */
+    if (dev->play_running) {
+      rc = -EBUSY;
+      goto pin_out;
+    }
+    value = pin_op_value(cmd, dev->parport_dpr, mask);
+    if (mask) {
+      parport_write_reg(dev, MCS9835_PARPORT_REG_DPR, value);
+    }
+  } else {
+    spin_lock_irqsave(&dev->parport_dcr_lock, flags);
+    value = pin_op_value(cmd, dev->parport_dcr, mask);
+    if (mask) {
+      parport_write_reg(dev, MCS9835_PARPORT_REG_DCR, value);
+    }
+    spin_unlock_irqrestore(&dev->parport_dcr_lock, flags);
+  }
+
+  op.value = value;
+
+ pin_out:
+  mutex_unlock(&dev->parport_mutex);
+
+  if (rc == 0) {
+    if (copy_to_user(arg, &op, sizeof(op))) {
+      rc = -EFAULT;
+    }
+  }
+
+  return rc;
+}
+
+/****************************************************************************/
+
+static u8 pin_op_value(unsigned int cmd,
+		       u8 value,
+		       u8 mask)
+{
+  switch (cmd) {
+  case MCS9835_IOC_PIN_SET:
+    return value | mask;
+  case MCS9835_IOC_PIN_CLEAR:
+    return value & ~mask;
+  default:
+    return value ^ mask;
+  }
+}
+
+/****************************************************************************/
+
+static void dump_bar_registers(const char *name,
+			       void __iomem *base,
+			       const u8 *regs,
+			       int nregs)
+{
+  int i;
+
+  LOG(MCS_INF, "%s\n", name);
+  for (i=0; i < nregs; i++) {
+    LOG(MCS_INF, "  [%d] = 0x%02x\n", regs[i], ioread8(base + regs[i]));
+  }
+}
+
+/****************************************************************************/
+
+/*
+ * Only registers read without side effects. Receive buffer,
+ * interrupt ident, line and modem status reads change UART state,
+ * a status register read clears the nAck interrupt, EPP offsets
+ * start bus cycles and a FIFO read consumes data.
+ */
+static void dump_dev_registers(struct mcs9835_dev *dev)
+{
+  static const u8 uart_regs[] = {
+    MCS9835_UART_REG_IER,
+    MCS9835_UART_REG_LCR,
+    MCS9835_UART_REG_MCR,
+    MCS9835_UART_REG_SCR,
+  };
+  static const u8 parport_regs[] = {
+    MCS9835_PARPORT_REG_DPR,
+    MCS9835_PARPORT_REG_DCR,
+  };
+  static const u8 ecp_regs[] = {
+    MCS9835_ECP_REG_CFGB,
+    MCS9835_ECP_REG_ECR,
+  };
+
+  dump_bar_registers("BAR0 - UART-A", dev->vmem_bar0,
+		     uart_regs, ARRAY_SIZE(uart_regs));
+  dump_bar_registers("BAR1 - UART-B", dev->vmem_bar1,
+		     uart_regs, ARRAY_SIZE(uart_regs));
+  dump_bar_registers("BAR2 - SPPR", dev->vmem_bar2,
+		     parport_regs, ARRAY_SIZE(parport_regs));
+  dump_bar_registers("BAR3", dev->vmem_bar3,
+		     ecp_regs, ARRAY_SIZE(ecp_regs));
 }
@@ -0,0 +1,651 @@
+/***********************************************************************
+*                                                                      *
+* Copyright (C) 2017 Bonden i Nol (hakanbrolin@hotmail.com)            *
+*                                                                      *
+* This program is free software; you can redistribute it and/or modify *
+* it under the terms of the GNU General Public License as published by *
+* the Free Software Foundation; either version 2 of the License, or    *
+* (at your option) any later version.                                  *
+*                                                                      *
+************************************************************************/
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/err.h>
+#include <linux/spinlock.h>
+#include <linux/irq_work.h>
+#include <linux/platform_device.h>
+
+#include "mcs9835.h"
+#include "mcs9835_fake.h"
+#include "mcs9835_product_info.h"
+#include "mcs9835_log.h"
+#include "mcs9835_hw.h"
+
+/****************************************************************************
+ *
+ * Macros
+ *
+ ****************************************************************************/
+
+/* Emulated modem status, CTS, DSR and DCD active */
+#define MCS9835_FAKE_MSR  0xb0
+
+/* Control register bits always read as one */
+#define MCS9835_FAKE_DCR_ONES  0xc0
+
+/****************************************************************************
+ *
+ * Types
+ *
+ ****************************************************************************/
+
+struct mcs9835_fake_uart {
+  u8       rx[MCS9835_UART_FIFO_SIZE]; /* Loopback receive FIFO */
+  unsigned rx_head;
+  unsigned rx_count;
+  u8       ier;
+  u8       fcr;
+  u8       lcr;
+  u8       mcr;
+  u8       scr;
+  u8       dll;
+  u8       dlm;
+  u8       lsr_err;      /* Error bits, cleared by reading LSR */
+  int      thre_pending; /* Transmit holding empty interrupt   */
+};
+
+struct mcs9835_fake {
+  /* Register address space, only decoded, never read */
+  u8 bars[MCS9835_NUM_BARS][MCS9835_FAKE_BAR_SIZE];
+
+  spinlock_t lock; /* Emulated register state */
+
+  struct mcs9835_fake_uart uart[MCS9835_MAX_UARTS];
+
+  /* Parallel port */
+  u8 dpr;
+  u8 dcr;
+  u8 ecr;
+  u8 cfgb;
+  u8 epp_addr;
+  u8 epp_data;
+  int ack_pending; /* nAck interrupt latched, until DSR is read */
+
+  /* Interrupt line, raised from register access */
+  struct irq_work irq_work;
+  irq_handler_t   handler;
+  void            *dev_id;
+
+  struct platform_device *pdev;
+  int dev_idx;
+};
+
+/****************************************************************************
+ *
+ * Function prototypes
+ *
+ ****************************************************************************/
+
+static struct mcs9835_fake *fake_lookup(const void __iomem *addr,
+					unsigned *bar,
+					unsigned *offset);
+
+static u8 fake_uart_read(struct mcs9835_fake_uart *uart,
+			 unsigned offset);
+
+static void fake_uart_write(struct mcs9835_fake_uart *uart,
+			    unsigned offset,
+			    u8 value);
+
+static u8 fake_uart_iir(struct mcs9835_fake_uart *uart);
+
+static u8 fake_parport_dsr(struct mcs9835_fake *fake);
+
+static void fake_parport_data(struct mcs9835_fake *fake,
+			      u8 value);
+
+static u8 fake_read(struct mcs9835_fake *fake,
+		    unsigned bar,
+		    unsigned offset);
+
+static void fake_write(struct mcs9835_fake *fake,
+		       unsigned bar,
+		       unsigned offset,
+		       u8 value);
+
+static int fake_irq_pending(struct mcs9835_fake *fake);
+
+static void fake_irq_work(struct irq_work *work);
+
+/****************************************************************************
+ *
+ * Global variables
+ *
+ ****************************************************************************/
+
+/* Created and destroyed at module load/unload only */
+static struct mcs9835_fake *mcs9835_fakes[MCS9835_MAX_DEVICES];
+
+/****************************************************************************
+ *
+ * Exported functions
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+struct mcs9835_fake *mcs9835_fake_create(int dev_idx)
+{
+  struct mcs9835_fake *fake;
+  int rc;
+
+  fake = kzalloc(sizeof(struct mcs9835_fake), GFP_KERNEL);
+  if (fake == NULL) {
+    return ERR_PTR(-ENOMEM);
+  }
+
+  spin_lock_init(&fake->lock);
+  init_irq_work(&fake->irq_work, fake_irq_work);
+  fake->dev_idx = dev_idx;
+  fake->dcr     = MCS9835_PARPORT_DCR_NINIT;
+
+  /* Parent device for character devices and sysfs */
+  fake->pdev = platform_device_register_simple(DRV_NAME "_fake",
+					       dev_idx, NULL, 0);
+  if (IS_ERR(fake->pdev)) {
+    rc = PTR_ERR(fake->pdev);
+    kfree(fake);
+    return ERR_PTR(rc);
+  }
+
+  mcs9835_fakes[dev_idx] = fake;
+
+  LOG(MCS_INI, "emulated device %d created\n", dev_idx);
+
+  return fake;
+}
+
+/****************************************************************************/
+
+void mcs9835_fake_destroy(struct mcs9835_fake *fake)
+{
+  mcs9835_fakes[fake->dev_idx] = NULL;
+  platform_device_unregister(fake->pdev);
+  kfree(fake);
+}
+
+/****************************************************************************/
+
+void __iomem *mcs9835_fake_bar(struct mcs9835_fake *fake,
+			       unsigned bar)
+{
+  return (void __iomem *)fake->bars[bar];
+}
+
+/****************************************************************************/
+
+struct device *mcs9835_fake_device(struct mcs9835_fake *fake)
+{
+  return &fake->pdev->dev;
+}
+
+/****************************************************************************/
+
+int mcs9835_fake_request_irq(struct mcs9835_fake *fake,
+			     irq_handler_t handler,
+			     void *dev_id)
+{
+  unsigned long flags;
+
+  spin_lock_irqsave(&fake->lock, flags);
+  fake->handler = handler;
+  fake->dev_id  = dev_id;
+  spin_unlock_irqrestore(&fake->lock, flags);
+
+  return 0;
+}
+
+/****************************************************************************/
+
+void mcs9835_fake_free_irq(struct mcs9835_fake *fake)
+{
+  unsigned long flags;
+
+  spin_lock_irqsave(&fake->lock, flags);
+  fake->handler = NULL;
+  spin_unlock_irqrestore(&fake->lock, flags);
+
+  irq_work_sync(&fake->irq_work);
+}
+
+/****************************************************************************/
+
+u8 mcs9835_fake_read8(const void __iomem *addr)
+{
+  struct mcs9835_fake *fake;
+  unsigned bar;
+  unsigned offset;
+  unsigned long flags;
+  u8 value;
+
+  fake = fake_lookup(addr, &bar, &offset);
+  if (fake == NULL) {
+    return 0xff; /* Nothing decodes the address */
+  }
+
+  spin_lock_irqsave(&fake->lock, flags);
+  value = fake_read(fake, bar, offset);
+  spin_unlock_irqrestore(&fake->lock, flags);
+
+  return value;
+}
+
+/****************************************************************************/
+
+void mcs9835_fake_write8(u8 value,
+			 void __iomem *addr)
+{
+  struct mcs9835_fake *fake;
+  unsigned bar;
+  unsigned offset;
+  unsigned long flags;
+  int raise;
+
+  fake = fake_lookup(addr, &bar, &offset);
+  if (fake == NULL) {
+    return;
+  }
+
+  spin_lock_irqsave(&fake->lock, flags);
+  fake_write(fake, bar, offset, value);
+  raise = fake_irq_pending(fake);
+  spin_unlock_irqrestore(&fake->lock, flags);
+
+  if (raise) {
+    irq_work_queue(&fake->irq_work);
+  }
+}
+
+/****************************************************************************/
+
+void mcs9835_fake_read8_rep(const void __iomem *addr,
+			    void *buf,
+			    unsigned long count)
+{
+  u8 *p = buf;
+
+  while (count--) {
+    *p++ = mcs9835_fake_read8(addr);
+  }
+}
+
+/****************************************************************************/
+
+void mcs9835_fake_write8_rep(void __iomem *addr,
+			     const void *buf,
+			     unsigned long count)
+{
+  const u8 *p = buf;
+
+  while (count--) {
+    mcs9835_fake_write8(*p++, addr);
+  }
+}
+
+/****************************************************************************
+ *
+ * Register emulation
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+static struct mcs9835_fake *fake_lookup(const void __iomem *addr,
+					unsigned *bar,
+					unsigned *offset)
+{
+  const u8 *p = (const u8 __force *)addr;
+  struct mcs9835_fake *fake;
+  size_t pos;
+  int i;
+
+  for (i=0; i < MCS9835_MAX_DEVICES; i++) {
+    fake = mcs9835_fakes[i];
+    if ( (fake != NULL) &&
+	 (p >= &fake->bars[0][0]) &&
+	 (p < &fake->bars[MCS9835_NUM_BARS][0]) ) {
+      pos = p - &fake->bars[0][0];
+      *bar    = pos / MCS9835_FAKE_BAR_SIZE;
+      *offset = pos % MCS9835_FAKE_BAR_SIZE;
+      return fake;
+    }
+  }
+
+  return NULL;
+}
+
+/****************************************************************************/
+
+static u8 fake_read(struct mcs9835_fake *fake,
+		    unsigned bar,
+		    unsigned offset)
+{
+  u8 value;
+
+  switch (bar) {
+  case MCS9835_BAR_UART_A:
+  case MCS9835_BAR_UART_B:
+    return fake_uart_read(&fake->uart[bar], offset);
+  case MCS9835_BAR_PARPORT:
+    switch (offset) {
+    case MCS9835_PARPORT_REG_DPR:
+      return fake->dpr;
+    case MCS9835_PARPORT_REG_DSR:
+      value = fake_parport_dsr(fake);
+      fake->ack_pending = 0; /* Cleared by reading */
+      return value;
+    case MCS9835_PARPORT_REG_DCR:
+      return fake->dcr | MCS9835_FAKE_DCR_ONES;
+    case MCS9835_PARPORT_REG_EPP_ADDR:
+      return fake->epp_addr;
+    case MCS9835_PARPORT_REG_EPP_DATA:
+      return fake->epp_data;
+    default:
+      return 0xff;
+    }
+  default:
+    switch (offset) {
+    case MCS9835_ECP_REG_CFGB:
+      return fake->cfgb;
+    case MCS9835_ECP_REG_ECR:
+      /* FIFO drains as soon as it is written */
+      return fake->ecr | MCS9835_ECR_FIFO_EMPTY;
+    default:
+      return 0xff;
+    }
+  }
+}
+
+/****************************************************************************/
+
+static void fake_write(struct mcs9835_fake *fake,
+		       unsigned bar,
+		       unsigned offset,
+		       u8 value)
+{
+  switch (bar) {
+  case MCS9835_BAR_UART_A:
+  case MCS9835_BAR_UART_B:
+    fake_uart_write(&fake->uart[bar], offset, value);
+    break;
+  case MCS9835_BAR_PARPORT:
+    switch (offset) {
+    case MCS9835_PARPORT_REG_DPR:
+      fake_parport_data(fake, value);
+      break;
+    case MCS9835_PARPORT_REG_DCR:
+      fake->dcr = value & ~MCS9835_FAKE_DCR_ONES;
+      break;
+    case MCS9835_PARPORT_REG_EPP_ADDR:
+      fake->epp_addr = value; /* Peripheral echoes the last cycle */
+      break;
+    case MCS9835_PARPORT_REG_EPP_DATA:
+      fake->epp_data = value;
+      break;
+    }
+    break;
+  default:
+    switch (offset) {
+    case MCS9835_ECP_REG_FIFO:
+      fake_parport_data(fake, value); /* Straight out on the data lines */
+      break;
+    case MCS9835_ECP_REG_CFGB:
+      fake->cfgb = value;
+      break;
+    case MCS9835_ECP_REG_ECR:
+      fake->ecr = value & ~(MCS9835_ECR_FIFO_EMPTY | MCS9835_ECR_FIFO_FULL);
+      break;
+    }
+  }
+}
+
+/****************************************************************************/
+
+/*
+ * Loopback plug, status lines 3-7 follow data lines D0-D4.
+ * nIRQ reads low while a nAck interrupt is latched.
+ */
+static u8 fake_parport_dsr(struct mcs9835_fake *fake)
+{
+  return (((fake->dpr << 3) & 0xf8) |
+	  (fake->ack_pending ? 0 : MCS9835_PARPORT_DSR_NIRQ));
+}
+
+/****************************************************************************/
+
+/*
+ * Drive the data lines. As the chip, the port interrupts only
+ * on the rising edge of nAck (D3 in loopback), the end of the pulse.
+ */
+static void fake_parport_data(struct mcs9835_fake *fake,
+			      u8 value)
+{
+  u8 nack = fake_parport_dsr(fake) & MCS9835_PARPORT_DSR_NACK;
+
+  fake->dpr = value;
+
+  if ( !nack &&
+       (fake_parport_dsr(fake) & MCS9835_PARPORT_DSR_NACK) &&
+       (fake->dcr & MCS9835_PARPORT_DCR_IRQ_EN) ) {
+    fake->ack_pending = 1;
+  }
+}
+
+/****************************************************************************/
+
+static u8 fake_uart_read(struct mcs9835_fake_uart *uart,
+			 unsigned offset)
+{
+  u8 value;
+
+  if ( (uart->lcr & MCS9835_UART_LCR_DLAB) &&
+       (offset <= MCS9835_UART_REG_DLM) ) {
+    return (offset == MCS9835_UART_REG_DLL ? uart->dll : uart->dlm);
+  }
+
+  switch (offset) {
+  case MCS9835_UART_REG_RBR:
+    if (uart->rx_count == 0) {
+      return 0;
+    }
+    value = uart->rx[uart->rx_head];
+    uart->rx_head = (uart->rx_head + 1) % MCS9835_UART_FIFO_SIZE;
+    uart->rx_count--;
+    return value;
+  case MCS9835_UART_REG_IER:
+    return uart->ier;
+  case MCS9835_UART_REG_IIR:
+    value = fake_uart_iir(uart);
+    if ((value & MCS9835_UART_IIR_ID) == MCS9835_UART_IIR_THRI) {
+      uart->thre_pending = 0; /* Cleared by reading IIR */
+    }
+    if (uart->fcr & MCS9835_UART_FCR_ENABLE) {
+      value |= 0xc0;
+    }
+    return value;
+  case MCS9835_UART_REG_LCR:
+    return uart->lcr;
+  case MCS9835_UART_REG_MCR:
+    return uart->mcr;
+  case MCS9835_UART_REG_LSR:
+    /* Transmitter always empty, data is looped back at once */
+    value = (MCS9835_UART_LSR_THRE | MCS9835_UART_LSR_TEMT | uart->lsr_err);
+    if (uart->rx_count) {
+      value |= MCS9835_UART_LSR_DR;
+    }
+    uart->lsr_err = 0;
+    return value;
+  case MCS9835_UART_REG_MSR:
+    return MCS9835_FAKE_MSR;
+  default:
+    return uart->scr;
+  }
+}
+
+/****************************************************************************/
+
+static void fake_uart_write(struct mcs9835_fake_uart *uart,
+			    unsigned offset,
+			    u8 value)
+{
+  if ( (uart->lcr & MCS9835_UART_LCR_DLAB) &&
+       (offset <= MCS9835_UART_REG_DLM) ) {
+    if (offset == MCS9835_UART_REG_DLL) {
+      uart->dll = value;
+    } else {
+      uart->dlm = value;
+    }
+    return;
+  }
+
+  switch (offset) {
+  case MCS9835_UART_REG_THR:
+    /* Loop back to own receiver */
+    if (uart->rx_count < MCS9835_UART_FIFO_SIZE) {
+      uart->rx[(uart->rx_head + uart->rx_count) % MCS9835_UART_FIFO_SIZE] =
+	value;
+      uart->rx_count++;
+    } else {
+      uart->lsr_err |= MCS9835_UART_LSR_OE;
+    }
+    uart->thre_pending = 1;
+    break;
+  case MCS9835_UART_REG_IER:
+    /* Enabling the interrupt with an empty transmitter raises it */
+    if ((value & ~uart->ier) & MCS9835_UART_IER_THRI) {
+      uart->thre_pending = 1;
+    }
+    uart->ier = value & 0x0f;
+    break;
+  case MCS9835_UART_REG_FCR:
+    if (value & MCS9835_UART_FCR_CLEAR_RCVR) {
+      uart->rx_head  = 0;
+      uart->rx_count = 0;
+    }
+    uart->fcr = value & ~(MCS9835_UART_FCR_CLEAR_RCVR |
+			  MCS9835_UART_FCR_CLEAR_XMIT);
+    break;
+  case MCS9835_UART_REG_LCR:
+    uart->lcr = value;
+    break;
+  case MCS9835_UART_REG_MCR:
+    uart->mcr = value;
+    break;
+  case MCS9835_UART_REG_SCR:
+    uart->scr = value;
+    break;
+  }
+}
+
+/****************************************************************************/
+
+/*
+ * Highest priority pending interrupt, as the 16550.
+ * Fewer characters than the trigger level report a timeout.
+ */
+static u8 fake_uart_iir(struct mcs9835_fake_uart *uart)
+{
+  unsigned trigger;
+
+  switch (uart->fcr & MCS9835_UART_FCR_TRIGGER_14) {
+  case MCS9835_UART_FCR_TRIGGER_14:
+    trigger = 14;
+    break;
+  case MCS9835_UART_FCR_TRIGGER_8:
+    trigger = 8;
+    break;
+  case MCS9835_UART_FCR_TRIGGER_4:
+    trigger = 4;
+    break;
+  default:
+    trigger = 1;
+    break;
+  }
+
+  if ( (uart->ier & MCS9835_UART_IER_RLSI) && uart->lsr_err ) {
+    return MCS9835_UART_IIR_RLSI;
+  }
+  if ( (uart->ier & MCS9835_UART_IER_RDI) && uart->rx_count ) {
+    return (uart->rx_count >= trigger ?
+	    MCS9835_UART_IIR_RDI :
+	    MCS9835_UART_IIR_CTI);
+  }
+  if ( (uart->ier & MCS9835_UART_IER_THRI) && uart->thre_pending ) {
+    return MCS9835_UART_IIR_THRI;
+  }
+
+  return MCS9835_UART_IIR_NO_INT;
+}
+
+/****************************************************************************
+ *
+ * Interrupt emulation
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+/*
+ * Check for a pending interrupt, called with fake lock held.
+ * UART interrupts need OUT2, the parallel port interrupts on
+ * a latched nAck edge while enabled.
+ */
+static int fake_irq_pending(struct mcs9835_fake *fake)
+{
+  struct mcs9835_fake_uart *uart;
+  int i;
+
+  if (fake->handler == NULL) {
+    return 0;
+  }
+
+  for (i=0; i < MCS9835_MAX_UARTS; i++) {
+    uart = &fake->uart[i];
+    if ( (uart->mcr & MCS9835_UART_MCR_OUT2) &&
+	 !(fake_uart_iir(uart) & MCS9835_UART_IIR_NO_INT) ) {
+      return 1;
+    }
+  }
+
+  if ( (fake->dcr & MCS9835_PARPORT_DCR_IRQ_EN) &&
+       fake->ack_pending ) {
+    return 1;
+  }
+
+  return 0;
+}
+
+/****************************************************************************/
+
+/*
+ * Run the interrupt handler in hard interrupt context,
+ * as for a real interrupt line.
+ */
+static void fake_irq_work(struct irq_work *work)
+{
+  struct mcs9835_fake *fake = container_of(work,
+					   struct mcs9835_fake,
+					   irq_work);
+  irq_handler_t handler;
+  void *dev_id;
+
+  spin_lock(&fake->lock);
+  handler = fake->handler;
+  dev_id  = fake->dev_id;
+  spin_unlock(&fake->lock);
+
+  if (handler != NULL) {
+    handler(0, dev_id);
+  }
+}
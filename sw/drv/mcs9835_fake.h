@@ -0,0 +1,83 @@
+/***********************************************************************
+*                                                                      *
+* Copyright (C) 2017 Bonden i Nol (hakanbrolin@hotmail.com)            *
+*                                                                      *
+* This program is free software; you can redistribute it and/or modify *
+* it under the terms of the GNU General Public License as published by *
+* the Free Software Foundation; either version 2 of the License, or    *
+* (at your option) any later version.                                  *
+*                                                                      *
+************************************************************************/
+
+#ifndef __MCS9835_FAKE_H__
+#define __MCS9835_FAKE_H__
+
+/*
+ * Emulated MCS9835, built with FAKE_HW=1.
+ * The BARs are emulated in memory, register access of the whole
+ * driver is redirected here. The UARTs loop transmitted data back
+ * to their own receiver, the parallel port status lines follow
+ * data lines D0-D4 like a loopback plug.
+ */
+
+#include <linux/io.h>
+#include <linux/device.h>
+#include <linux/interrupt.h>
+
+/****************************************************************************
+ *
+ * Macros
+ *
+ ****************************************************************************/
+
+/* Emulated BAR size (bytes) */
+#define MCS9835_FAKE_BAR_SIZE  8
+
+/* Register access goes to the emulated device */
+#undef ioread8
+#undef iowrite8
+#undef ioread8_rep
+#undef iowrite8_rep
+
+#define ioread8(addr)  mcs9835_fake_read8(addr)
+#define iowrite8(value, addr)  mcs9835_fake_write8(value, addr)
+#define ioread8_rep(addr, buf, count)  mcs9835_fake_read8_rep(addr, buf, count)
+#define iowrite8_rep(addr, buf, count) mcs9835_fake_write8_rep(addr, buf, count)
+
+/****************************************************************************
+ *
+ * Exported functions
+ *
+ ****************************************************************************/
+
+struct mcs9835_fake;
+
+extern struct mcs9835_fake *mcs9835_fake_create(int dev_idx);
+
+extern void mcs9835_fake_destroy(struct mcs9835_fake *fake);
+
+extern void __iomem *mcs9835_fake_bar(struct mcs9835_fake *fake,
+				      unsigned bar);
+
+extern struct device *mcs9835_fake_device(struct mcs9835_fake *fake);
+
+extern int mcs9835_fake_request_irq(struct mcs9835_fake *fake,
+				    irq_handler_t handler,
+				    void *dev_id);
+
+extern void mcs9835_fake_free_irq(struct mcs9835_fake *fake);
+
+extern u8 mcs9835_fake_read8(const void __iomem *addr);
+
+extern void mcs9835_fake_write8(u8 value,
+				void __iomem *addr);
+
+extern void mcs9835_fake_read8_rep(const void __iomem *addr,
+				   void *buf,
+				   unsigned long count);
+
+extern void mcs9835_fake_write8_rep(void __iomem *addr,
+				    const void *buf,
+				    unsigned long count);
+
+#endif /* __MCS9835_FAKE_H__ */
@@ -0,0 +1,387 @@
+/***********************************************************************
+*                                                                      *
+* Copyright (C) 2017 Bonden i Nol (hakanbrolin@hotmail.com)            *
+*                                                                      *
+* This program is free software; you can redistribute it and/or modify *
+* it under the terms of the GNU General Public License as published by *
+* the Free Software Foundation; either version 2 of the License, or    *
+* (at your option) any later version.                                  *
+*                                                                      *
+************************************************************************/
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bitops.h>
+#include <linux/version.h>
+
+#include "mcs9835_gpio.h"
+#include "mcs9835_log.h"
+#include "mcs9835_hw.h"
+#include "mcs9835_trace.h"
+
+#ifdef MCS9835_HAVE_GPIO
+
+/****************************************************************************
+ *
+ * Macros
+ *
+ ****************************************************************************/
+
+/* Kernel compatibility */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,17,0)
+#define MCS9835_GPIO_SET_RC /* set/set_multiple return an error code */
+#endif
+#ifndef GPIO_LINE_DIRECTION_IN
+#define GPIO_LINE_DIRECTION_IN   1
+#define GPIO_LINE_DIRECTION_OUT  0
+#endif
+
+/* Register bits of the lines */
+#define MCS9835_GPIO_STATUS_SHIFT  3    /* nError is DSR bit 3       */
+#define MCS9835_GPIO_STATUS_BITS   0x1f
+#define MCS9835_GPIO_CONTROL_BITS  0x0f /* nStrobe to nSelectIn      */
+
+/* Register bits inverted by the hardware, Busy and DCR bits 0,1,3 */
+#define MCS9835_GPIO_DSR_INVERTED  0x80
+#define MCS9835_GPIO_DCR_INVERTED  0x0b
+
+/* Lines of each register, as GPIO bitmap */
+#define MCS9835_GPIO_DATA_MASK \
+  (0xffUL << MCS9835_GPIO_LINE_DATA)
+#define MCS9835_GPIO_STATUS_MASK \
+  ((unsigned long)MCS9835_GPIO_STATUS_BITS << MCS9835_GPIO_LINE_STATUS)
+#define MCS9835_GPIO_CONTROL_MASK \
+  ((unsigned long)MCS9835_GPIO_CONTROL_BITS << MCS9835_GPIO_LINE_CONTROL)
+
+/****************************************************************************
+ *
+ * Function prototypes
+ *
+ ****************************************************************************/
+
+static int mcs9835_gpio_get_direction(struct gpio_chip *chip,
+				      unsigned int offset);
+
+static int mcs9835_gpio_direction_input(struct gpio_chip *chip,
+					unsigned int offset);
+
+static int mcs9835_gpio_direction_output(struct gpio_chip *chip,
+					 unsigned int offset,
+					 int value);
+
+static int mcs9835_gpio_get(struct gpio_chip *chip,
+			    unsigned int offset);
+
+static int mcs9835_gpio_get_multiple(struct gpio_chip *chip,
+				     unsigned long *mask,
+				     unsigned long *bits);
+
+#ifdef MCS9835_GPIO_SET_RC
+static int mcs9835_gpio_set(struct gpio_chip *chip,
+			    unsigned int offset,
+			    int value);
+
+static int mcs9835_gpio_set_multiple(struct gpio_chip *chip,
+				     unsigned long *mask,
+				     unsigned long *bits);
+#else
+static void mcs9835_gpio_set(struct gpio_chip *chip,
+			     unsigned int offset,
+			     int value);
+
+static void mcs9835_gpio_set_multiple(struct gpio_chip *chip,
+				      unsigned long *mask,
+				      unsigned long *bits);
+#endif
+
+static int gpio_write(struct mcs9835_dev *dev,
+		      unsigned long mask,
+		      unsigned long bits);
+
+/****************************************************************************
+ *
+ * Private data
+ *
+ ****************************************************************************/
+
+static const char *const mcs9835_gpio_names[MCS9835_GPIO_LINES] = {
+  "D0", "D1", "D2", "D3", "D4", "D5", "D6", "D7",
+  "nError", "Select", "PaperOut", "nAck", "Busy",
+  "nStrobe", "nAutoFd", "nInit", "nSelectIn",
+};
+
+/****************************************************************************
+ *
+ * Exported functions
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+/*
+ * Register the parallel port pins as a GPIO chip.
+ * The device works without it, failure is only logged.
+ */
+void mcs9835_gpio_initialize(struct mcs9835_dev *dev)
+{
+  struct gpio_chip *chip = &dev->gpio;
+  int rc;
+
+  memset(chip, 0, sizeof(*chip));
+  chip->label            = dev_name(dev->parent);
+  chip->parent           = dev->parent;
+  chip->owner            = THIS_MODULE;
+  chip->base             = -1;
+  chip->ngpio            = MCS9835_GPIO_LINES;
+  chip->names            = mcs9835_gpio_names;
+  chip->can_sleep        = true; /* Takes the parport mutex */
+  chip->get_direction    = mcs9835_gpio_get_direction;
+  chip->direction_input  = mcs9835_gpio_direction_input;
+  chip->direction_output = mcs9835_gpio_direction_output;
+  chip->get              = mcs9835_gpio_get;
+  chip->get_multiple     = mcs9835_gpio_get_multiple;
+  chip->set              = mcs9835_gpio_set;
+  chip->set_multiple     = mcs9835_gpio_set_multiple;
+
+  rc = gpiochip_add_data(chip, dev);
+  if (rc) {
+    LOG(MCS_WRN, "add GPIO chip failed (%d)\n", rc);
+    dev->have_gpio = 0;
+    return;
+  }
+  dev->have_gpio = 1;
+
+  LOG(MCS_INI, "GPIO chip %s, %u lines\n", chip->label, chip->ngpio);
+}
+
+/****************************************************************************/
+
+/*
+ * Remove the GPIO chip, consumers still holding lines get errors
+ * from gpiolib.
+ */
+void mcs9835_gpio_remove(struct mcs9835_dev *dev)
+{
+  if (dev->have_gpio) {
+    gpiochip_remove(&dev->gpio);
+    dev->have_gpio = 0;
+  }
+}
+
+/****************************************************************************
+ *
+ * GPIO chip operations
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+static int mcs9835_gpio_get_direction(struct gpio_chip *chip,
+				      unsigned int offset)
+{
+  if (BIT(offset) & MCS9835_GPIO_STATUS_MASK) {
+    return GPIO_LINE_DIRECTION_IN;
+  }
+  return GPIO_LINE_DIRECTION_OUT;
+}
+
+/****************************************************************************/
+
+static int mcs9835_gpio_direction_input(struct gpio_chip *chip,
+					unsigned int offset)
+{
+  /* Directions are fixed */
+  if (BIT(offset) & MCS9835_GPIO_STATUS_MASK) {
+    return 0;
+  }
+  return -EINVAL;
+}
+
+/****************************************************************************/
+
+static int mcs9835_gpio_direction_output(struct gpio_chip *chip,
+					 unsigned int offset,
+					 int value)
+{
+  /* Directions are fixed */
+  if (BIT(offset) & MCS9835_GPIO_STATUS_MASK) {
+    return -EINVAL;
+  }
+  return gpio_write(gpiochip_get_data(chip),
+		    BIT(offset),
+		    (value ? BIT(offset) : 0));
+}
+
+/****************************************************************************/
+
+static int mcs9835_gpio_get(struct gpio_chip *chip,
+			    unsigned int offset)
+{
+  unsigned long mask = BIT(offset);
+  unsigned long bits = 0;
+  int rc;
+
+  rc = mcs9835_gpio_get_multiple(chip, &mask, &bits);
+  if (rc) {
+    return rc;
+  }
+  return ((bits & mask) != 0);
+}
+
+/****************************************************************************/
+
+/*
+ * Output lines come from the register copies, the status
+ * register is read once when any of its lines are asked for.
+ */
+static int mcs9835_gpio_get_multiple(struct gpio_chip *chip,
+				     unsigned long *mask,
+				     unsigned long *bits)
+{
+  struct mcs9835_dev *dev = gpiochip_get_data(chip);
+  unsigned long lines;
+  u8 dsr;
+  u8 dcr;
+
+  mutex_lock(&dev->parport_mutex);
+
+  /* Device removed */
+  if (!dev->init_done) {
+    mutex_unlock(&dev->parport_mutex);
+    return -ENODEV;
+  }
+
+  dcr = (dev->parport_dcr ^ MCS9835_GPIO_DCR_INVERTED) &
+    MCS9835_GPIO_CONTROL_BITS;
+  lines =
+    ((unsigned long)dev->parport_dpr << MCS9835_GPIO_LINE_DATA) |
+    ((unsigned long)dcr << MCS9835_GPIO_LINE_CONTROL);
+
+  if (*mask & MCS9835_GPIO_STATUS_MASK) {
+    dsr = mcs9835_parport_read_dsr(dev);
+    dsr = ((dsr ^ MCS9835_GPIO_DSR_INVERTED) >> MCS9835_GPIO_STATUS_SHIFT) &
+      MCS9835_GPIO_STATUS_BITS;
+    lines |= (unsigned long)dsr << MCS9835_GPIO_LINE_STATUS;
+  }
+
+  mutex_unlock(&dev->parport_mutex);
+
+  *bits = (*bits & ~*mask) | (lines & *mask);
+
+  return 0;
+}
+
+/****************************************************************************/
+
+#ifdef MCS9835_GPIO_SET_RC
+
+static int mcs9835_gpio_set(struct gpio_chip *chip,
+			    unsigned int offset,
+			    int value)
+{
+  return gpio_write(gpiochip_get_data(chip),
+		    BIT(offset),
+		    (value ? BIT(offset) : 0));
+}
+
+/****************************************************************************/
+
+static int mcs9835_gpio_set_multiple(struct gpio_chip *chip,
+				     unsigned long *mask,
+				     unsigned long *bits)
+{
+  return gpio_write(gpiochip_get_data(chip), *mask, *bits);
+}
+
+#else
+
+static void mcs9835_gpio_set(struct gpio_chip *chip,
+			     unsigned int offset,
+			     int value)
+{
+  gpio_write(gpiochip_get_data(chip),
+	     BIT(offset),
+	     (value ? BIT(offset) : 0));
+}
+
+/****************************************************************************/
+
+static void mcs9835_gpio_set_multiple(struct gpio_chip *chip,
+				      unsigned long *mask,
+				      unsigned long *bits)
+{
+  gpio_write(gpiochip_get_data(chip), *mask, *bits);
+}
+
+#endif
+
+/****************************************************************************
+ *
+ * Support functions
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+/*
+ * Set output lines, at most one write each of the data and the
+ * control register. Status lines in the mask are ignored.
+ */
+static int gpio_write(struct mcs9835_dev *dev,
+		      unsigned long mask,
+		      unsigned long bits)
+{
+  u8 data_mask = (mask & MCS9835_GPIO_DATA_MASK) >> MCS9835_GPIO_LINE_DATA;
+  u8 ctrl_mask = ((mask & MCS9835_GPIO_CONTROL_MASK) >>
+		  MCS9835_GPIO_LINE_CONTROL);
+  unsigned long flags;
+  u8 value;
+  int rc = 0;
+
+  mutex_lock(&dev->parport_mutex);
+
+  /* Device removed */
+  if (!dev->init_done) {
+    rc = -ENODEV;
+    goto write_out;
+  }
+
+  if (data_mask) {
+    /* Playback owns the data register */
+    if (dev->play_running) {
+      rc = -EBUSY;
+      goto write_out;
+    }
+    value = (dev->parport_dpr & ~data_mask) |
+      ((bits >> MCS9835_GPIO_LINE_DATA) & data_mask);
+    iowrite8(value, dev->vmem_bar2 + MCS9835_PARPORT_REG_DPR);
+    dev->parport_dpr = value;
+    trace_mcs9835_reg_write(dev->dev_idx, MCS9835_BAR_PARPORT,
+			    MCS9835_PARPORT_REG_DPR, value);
+  }
+
+  if (ctrl_mask) {
+    value = ((bits >> MCS9835_GPIO_LINE_CONTROL) ^
+	     MCS9835_GPIO_DCR_INVERTED) & ctrl_mask;
+
+    /* Interrupt enable and mode bits are updated from other contexts */
+    spin_lock_irqsave(&dev->parport_dcr_lock, flags);
+    value |= dev->parport_dcr & ~ctrl_mask;
+    iowrite8(value, dev->vmem_bar2 + MCS9835_PARPORT_REG_DCR);
+    dev->parport_dcr = value;
+    spin_unlock_irqrestore(&dev->parport_dcr_lock, flags);
+    trace_mcs9835_reg_write(dev->dev_idx, MCS9835_BAR_PARPORT,
+			    MCS9835_PARPORT_REG_DCR, value);
+  }
+
+ write_out:
+  mutex_unlock(&dev->parport_mutex);
+
+  if (rc) {
+    LOG(MCS_DBG, "GPIO write mask 0x%lx failed (%d)\n", mask, rc);
+  }
+
+  return rc;
+}
+
+#endif /* MCS9835_HAVE_GPIO */
@@ -0,0 +1,37 @@
+/***********************************************************************
+*                                                                      *
+* Copyright (C) 2017 Bonden i Nol (hakanbrolin@hotmail.com)            *
+*                                                                      *
+* This program is free software; you can redistribute it and/or modify *
+* it under the terms of the GNU General Public License as published by *
+* the Free Software Foundation; either version 2 of the License, or    *
+* (at your option) any later version.                                  *
+*                                                                      *
+************************************************************************/
+
+#ifndef __MCS9835_GPIO_H__
+#define __MCS9835_GPIO_H__
+
+#include "mcs9835.h"
+
+/****************************************************************************
+ * 
+ * Exported functions
+ *
+ ****************************************************************************/
+
+#ifdef MCS9835_HAVE_GPIO
+
+extern void mcs9835_gpio_initialize(struct mcs9835_dev *dev);
+
+extern void mcs9835_gpio_remove(struct mcs9835_dev *dev);
+
+#else
+
+static inline void mcs9835_gpio_initialize(struct mcs9835_dev *dev) {}
+
+static inline void mcs9835_gpio_remove(struct mcs9835_dev *dev) {}
+
+#endif
+
+#endif /* __MCS9835_GPIO_H__ */
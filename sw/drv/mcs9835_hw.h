@@ -20,11 +20,124 @@
 #define MCS9835_VENDOR_ID  PCI_VENDOR_ID_NETMOS
 #define MCS9835_DEVICE_ID  PCI_DEVICE_ID_NETMOS_9835
 
+/*
+ * PCI BARs, all I/O port type
+ */
+#define MCS9835_BAR_UART_A   0
+#define MCS9835_BAR_UART_B   1
+#define MCS9835_BAR_PARPORT  2
+#define MCS9835_BAR_CONFIG   3 /* Config A/B and ECR */
+
+#define MCS9835_NUM_BARS  4
+
 /*
  * Parallel port registers (BAR2 offset)
  */
 #define MCS9835_PARPORT_REG_DPR  0x00
 #define MCS9835_PARPORT_REG_DSR  0x01
 #define MCS9835_PARPORT_REG_DCR  0x02
+#define MCS9835_PARPORT_REG_EPP_ADDR  0x03 /* EPP address cycle */
+#define MCS9835_PARPORT_REG_EPP_DATA  0x04 /* EPP data cycle    */
+
+/*
+ * Parallel port status register bits
+ */
+#define MCS9835_PARPORT_DSR_EPP_TIMEOUT  0x01 /* EPP cycle not acknowledged */
+#define MCS9835_PARPORT_DSR_NIRQ         0x04 /* Low while nAck irq pending */
+#define MCS9835_PARPORT_DSR_NACK         0x40 /* nAck line                  */
+
+/*
+ * Parallel port control register bits
+ */
+#define MCS9835_PARPORT_DCR_NINIT   0x04 /* nInit, high is inactive */
+#define MCS9835_PARPORT_DCR_IRQ_EN  0x10 /* Interrupt on nAck */
+#define MCS9835_PARPORT_DCR_DIR     0x20 /* Data lines input    */
+
+/*
+ * Extended parallel port registers (BAR3 offset)
+ */
+#define MCS9835_ECP_REG_FIFO  0x00 /* Parallel port FIFO, config A (mode 111) */
+#define MCS9835_ECP_REG_CFGB  0x01 /* Config B (mode 111)                     */
+#define MCS9835_ECP_REG_ECR   0x02 /* Extended control register               */
+
+/* Hardware FIFO depth (bytes) */
+#define MCS9835_ECP_FIFO_SIZE  16
+
+/*
+ * Extended control register bits
+ */
+#define MCS9835_ECR_FIFO_EMPTY     0x01
+#define MCS9835_ECR_FIFO_FULL      0x02
+#define MCS9835_ECR_SERVICE_INTR   0x04 /* Set disables service interrupts */
+#define MCS9835_ECR_DMA_EN         0x08
+#define MCS9835_ECR_N_ERR_INTR_EN  0x10 /* Set disables nFault interrupt   */
+
+#define MCS9835_ECR_MODE_MASK  0xe0
+#define MCS9835_ECR_MODE_SPP   0x00 /* 000 Standard                */
+#define MCS9835_ECR_MODE_PS2   0x20 /* 001 Byte, bidirectional     */
+#define MCS9835_ECR_MODE_FIFO  0x40 /* 010 Parallel port FIFO      */
+#define MCS9835_ECR_MODE_ECP   0x60 /* 011 ECP                     */
+#define MCS9835_ECR_MODE_EPP   0x80 /* 100 EPP                     */
+#define MCS9835_ECR_MODE_TEST  0xc0 /* 110 Test                    */
+#define MCS9835_ECR_MODE_CFG   0xe0 /* 111 Configuration           */
+
+/*
+ * UART registers (BAR0 UART-A, BAR1 UART-B offset)
+ * 16550 compatible, 16 byte FIFOs
+ */
+#define MCS9835_UART_REG_RBR  0x00 /* Receive buffer    (read,  DLAB=0) */
+#define MCS9835_UART_REG_THR  0x00 /* Transmit holding  (write, DLAB=0) */
+#define MCS9835_UART_REG_DLL  0x00 /* Divisor latch LSB (DLAB=1)        */
+#define MCS9835_UART_REG_IER  0x01 /* Interrupt enable  (DLAB=0)        */
+#define MCS9835_UART_REG_DLM  0x01 /* Divisor latch MSB (DLAB=1)        */
+#define MCS9835_UART_REG_IIR  0x02 /* Interrupt ident   (read)          */
+#define MCS9835_UART_REG_FCR  0x02 /* FIFO control      (write)         */
+#define MCS9835_UART_REG_LCR  0x03 /* Line control                      */
+#define MCS9835_UART_REG_MCR  0x04 /* Modem control                     */
+#define MCS9835_UART_REG_LSR  0x05 /* Line status                       */
+#define MCS9835_UART_REG_MSR  0x06 /* Modem status                      */
+#define MCS9835_UART_REG_SCR  0x07 /* Scratch                           */
+
+#define MCS9835_UART_FIFO_SIZE  16
+#define MCS9835_UART_BASE_BAUD  115200
+
+/*
+ * UART register bits
+ */
+#define MCS9835_UART_IER_RDI   0x01 /* Receive data available  */
+#define MCS9835_UART_IER_THRI  0x02 /* Transmit holding empty  */
+#define MCS9835_UART_IER_RLSI  0x04 /* Receive line status     */
+#define MCS9835_UART_IER_MSI   0x08 /* Modem status            */
+
+#define MCS9835_UART_IIR_NO_INT  0x01 /* No interrupt pending       */
+#define MCS9835_UART_IIR_ID      0x0e /* Interrupt ID mask          */
+#define MCS9835_UART_IIR_MSI     0x00 /* Modem status               */
+#define MCS9835_UART_IIR_THRI    0x02 /* Transmit holding empty     */
+#define MCS9835_UART_IIR_RDI     0x04 /* Receive trigger level      */
+#define MCS9835_UART_IIR_RLSI    0x06 /* Receive line status        */
+#define MCS9835_UART_IIR_CTI     0x0c /* Receive character timeout  */
+
+#define MCS9835_UART_FCR_ENABLE      0x01
+#define MCS9835_UART_FCR_CLEAR_RCVR  0x02
+#define MCS9835_UART_FCR_CLEAR_XMIT  0x04
+#define MCS9835_UART_FCR_TRIGGER_1   0x00
+#define MCS9835_UART_FCR_TRIGGER_4   0x40
+#define MCS9835_UART_FCR_TRIGGER_8   0x80
+#define MCS9835_UART_FCR_TRIGGER_14  0xc0
+
+#define MCS9835_UART_LCR_WLEN8  0x03 /* 8 data bits, 1 stop, no parity */
+#define MCS9835_UART_LCR_DLAB   0x80 /* Divisor latch access            */
+
+#define MCS9835_UART_MCR_DTR   0x01
+#define MCS9835_UART_MCR_RTS   0x02
+#define MCS9835_UART_MCR_OUT2  0x08 /* Interrupt output enable */
+
+#define MCS9835_UART_LSR_DR    0x01 /* Data ready           */
+#define MCS9835_UART_LSR_OE    0x02 /* Overrun error        */
+#define MCS9835_UART_LSR_PE    0x04 /* Parity error         */
+#define MCS9835_UART_LSR_FE    0x08 /* Framing error        */
+#define MCS9835_UART_LSR_BI    0x10 /* Break interrupt      */
+#define MCS9835_UART_LSR_THRE  0x20 /* Transmit FIFO empty  */
+#define MCS9835_UART_LSR_TEMT  0x40 /* Transmitter empty    */
 
 #endif /* __MCS9835_HW_H__ */
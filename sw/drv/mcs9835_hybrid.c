@@ -0,0 +1,430 @@
+/***********************************************************************
+*                                                                      *
+* Copyright (C) 2017 Bonden i Nol (hakanbrolin@hotmail.com)            *
+*                                                                      *
+* This program is free software; you can redistribute it and/or modify *
+* it under the terms of the GNU General Public License as published by *
+* the Free Software Foundation; either version 2 of the License, or    *
+* (at your option) any later version.                                  *
+*                                                                      *
+************************************************************************/
+
+#include <linux/kernel.h>
+#include <linux/stddef.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/sysfs.h>
+#include <linux/device.h>
+#include <linux/version.h>
+
+#include "mcs9835_hybrid.h"
+#include "mcs9835_log.h"
+
+/****************************************************************************
+ *
+ * Macros
+ *
+ ****************************************************************************/
+
+/* Interrupt sources in sysfs */
+#define HYBRID_SRC_UART_A   0
+#define HYBRID_SRC_UART_B   1
+#define HYBRID_SRC_PARPORT  2
+
+/* Read-only attribute of one source */
+#define HYBRID_ATTR(_name, _show, _src, _field)				\
+  static struct hybrid_attr hybrid_attr_##_name = {			\
+    .attr   = __ATTR(_name, S_IRUGO, _show, NULL),			\
+    .source = _src,							\
+    .offset = offsetof(struct mcs9835_hybrid, _field),			\
+  }
+
+/* Writable attribute of one source */
+#define HYBRID_ATTR_RW(_name, _show, _store, _src, _field)		\
+  static struct hybrid_attr hybrid_attr_##_name = {			\
+    .attr   = __ATTR(_name, S_IRUGO | S_IWUSR, _show, _store),		\
+    .source = _src,							\
+    .offset = offsetof(struct mcs9835_hybrid, _field),			\
+  }
+
+/* Settings, mode and counters of one source */
+#define HYBRID_SOURCE_ATTRS(_src, _idx)					\
+  HYBRID_ATTR_RW(_src##_enter, hybrid_enter_show, hybrid_enter_store,	\
+		 _idx, enter_work);					\
+  HYBRID_ATTR(_src##_window_us, hybrid_window_show, _idx, window_ns);	\
+  HYBRID_ATTR(_src##_mode, hybrid_mode_show, _idx, polling);		\
+  HYBRID_ATTR(_src##_irqs, hybrid_counter_show, _idx, irqs);		\
+  HYBRID_ATTR(_src##_polls, hybrid_counter_show, _idx, polls);		\
+  HYBRID_ATTR(_src##_to_poll, hybrid_counter_show, _idx, to_poll);	\
+  HYBRID_ATTR(_src##_to_irq, hybrid_counter_show, _idx, to_irq)
+
+#define HYBRID_SOURCE_LIST(_src)			\
+  &hybrid_attr_##_src##_enter.attr.attr,		\
+  &hybrid_attr_##_src##_window_us.attr.attr,		\
+  &hybrid_attr_##_src##_mode.attr.attr,			\
+  &hybrid_attr_##_src##_irqs.attr.attr,			\
+  &hybrid_attr_##_src##_polls.attr.attr,		\
+  &hybrid_attr_##_src##_to_poll.attr.attr,		\
+  &hybrid_attr_##_src##_to_irq.attr.attr
+
+/****************************************************************************
+ *
+ * Support types
+ *
+ ****************************************************************************/
+
+struct hybrid_attr {
+  struct device_attribute attr;
+  int                     source; /* HYBRID_SRC_x                */
+  size_t                  offset; /* Field in struct mcs9835_hybrid */
+};
+
+/****************************************************************************
+ *
+ * Function prototypes
+ *
+ ****************************************************************************/
+
+static enum hrtimer_restart hybrid_timer(struct hrtimer *timer);
+
+static struct mcs9835_hybrid *hybrid_source(struct device *device,
+					    struct device_attribute *attr,
+					    size_t *offset);
+
+static ssize_t hybrid_mode_show(struct device *device,
+				struct device_attribute *attr,
+				char *buf);
+
+static ssize_t hybrid_counter_show(struct device *device,
+				   struct device_attribute *attr,
+				   char *buf);
+
+static ssize_t hybrid_enter_show(struct device *device,
+				 struct device_attribute *attr,
+				 char *buf);
+
+static ssize_t hybrid_enter_store(struct device *device,
+				  struct device_attribute *attr,
+				  const char *buf,
+				  size_t count);
+
+static ssize_t hybrid_window_show(struct device *device,
+				  struct device_attribute *attr,
+				  char *buf);
+
+static ssize_t exit_polls_show(struct device *device,
+			       struct device_attribute *attr,
+			       char *buf);
+
+static ssize_t exit_polls_store(struct device *device,
+				struct device_attribute *attr,
+				const char *buf,
+				size_t count);
+
+/****************************************************************************
+ *
+ * Sysfs attributes
+ * Group "hybrid" of the PCI device.
+ *
+ ****************************************************************************/
+static DEVICE_ATTR(exit_polls, S_IRUGO | S_IWUSR,
+		   exit_polls_show, exit_polls_store);
+
+HYBRID_SOURCE_ATTRS(uart_a, HYBRID_SRC_UART_A);
+HYBRID_SOURCE_ATTRS(uart_b, HYBRID_SRC_UART_B);
+HYBRID_SOURCE_ATTRS(parport, HYBRID_SRC_PARPORT);
+
+static struct attribute *mcs9835_hybrid_attrs[] = {
+  &dev_attr_exit_polls.attr,
+  HYBRID_SOURCE_LIST(uart_a),
+  HYBRID_SOURCE_LIST(uart_b),
+  HYBRID_SOURCE_LIST(parport),
+  NULL,
+};
+
+static const struct attribute_group mcs9835_hybrid_group = {
+  .name  = "hybrid",
+  .attrs = mcs9835_hybrid_attrs,
+};
+
+/****************************************************************************
+ *
+ * Exported functions
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+void mcs9835_hybrid_initialize(struct mcs9835_hybrid *hy,
+			       struct mcs9835_dev *dev,
+			       mcs9835_hybrid_poll_t poll,
+			       mcs9835_hybrid_unmask_t unmask,
+			       u64 poll_ns,
+			       u64 window_ns,
+			       unsigned enter_work)
+{
+  memset(hy, 0, sizeof(*hy));
+  hy->dev        = dev;
+  hy->poll       = poll;
+  hy->unmask     = unmask;
+  hy->poll_ns    = poll_ns;
+  hy->window_ns  = window_ns;
+  hy->enter_work = enter_work;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+  hrtimer_setup(&hy->timer, hybrid_timer,
+		CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+#else
+  hrtimer_init(&hy->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  hy->timer.function = hybrid_timer;
+#endif
+}
+
+/****************************************************************************/
+
+/*
+ * Count an interrupt handled for the source, and the work it did,
+ * bytes or events. Returns non-zero when the work within the window
+ * calls for polling, the caller then masks the interrupt.
+ * Called from the interrupt handler.
+ */
+int mcs9835_hybrid_irq(struct mcs9835_hybrid *hy,
+		       unsigned work)
+{
+  unsigned enter_work = hy->enter_work;
+  s64 now_ns;
+
+  hy->irqs++;
+
+  if (enter_work == 0) {
+    return 0;
+  }
+
+  now_ns = ktime_to_ns(ktime_get());
+  if (now_ns - hy->window_start_ns > hy->window_ns) {
+    hy->window_start_ns = now_ns;
+    hy->window_work     = 0;
+  }
+  hy->window_work += work;
+  if (hy->window_work < enter_work) {
+    return 0;
+  }
+
+  /* Sustained load, poll until it drains */
+  hy->window_work = 0;
+  hy->idle_polls  = 0;
+  hy->polling     = 1;
+  hy->to_poll++;
+  hrtimer_start(&hy->timer, ns_to_ktime(hy->poll_ns), HRTIMER_MODE_REL);
+
+  return 1;
+}
+
+/****************************************************************************/
+
+/*
+ * Stop polling, the interrupt is not unmasked.
+ * Returns with the timer stopped.
+ */
+void mcs9835_hybrid_stop(struct mcs9835_hybrid *hy)
+{
+  hrtimer_cancel(&hy->timer);
+  hy->polling = 0;
+}
+
+/****************************************************************************/
+
+/*
+ * Add the sysfs group, the device works without it.
+ */
+void mcs9835_hybrid_sysfs_create(struct mcs9835_dev *dev)
+{
+  if (sysfs_create_group(&dev->parent->kobj, &mcs9835_hybrid_group)) {
+    LOG(MCS_WRN, "create hybrid sysfs group failed\n");
+  }
+}
+
+/****************************************************************************/
+
+void mcs9835_hybrid_sysfs_remove(struct mcs9835_dev *dev)
+{
+  sysfs_remove_group(&dev->parent->kobj, &mcs9835_hybrid_group);
+}
+
+/****************************************************************************
+ *
+ * Timer handling
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+/*
+ * Poll the source, at most its budget per call.
+ * Back to interrupts after exit_polls polls without events.
+ */
+static enum hrtimer_restart hybrid_timer(struct hrtimer *timer)
+{
+  struct mcs9835_hybrid *hy = container_of(timer,
+					   struct mcs9835_hybrid,
+					   timer);
+
+  hy->polls++;
+
+  if (hy->poll(hy)) {
+    hy->idle_polls = 0;
+  } else if (++hy->idle_polls >= hy->dev->hybrid_exit_polls) {
+    /* Polling ends before the interrupt handler takes over */
+    hy->polling = 0;
+    hy->to_irq++;
+    smp_wmb();
+    hy->unmask(hy);
+    return HRTIMER_NORESTART;
+  }
+
+  hrtimer_forward_now(timer, ns_to_ktime(hy->poll_ns));
+
+  return HRTIMER_RESTART;
+}
+
+/****************************************************************************
+ *
+ * Sysfs functions
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+static struct mcs9835_hybrid *hybrid_source(struct device *device,
+					    struct device_attribute *attr,
+					    size_t *offset)
+{
+  struct mcs9835_dev *dev = dev_get_drvdata(device);
+  struct hybrid_attr *ha = container_of(attr, struct hybrid_attr, attr);
+
+  *offset = ha->offset;
+
+  switch (ha->source) {
+  case HYBRID_SRC_UART_A:
+    return &dev->uart[MCS9835_UART_IDX_A].rx_hybrid;
+  case HYBRID_SRC_UART_B:
+    return &dev->uart[MCS9835_UART_IDX_B].rx_hybrid;
+  default:
+    return &dev->parport_hybrid;
+  }
+}
+
+/****************************************************************************/
+
+static ssize_t hybrid_mode_show(struct device *device,
+				struct device_attribute *attr,
+				char *buf)
+{
+  struct mcs9835_hybrid *hy;
+  size_t offset;
+
+  hy = hybrid_source(device, attr, &offset);
+
+  return sprintf(buf, "%s\n", (hy->polling ? "poll" : "irq"));
+}
+
+/****************************************************************************/
+
+static ssize_t hybrid_counter_show(struct device *device,
+				   struct device_attribute *attr,
+				   char *buf)
+{
+  struct mcs9835_hybrid *hy;
+  size_t offset;
+
+  hy = hybrid_source(device, attr, &offset);
+
+  return sprintf(buf, "%lu\n", *(unsigned long *)((char *)hy + offset));
+}
+
+/****************************************************************************/
+
+static ssize_t hybrid_enter_show(struct device *device,
+				 struct device_attribute *attr,
+				 char *buf)
+{
+  struct mcs9835_hybrid *hy;
+  size_t offset;
+
+  hy = hybrid_source(device, attr, &offset);
+
+  return sprintf(buf, "%u\n", hy->enter_work);
+}
+
+/****************************************************************************/
+
+/*
+ * Work within the window of the source, UART bytes or parallel
+ * port events, that switches it to polling. 0 keeps it on interrupts.
+ */
+static ssize_t hybrid_enter_store(struct device *device,
+				  struct device_attribute *attr,
+				  const char *buf,
+				  size_t count)
+{
+  struct mcs9835_hybrid *hy;
+  size_t offset;
+  unsigned value;
+
+  if (kstrtouint(buf, 0, &value)) {
+    return -EINVAL;
+  }
+  hy = hybrid_source(device, attr, &offset);
+  hy->enter_work = value;
+
+  return count;
+}
+
+/****************************************************************************/
+
+static ssize_t hybrid_window_show(struct device *device,
+				  struct device_attribute *attr,
+				  char *buf)
+{
+  struct mcs9835_hybrid *hy;
+  size_t offset;
+
+  hy = hybrid_source(device, attr, &offset);
+
+  return sprintf(buf, "%llu\n",
+		 (unsigned long long)div_u64(hy->window_ns, NSEC_PER_USEC));
+}
+
+/****************************************************************************/
+
+static ssize_t exit_polls_show(struct device *device,
+			       struct device_attribute *attr,
+			       char *buf)
+{
+  struct mcs9835_dev *dev = dev_get_drvdata(device);
+
+  return sprintf(buf, "%u\n", dev->hybrid_exit_polls);
+}
+
+/****************************************************************************/
+
+/*
+ * Polls in a row without events that switch a source back
+ * to interrupts.
+ */
+static ssize_t exit_polls_store(struct device *device,
+				struct device_attribute *attr,
+				const char *buf,
+				size_t count)
+{
+  struct mcs9835_dev *dev = dev_get_drvdata(device);
+  unsigned value;
+
+  if ( kstrtouint(buf, 0, &value) ||
+       (value == 0) ) {
+    return -EINVAL;
+  }
+  dev->hybrid_exit_polls = value;
+
+  return count;
+}
@@ -0,0 +1,40 @@
+/***********************************************************************
+*                                                                      *
+* Copyright (C) 2017 Bonden i Nol (hakanbrolin@hotmail.com)            *
+*                                                                      *
+* This program is free software; you can redistribute it and/or modify *
+* it under the terms of the GNU General Public License as published by *
+* the Free Software Foundation; either version 2 of the License, or    *
+* (at your option) any later version.                                  *
+*                                                                      *
+************************************************************************/
+
+#ifndef __MCS9835_HYBRID_H__
+#define __MCS9835_HYBRID_H__
+
+#include "mcs9835.h"
+
+/****************************************************************************
+ * 
+ * Exported functions
+ *
+ ****************************************************************************/
+
+extern void mcs9835_hybrid_initialize(struct mcs9835_hybrid *hy,
+				      struct mcs9835_dev *dev,
+				      mcs9835_hybrid_poll_t poll,
+				      mcs9835_hybrid_unmask_t unmask,
+				      u64 poll_ns,
+				      u64 window_ns,
+				      unsigned enter_work);
+
+extern int mcs9835_hybrid_irq(struct mcs9835_hybrid *hy,
+			      unsigned work);
+
+extern void mcs9835_hybrid_stop(struct mcs9835_hybrid *hy);
+
+extern void mcs9835_hybrid_sysfs_create(struct mcs9835_dev *dev);
+
+extern void mcs9835_hybrid_sysfs_remove(struct mcs9835_dev *dev);
+
+#endif /* __MCS9835_HYBRID_H__ */
@@ -10,6 +10,13 @@
 ************************************************************************/
 
 #include <linux/errno.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/mutex.h>
+#include <linux/string.h>
+#include <linux/seq_file.h>
+#include <linux/debugfs.h>
+#include <asm/uaccess.h>
 
 #include "mcs9835_log.h"
 
@@ -34,6 +41,23 @@ typedef struct _MCS_LOGINFO_T_ {
   char            name[MCS_MAX_LOGNAME];
 } MCS_LOGINFO_T;
 
+/****************************************************************************
+ *
+ * Function prototypes
+ *
+ ****************************************************************************/
+
+static int mcs_open_log_level(struct inode *inode,
+			      struct file *file);
+
+static int mcs_show_log_level(struct seq_file *m,
+			      void *v);
+
+static ssize_t mcs_write_log_level(struct file *file,
+				   const char __user *buf,
+				   size_t count,
+				   loff_t *pos);
+
 /****************************************************************************
  *
  * Global variables
@@ -73,6 +97,22 @@ u32 mcs_log_level = MCS_ALR |
                     MCS_WRN | 
                     MCS_INF;
 
+/* Serializes runtime loglevel updates */
+static DEFINE_MUTEX(mcs_log_mutex);
+
+/*
+ * Runtime loglevel control, /sys/kernel/debug/mcs9835/loglevel
+ * Read shows current loglevels, write sets a new loglevel bitmask.
+ */
+static const struct file_operations mcs_fops_log_level = {
+  .owner   = THIS_MODULE,
+  .open    = mcs_open_log_level,
+  .read    = seq_read,
+  .write   = mcs_write_log_level,
+  .llseek  = seq_lseek,
+  .release = single_release,
+};
+
 /****************************************************************************
  *
  * Exported functions
@@ -136,3 +176,81 @@ long mcs_set_log_level(const u32 level,
   
   return 0;
 }
+
+/****************************************************************************/
+
+void mcs_log_debugfs_create(struct dentry *parent)
+{
+  if (parent == NULL) {
+    return;
+  }
+
+  debugfs_create_file("loglevel", 0644, parent, NULL, &mcs_fops_log_level);
+}
+
+/****************************************************************************
+ *
+ * File operation functions
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+static int mcs_open_log_level(struct inode *inode,
+			      struct file *file)
+{
+  return single_open(file, mcs_show_log_level, NULL);
+}
+
+/****************************************************************************/
+
+static int mcs_show_log_level(struct seq_file *m,
+			      void *v)
+{
+  int i = 0;
+
+  seq_printf(m, "Log mask: [0x%08x]\n", mcs_log_level);
+
+  for (i = 0; i < MCS_MAX_LOGLEVELS; i++) {
+    seq_printf(m, "0x%05x\t%s\t%s\n",
+	       log_list[i].level,
+	       (log_list[i].status == MCS_ENABLE ? "ON" : ""),
+	       log_list[i].name);
+  }
+
+  return 0;
+}
+
+/****************************************************************************/
+
+static ssize_t mcs_write_log_level(struct file *file,
+				   const char __user *buf,
+				   size_t count,
+				   loff_t *pos)
+{
+  char kbuf[16];
+  u32 level;
+  int rc;
+
+  /* Get new loglevel bitmask from user */
+  if (count >= sizeof(kbuf)) {
+    return -EINVAL;
+  }
+  if (copy_from_user(kbuf, buf, count)) {
+    return -EFAULT;
+  }
+  kbuf[count] = '\0';
+
+  rc = kstrtou32(strim(kbuf), 0, &level);
+  if (rc) {
+    return rc;
+  }
+
+  /* Switch to new bitmask, levels kept on are never off in between */
+  mutex_lock(&mcs_log_mutex);
+  mcs_set_log_level(~level, MCS_DISABLE);
+  mcs_set_log_level(level, MCS_ENABLE);
+  mutex_unlock(&mcs_log_mutex);
+
+  return count;
+}
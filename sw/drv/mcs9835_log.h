@@ -13,6 +13,7 @@
 #define __MCS9835_LOG_H__
 
 #include <linux/kernel.h>
+#include <linux/compiler.h>
 
 #include "mcs9835_product_info.h"
 
@@ -28,11 +29,11 @@
 #define MCS_INF (0x00000008)  /* General info               */
 
 #define MCS_INI (0x00000010)  /* Module init & device probe */
-#define MCS_REG (0x00000020)  /* Register access            */
+#define MCS_REG (0x00000020)  /* Unused, see tracepoints     */
 #define MCS_SEM (0x00000040)  /* Semaphore/synchronziation  */
 
 #define MCS_CDV (0x00000100)  /* Character device handling  */
-#define MCS_IRQ (0x00000200)  /* IRQ handling               */
+#define MCS_IRQ (0x00000200)  /* Unused, see tracepoints     */
 #define MCS_DMA (0x00000400)  /* DMA handling               */
 #define MCS_VMA (0x00000800)  /* Virtual memory mapping     */
 
@@ -43,18 +44,23 @@ extern u32 mcs_log_level;
 /*
  * Logs information to syslog if the requested loglevel is enabled.
  * If loglevel debug is enabled, add function name and line number
- * to the log string
+ * to the log string.
+ * Register access and interrupt handling are not logged here, they
+ * use the tracepoints in mcs9835_trace.h, enabled under
+ * /sys/kernel/tracing/events/mcs9835. The MCS_REG and MCS_IRQ bits
+ * are kept so existing loglevel masks stay valid, they log nothing.
  */
-#define LOG(logid, fmt, args...)		            \
-  if (mcs_log_level & logid) do {			    \
-      if ((mcs_log_level & MCS_DBG) || (logid == MCS_ERR)) {  \
-	printk(KERN_INFO DRV_NAME " (%s):%s():%d: ", #logid, __func__, __LINE__); \
-	printk(fmt, ## args);						\
+#define LOG(logid, fmt, args...)					\
+  do {									\
+    if (unlikely(mcs_log_level & (logid))) {				\
+      if ((mcs_log_level & MCS_DBG) || ((logid) == MCS_ERR)) {		\
+	printk(KERN_INFO DRV_NAME " (%s):%s():%d: " fmt,		\
+	       #logid, __func__, __LINE__, ## args);			\
       } else {								\
-	printk(KERN_INFO DRV_NAME " (%s): ", #logid);			\
-	printk(fmt, ## args);						\
+	printk(KERN_INFO DRV_NAME " (%s): " fmt, #logid, ## args);	\
       }									\
-  } while(0);
+    }									\
+  } while (0)
 
 /****************************************************************************
  *
@@ -82,4 +88,8 @@ extern void mcs_display_log_levels(void);
 extern long mcs_set_log_level(const u32 level,
 			      const MCS_LOGSTATUS_E status);
 
+struct dentry;
+
+extern void mcs_log_debugfs_create(struct dentry *parent);
+
 #endif /* __MCS9835_LOG_H__ */
@@ -0,0 +1,361 @@
+/***********************************************************************
+*                                                                      *
+* Copyright (C) 2017 Bonden i Nol (hakanbrolin@hotmail.com)            *
+*                                                                      *
+* This program is free software; you can redistribute it and/or modify *
+* it under the terms of the GNU General Public License as published by *
+* the Free Software Foundation; either version 2 of the License, or    *
+* (at your option) any later version.                                  *
+*                                                                      *
+************************************************************************/
+
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/sched.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/version.h>
+#include <asm/uaccess.h>
+
+#include "mcs9835_play.h"
+#include "mcs9835_log.h"
+#include "mcs9835_hw.h"
+#include "mcs9835_trace.h"
+
+/****************************************************************************
+ *
+ * Macros
+ *
+ ****************************************************************************/
+
+/* Steps copied from user at a time (stack buffer) */
+#define MCS9835_PLAY_COPY_STEPS  32
+
+/****************************************************************************
+ *
+ * Function prototypes
+ *
+ ****************************************************************************/
+
+static enum hrtimer_restart play_timer(struct hrtimer *timer);
+
+static long play_queue(struct mcs9835_dev *dev,
+		       struct file *file,
+		       struct mcs9835_play_queue __user *arg);
+
+static long play_start(struct mcs9835_dev *dev,
+		       struct file *file,
+		       struct mcs9835_play_start __user *arg);
+
+static long play_status(struct mcs9835_dev *dev,
+			struct mcs9835_play_status __user *arg);
+
+/****************************************************************************
+ *
+ * Exported functions
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+int mcs9835_play_initialize(struct mcs9835_dev *dev)
+{
+  int rc;
+
+  /* Absolute expiry times, steps don't accumulate timer latency */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+  hrtimer_setup(&dev->play_timer, play_timer, 
+		CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+#else
+  hrtimer_init(&dev->play_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+  dev->play_timer.function = play_timer;
+#endif
+
+  init_waitqueue_head(&dev->play_wq);
+  mutex_init(&dev->play_mutex);
+  dev->play_owner     = NULL;
+  dev->play_period_ns = 0;
+  dev->play_running   = 0;
+  dev->play_late      = 0;
+
+  rc = kfifo_alloc(&dev->play_steps, MCS9835_PLAY_STEPS, GFP_KERNEL);
+  if (rc) {
+    LOG(MCS_ERR, "allocate parallel port playback queue failed\n");
+    return rc;
+  }
+
+  return 0;
+}
+
+/****************************************************************************/
+
+/*
+ * Release playback resources.
+ * Called when the last reference to the device is gone.
+ */
+void mcs9835_play_finalize(struct mcs9835_dev *dev)
+{
+  kfifo_free(&dev->play_steps);
+}
+
+/****************************************************************************/
+
+/*
+ * Stop playing and discard queued steps.
+ * Returns with the timer stopped, no more register writes are made.
+ */
+void mcs9835_play_stop(struct mcs9835_dev *dev)
+{
+  hrtimer_cancel(&dev->play_timer);
+  dev->play_running = 0;
+  dev->play_owner   = NULL;
+
+  /* Release blocked queueing, then discard with producer stopped */
+  wake_up_interruptible(&dev->play_wq);
+  mutex_lock(&dev->play_mutex);
+  kfifo_reset(&dev->play_steps);
+  mutex_unlock(&dev->play_mutex);
+}
+
+/****************************************************************************/
+
+/*
+ * Queue one step without blocking.
+ * Called by the ring with the parport mutex held, so it must not wait
+ * for a queueing ioctl blocked on a full queue under the play mutex.
+ * Returns 0, -ENOSPC when the queue is full, -EAGAIN while another
+ * producer queues, or -ENODEV.
+ */
+int mcs9835_play_queue_step(struct mcs9835_dev *dev,
+			    const struct mcs9835_play_step *step)
+{
+  int rc = 0;
+
+  if (!mutex_trylock(&dev->play_mutex)) {
+    return -EAGAIN;
+  }
+
+  if (!dev->init_done) {
+    rc = -ENODEV;
+  } else if (kfifo_in(&dev->play_steps, step, 1) != 1) {
+    rc = -ENOSPC;
+  }
+
+  mutex_unlock(&dev->play_mutex);
+
+  return rc;
+}
+
+/****************************************************************************/
+
+long mcs9835_play_ioctl(struct mcs9835_dev *dev,
+			struct file *file,
+			unsigned int cmd,
+			unsigned long arg)
+{
+  switch (cmd) {
+  case MCS9835_IOC_PLAY_QUEUE:
+    return play_queue(dev, file, (void __user *)arg);
+  case MCS9835_IOC_PLAY_START:
+    return play_start(dev, file, (void __user *)arg);
+  case MCS9835_IOC_PLAY_STOP:
+    mcs9835_play_stop(dev);
+    return 0;
+  case MCS9835_IOC_PLAY_STATUS:
+    return play_status(dev, (void __user *)arg);
+  default:
+    return -ENOTTY;
+  }
+}
+
+/****************************************************************************
+ *
+ * Timer handling
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+/*
+ * Clock out one step to the data register and schedule the next.
+ * Single consumer of the step queue, no locking needed.
+ */
+static enum hrtimer_restart play_timer(struct hrtimer *timer)
+{
+  struct mcs9835_dev *dev = container_of(timer, 
+					 struct mcs9835_dev, 
+					 play_timer);
+  struct mcs9835_play_step step;
+  u32 interval_ns;
+
+  if (kfifo_out(&dev->play_steps, &step, 1) != 1) {
+    /* All steps played */
+    dev->play_running = 0;
+    wake_up_interruptible(&dev->play_wq);
+    return HRTIMER_NORESTART;
+  }
+
+  iowrite8(step.data, dev->vmem_bar2 + MCS9835_PARPORT_REG_DPR);
+  dev->parport_dpr = step.data;
+  trace_mcs9835_reg_write(dev->dev_idx, MCS9835_BAR_PARPORT, 
+			  MCS9835_PARPORT_REG_DPR, step.data);
+
+  interval_ns = (dev->play_period_ns ? 
+		 dev->play_period_ns : 
+		 step.interval_ns);
+  if (interval_ns < MCS9835_PLAY_MIN_INTERVAL_NS) {
+    interval_ns = MCS9835_PLAY_MIN_INTERVAL_NS;
+  }
+
+  if (ktime_to_ns(ktime_sub(ktime_get(), hrtimer_get_expires(timer))) >
+      interval_ns) {
+    dev->play_late++;
+  }
+
+  /* Half of the queue free, time for user to refill */
+  if (kfifo_len(&dev->play_steps) <= MCS9835_PLAY_STEPS / 2) {
+    wake_up_interruptible(&dev->play_wq);
+  }
+
+  hrtimer_add_expires_ns(timer, interval_ns);
+
+  return HRTIMER_RESTART;
+}
+
+/****************************************************************************
+ *
+ * Support functions
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+/*
+ * Queue steps, single producer serialized by play mutex.
+ * While playing, blocks until half of the queue is free so the user
+ * refills in large batches. When stopped, queues what fits.
+ * Returns number of steps queued.
+ */
+static long play_queue(struct mcs9835_dev *dev,
+		       struct file *file,
+		       struct mcs9835_play_queue __user *arg)
+{
+  struct mcs9835_play_step steps[MCS9835_PLAY_COPY_STEPS];
+  struct mcs9835_play_queue queue;
+  const struct mcs9835_play_step __user *usteps;
+  unsigned done = 0;
+  unsigned n;
+  long rc = 0;
+
+  if (copy_from_user(&queue, arg, sizeof(queue))) {
+    return -EFAULT;
+  }
+  usteps = (const void __user *)(unsigned long)queue.steps;
+
+  if (mutex_lock_interruptible(&dev->play_mutex)) {
+    return -ERESTARTSYS;
+  }
+
+  while (done < queue.count) {
+
+    if (!dev->init_done) {
+      rc = -ENODEV;
+      break;
+    }
+
+    /* Wait for space in queue */
+    if (kfifo_is_full(&dev->play_steps)) {
+      if (!dev->play_running) {
+	rc = -ENOSPC;
+	break;
+      }
+      if (file->f_flags & O_NONBLOCK) {
+	rc = -EAGAIN;
+	break;
+      }
+      if (wait_event_interruptible(dev->play_wq,
+				   (kfifo_len(&dev->play_steps) <= 
+				    MCS9835_PLAY_STEPS / 2) ||
+				   !dev->play_running ||
+				   !dev->init_done)) {
+	rc = -ERESTARTSYS;
+	break;
+      }
+      continue;
+    }
+
+    n = min_t(unsigned, queue.count - done, ARRAY_SIZE(steps));
+    n = min(n, kfifo_avail(&dev->play_steps));
+    if (copy_from_user(steps, usteps + done, n * sizeof(steps[0]))) {
+      rc = -EFAULT;
+      break;
+    }
+    kfifo_in(&dev->play_steps, steps, n);
+    done += n;
+  }
+
+  mutex_unlock(&dev->play_mutex);
+
+  return (done ? done : rc);
+}
+
+/****************************************************************************/
+
+/*
+ * Start playing queued steps, first step is played immediately.
+ * Playback owns the data register, the port must be in standard mode.
+ */
+static long play_start(struct mcs9835_dev *dev,
+		       struct file *file,
+		       struct mcs9835_play_start __user *arg)
+{
+  struct mcs9835_play_start start;
+  long rc = 0;
+
+  if (copy_from_user(&start, arg, sizeof(start))) {
+    return -EFAULT;
+  }
+
+  if (mutex_lock_interruptible(&dev->parport_mutex)) {
+    return -ERESTARTSYS;
+  }
+
+  if (!dev->init_done) {
+    rc = -ENODEV;
+  } else if (dev->parport_mode != MCS9835_PARPORT_MODE_SPP) {
+    rc = -EINVAL;
+  } else if (dev->play_running) {
+    rc = -EBUSY;
+  } else if (kfifo_is_empty(&dev->play_steps)) {
+    rc = -ENODATA;
+  } else {
+    dev->play_period_ns = start.period_ns;
+    dev->play_owner     = file;
+    dev->play_late      = 0;
+    dev->play_running   = 1;
+    hrtimer_start(&dev->play_timer, ktime_get(), HRTIMER_MODE_ABS);
+  }
+
+  mutex_unlock(&dev->parport_mutex);
+
+  return rc;
+}
+
+/****************************************************************************/
+
+static long play_status(struct mcs9835_dev *dev,
+			struct mcs9835_play_status __user *arg)
+{
+  struct mcs9835_play_status status;
+
+  memset(&status, 0, sizeof(status));
+  status.running = dev->play_running;
+  status.queued  = kfifo_len(&dev->play_steps);
+  status.late    = dev->play_late;
+
+  if (copy_to_user(arg, &status, sizeof(status))) {
+    return -EFAULT;
+  }
+
+  return 0;
+}
@@ -0,0 +1,39 @@
+/***********************************************************************
+*                                                                      *
+* Copyright (C) 2017 Bonden i Nol (hakanbrolin@hotmail.com)            *
+*                                                                      *
+* This program is free software; you can redistribute it and/or modify *
+* it under the terms of the GNU General Public License as published by *
+* the Free Software Foundation; either version 2 of the License, or    *
+* (at your option) any later version.                                  *
+*                                                                      *
+************************************************************************/
+
+#ifndef __MCS9835_PLAY_H__
+#define __MCS9835_PLAY_H__
+
+#include <linux/fs.h>
+
+#include "mcs9835.h"
+
+/****************************************************************************
+ * 
+ * Exported functions
+ *
+ ****************************************************************************/
+
+extern int mcs9835_play_initialize(struct mcs9835_dev *dev);
+
+extern void mcs9835_play_finalize(struct mcs9835_dev *dev);
+
+extern void mcs9835_play_stop(struct mcs9835_dev *dev);
+
+extern int mcs9835_play_queue_step(struct mcs9835_dev *dev,
+				   const struct mcs9835_play_step *step);
+
+extern long mcs9835_play_ioctl(struct mcs9835_dev *dev,
+			       struct file *file,
+			       unsigned int cmd,
+			       unsigned long arg);
+
+#endif /* __MCS9835_PLAY_H__ */
@@ -0,0 +1,485 @@
+/***********************************************************************
+*                                                                      *
+* Copyright (C) 2017 Bonden i Nol (hakanbrolin@hotmail.com)            *
+*                                                                      *
+* This program is free software; you can redistribute it and/or modify *
+* it under the terms of the GNU General Public License as published by *
+* the Free Software Foundation; either version 2 of the License, or    *
+* (at your option) any later version.                                  *
+*                                                                      *
+************************************************************************/
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/cache.h>
+#include <linux/vmalloc.h>
+#include <linux/version.h>
+#include <asm/uaccess.h>
+
+#include "mcs9835_ring.h"
+#include "mcs9835_play.h"
+#include "mcs9835_log.h"
+
+/****************************************************************************
+ *
+ * Macros
+ *
+ ****************************************************************************/
+
+/* Kernel compatibility */
+#ifndef READ_ONCE
+#define READ_ONCE(x)  ACCESS_ONCE(x)
+#endif
+
+/* Entries executed per hold of the parport mutex */
+#define MCS9835_RING_BATCH  64
+
+/****************************************************************************
+ *
+ * Support types
+ *
+ ****************************************************************************/
+
+/*
+ * Rings of one open file.
+ * The driver works from its own copies of the indices it owns,
+ * the shared header only publishes them.
+ */
+struct mcs9835_ring {
+  struct mcs9835_dev      *dev;
+  void                    *mem;    /* Shared with user, vmalloc */
+  struct mcs9835_ring_hdr *hdr;
+  struct mcs9835_ring_sqe *sq;
+  struct mcs9835_ring_cqe *cq;
+  u32                     sq_entries;
+  u32                     cq_entries;
+  u32                     sq_head; /* Entries taken       */
+  u32                     cq_tail; /* Completions added   */
+  unsigned long           size;    /* Mapping size        */
+  struct mutex            mutex;   /* Serializes execution */
+
+  /* Poll thread */
+  struct task_struct      *thread; /* NULL without polling */
+  wait_queue_head_t       wq;
+  u64                     poll_idle_ns;
+};
+
+/****************************************************************************
+ *
+ * Function prototypes
+ *
+ ****************************************************************************/
+
+static long ring_setup(struct mcs9835_parport_file *pfile,
+		       struct mcs9835_ring_setup __user *arg);
+
+static long ring_enter(struct mcs9835_ring *ring);
+
+static unsigned long ring_layout(u32 sq_entries,
+				 u32 cq_entries,
+				 u32 *sq_offset,
+				 u32 *cq_offset);
+
+static unsigned ring_process(struct mcs9835_ring *ring);
+
+static int ring_execute(struct mcs9835_dev *dev,
+			const struct mcs9835_ring_sqe *sqe);
+
+static int ring_pending(struct mcs9835_ring *ring);
+
+static int ring_poll_thread(void *data);
+
+/****************************************************************************
+ *
+ * Exported functions
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+/*
+ * Release the rings of a file being closed.
+ * No mappings are left, they hold the file open.
+ */
+void mcs9835_ring_release(struct mcs9835_parport_file *pfile)
+{
+  struct mcs9835_ring *ring = pfile->ring;
+
+  if (ring == NULL) {
+    return;
+  }
+
+  if (ring->thread != NULL) {
+    kthread_stop(ring->thread);
+  }
+  vfree(ring->mem);
+  kfree(ring);
+
+  pfile->ring = NULL;
+}
+
+/****************************************************************************/
+
+long mcs9835_ring_ioctl(struct mcs9835_parport_file *pfile,
+			unsigned int cmd,
+			unsigned long arg)
+{
+  struct mcs9835_ring *ring;
+
+  switch (cmd) {
+  case MCS9835_IOC_RING_SETUP:
+    return ring_setup(pfile, (void __user *)arg);
+  case MCS9835_IOC_RING_ENTER:
+    /* Set up once, published after initialization */
+    ring = READ_ONCE(pfile->ring);
+    if (ring == NULL) {
+      return -ENXIO;
+    }
+    smp_rmb();
+    return ring_enter(ring);
+  default:
+    return -ENOTTY;
+  }
+}
+
+/****************************************************************************/
+
+/*
+ * Map the rings read/write, header first.
+ * Shared mappings only, the driver must see what the user writes.
+ */
+int mcs9835_ring_mmap(struct mcs9835_parport_file *pfile,
+		      struct vm_area_struct *vma)
+{
+  struct mcs9835_ring *ring = READ_ONCE(pfile->ring);
+  unsigned long size = vma->vm_end - vma->vm_start;
+
+  if (ring == NULL) {
+    return -ENXIO;
+  }
+  smp_rmb();
+
+  if ( (size > ring->size) ||
+       !(vma->vm_flags & VM_SHARED) ) {
+    return -EINVAL;
+  }
+
+  LOG(MCS_VMA, "map submission rings, %lu bytes\n", size);
+
+  return remap_vmalloc_range(vma, ring->mem, 0);
+}
+
+/****************************************************************************
+ *
+ * Support functions
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+/*
+ * Allocate the rings, and start the poll thread if asked for.
+ * The size to map is returned before anything is allocated.
+ */
+static long ring_setup(struct mcs9835_parport_file *pfile,
+		       struct mcs9835_ring_setup __user *arg)
+{
+  struct mcs9835_dev *dev = pfile->dev;
+  struct mcs9835_ring_setup setup;
+  struct mcs9835_ring *ring = NULL;
+  unsigned long size;
+  u32 sq_offset;
+  u32 cq_offset;
+  long rc = 0;
+
+  if (copy_from_user(&setup, arg, sizeof(setup))) {
+    return -EFAULT;
+  }
+
+  /* Check user input */
+  if ( (setup.sq_entries == 0) ||
+       (setup.sq_entries > MCS9835_RING_MAX_ENTRIES) ||
+       !is_power_of_2(setup.sq_entries) ||
+       (setup.cq_entries < setup.sq_entries) ||
+       (setup.cq_entries > MCS9835_RING_MAX_ENTRIES) ||
+       !is_power_of_2(setup.cq_entries) ||
+       (setup.flags & ~MCS9835_RING_SETUP_POLL) ||
+       (setup.poll_idle_us > MCS9835_RING_POLL_IDLE_MAX_US) ) {
+    return -EINVAL;
+  }
+
+  size = ring_layout(setup.sq_entries, setup.cq_entries,
+		     &sq_offset, &cq_offset);
+  if (put_user((__u32)size, &arg->map_size)) {
+    return -EFAULT;
+  }
+
+  if (mutex_lock_interruptible(&pfile->mutex)) {
+    return -ERESTARTSYS;
+  }
+
+  /* Once per file */
+  if (pfile->ring != NULL) {
+    rc = -EBUSY;
+    goto setup_out;
+  }
+
+  ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+  if (ring == NULL) {
+    rc = -ENOMEM;
+    goto setup_out;
+  }
+
+  /* Zeroed, user memory can be mapped */
+  ring->mem = vmalloc_user(size);
+  if (ring->mem == NULL) {
+    rc = -ENOMEM;
+    goto setup_fail_1;
+  }
+
+  ring->dev          = dev;
+  ring->size         = size;
+  ring->hdr          = ring->mem;
+  ring->sq           = ring->mem + sq_offset;
+  ring->cq           = ring->mem + cq_offset;
+  ring->sq_entries   = setup.sq_entries;
+  ring->cq_entries   = setup.cq_entries;
+  ring->poll_idle_ns = (u64)setup.poll_idle_us * NSEC_PER_USEC;
+  mutex_init(&ring->mutex);
+  init_waitqueue_head(&ring->wq);
+
+  ring->hdr->sq_mask   = setup.sq_entries - 1;
+  ring->hdr->sq_offset = sq_offset;
+  ring->hdr->cq_mask   = setup.cq_entries - 1;
+  ring->hdr->cq_offset = cq_offset;
+
+  if (setup.flags & MCS9835_RING_SETUP_POLL) {
+    ring->thread = kthread_run(ring_poll_thread, ring, "%s_%d_ring",
+			       DRV_NAME, dev->dev_idx);
+    if (IS_ERR(ring->thread)) {
+      rc = PTR_ERR(ring->thread);
+      LOG(MCS_ERR, "start ring poll thread failed (%ld)\n", rc);
+      goto setup_fail_2;
+    }
+  }
+
+  /* Publish initialized rings to ioctl and mmap */
+  smp_wmb();
+  pfile->ring = ring;
+
+  LOG(MCS_INF, "rings sq:%u cq:%u%s, %lu bytes\n",
+      setup.sq_entries, setup.cq_entries,
+      (ring->thread ? " polled" : ""), size);
+
+  mutex_unlock(&pfile->mutex);
+
+  return 0;
+
+ setup_fail_2:
+  vfree(ring->mem);
+
+ setup_fail_1:
+  kfree(ring);
+
+ setup_out:
+  mutex_unlock(&pfile->mutex);
+
+  return rc;
+}
+
+/****************************************************************************/
+
+/*
+ * Execute posted entries, until the submission ring is empty or
+ * the completion ring is full. Returns entries executed.
+ * A polled ring is only woken up.
+ */
+static long ring_enter(struct mcs9835_ring *ring)
+{
+  unsigned done = 0;
+  unsigned n;
+
+  if (ring->thread != NULL) {
+    wake_up(&ring->wq);
+    return 0;
+  }
+
+  if (mutex_lock_interruptible(&ring->mutex)) {
+    return -ERESTARTSYS;
+  }
+
+  do {
+    n = ring_process(ring);
+    done += n;
+  } while ( (n == MCS9835_RING_BATCH) && !signal_pending(current) );
+
+  mutex_unlock(&ring->mutex);
+
+  return done;
+}
+
+/****************************************************************************/
+
+/*
+ * Place header, submission and completion entries on separate
+ * cache lines. Returns the page aligned size.
+ */
+static unsigned long ring_layout(u32 sq_entries,
+				 u32 cq_entries,
+				 u32 *sq_offset,
+				 u32 *cq_offset)
+{
+  *sq_offset = L1_CACHE_ALIGN(sizeof(struct mcs9835_ring_hdr));
+  *cq_offset = L1_CACHE_ALIGN(*sq_offset +
+			      sq_entries * sizeof(struct mcs9835_ring_sqe));
+
+  return PAGE_ALIGN(*cq_offset +
+		    cq_entries * sizeof(struct mcs9835_ring_cqe));
+}
+
+/****************************************************************************/
+
+/*
+ * Execute up to one batch of posted entries, as far as there
+ * is room for their completions. Returns entries executed.
+ * Single consumer of the submission ring, serialized by caller.
+ */
+static unsigned ring_process(struct mcs9835_ring *ring)
+{
+  struct mcs9835_dev *dev = ring->dev;
+  struct mcs9835_ring_hdr *hdr = ring->hdr;
+  struct mcs9835_ring_sqe sqe;
+  struct mcs9835_ring_cqe *cqe;
+  u32 sq_tail;
+  u32 cq_head;
+  unsigned n = 0;
+
+  sq_tail = READ_ONCE(hdr->sq_tail);
+  cq_head = READ_ONCE(hdr->cq_head);
+
+  /* Read entries after the tail that published them */
+  smp_rmb();
+
+  if (sq_tail == ring->sq_head) {
+    return 0;
+  }
+
+  mutex_lock(&dev->parport_mutex);
+
+  while ( (ring->sq_head != sq_tail) &&
+	  (ring->cq_tail - cq_head < ring->cq_entries) &&
+	  (n < MCS9835_RING_BATCH) ) {
+
+    /* Copy, the user may change the entry meanwhile */
+    sqe = ring->sq[ring->sq_head & (ring->sq_entries - 1)];
+    cqe = &ring->cq[ring->cq_tail & (ring->cq_entries - 1)];
+
+    cqe->user_data = sqe.user_data;
+    cqe->result    = (dev->init_done ? ring_execute(dev, &sqe) : -ENODEV);
+    cqe->reserved  = 0;
+
+    ring->sq_head++;
+    ring->cq_tail++;
+    n++;
+  }
+
+  mutex_unlock(&dev->parport_mutex);
+
+  /* Publish completions after they are written */
+  smp_wmb();
+  hdr->cq_tail = ring->cq_tail;
+  hdr->sq_head = ring->sq_head;
+
+  return n;
+}
+
+/****************************************************************************/
+
+/*
+ * Execute one entry, called with parport mutex held.
+ * Returns the value read, 0, or a negative error code.
+ */
+static int ring_execute(struct mcs9835_dev *dev,
+			const struct mcs9835_ring_sqe *sqe)
+{
+  struct mcs9835_reg_op op;
+  struct mcs9835_play_step step;
+  int rc;
+
+  switch (sqe->opcode) {
+  case MCS9835_RING_OP_NOP:
+    return 0;
+  case MCS9835_RING_OP_REG_READ:
+  case MCS9835_RING_OP_REG_WRITE:
+    op.bar      = sqe->bar;
+    op.offset   = sqe->offset;
+    op.op       = (sqe->opcode == MCS9835_RING_OP_REG_WRITE ?
+		   MCS9835_REG_OP_WRITE : MCS9835_REG_OP_READ);
+    op.value    = sqe->value;
+    op.delay_ns = sqe->arg;
+    rc = mcs9835_reg_op_check(dev, &op);
+    if (rc) {
+      return rc;
+    }
+    mcs9835_reg_op_execute(dev, &op);
+    return (op.op == MCS9835_REG_OP_READ ? op.value : 0);
+  case MCS9835_RING_OP_PLAY_STEP:
+    memset(&step, 0, sizeof(step));
+    step.interval_ns = sqe->arg;
+    step.data        = sqe->value;
+    return mcs9835_play_queue_step(dev, &step);
+  default:
+    return -EINVAL;
+  }
+}
+
+/****************************************************************************/
+
+/*
+ * Posted entries that can be executed.
+ */
+static int ring_pending(struct mcs9835_ring *ring)
+{
+  return ( (READ_ONCE(ring->hdr->sq_tail) != ring->sq_head) &&
+	   (ring->cq_tail - READ_ONCE(ring->hdr->cq_head) < ring->cq_entries) );
+}
+
+/****************************************************************************/
+
+/*
+ * Execute entries as they are posted. Idle for the poll idle
+ * time, flag that a wake-up is needed and sleep. The flag is set
+ * before the last check for entries, a user posting after that
+ * check sees it and calls MCS9835_IOC_RING_ENTER.
+ */
+static int ring_poll_thread(void *data)
+{
+  struct mcs9835_ring *ring = data;
+  struct mcs9835_ring_hdr *hdr = ring->hdr;
+  ktime_t idle_start = ktime_get();
+
+  while (!kthread_should_stop()) {
+
+    if (ring_process(ring)) {
+      idle_start = ktime_get();
+    } else if (ktime_to_ns(ktime_sub(ktime_get(), idle_start)) <
+	       ring->poll_idle_ns) {
+      cpu_relax();
+    } else {
+      hdr->flags |= MCS9835_RING_NEED_WAKEUP;
+      smp_mb();
+      wait_event_interruptible(ring->wq,
+			       ring_pending(ring) || kthread_should_stop());
+      hdr->flags &= ~MCS9835_RING_NEED_WAKEUP;
+      idle_start = ktime_get();
+    }
+
+    cond_resched();
+  }
+
+  return 0;
+}
@@ -0,0 +1,35 @@
+/***********************************************************************
+*                                                                      *
+* Copyright (C) 2017 Bonden i Nol (hakanbrolin@hotmail.com)            *
+*                                                                      *
+* This program is free software; you can redistribute it and/or modify *
+* it under the terms of the GNU General Public License as published by *
+* the Free Software Foundation; either version 2 of the License, or    *
+* (at your option) any later version.                                  *
+*                                                                      *
+************************************************************************/
+
+#ifndef __MCS9835_RING_H__
+#define __MCS9835_RING_H__
+
+#include <linux/fs.h>
+#include <linux/mm.h>
+
+#include "mcs9835.h"
+
+/****************************************************************************
+ * 
+ * Exported functions
+ *
+ ****************************************************************************/
+
+extern void mcs9835_ring_release(struct mcs9835_parport_file *pfile);
+
+extern long mcs9835_ring_ioctl(struct mcs9835_parport_file *pfile,
+			       unsigned int cmd,
+			       unsigned long arg);
+
+extern int mcs9835_ring_mmap(struct mcs9835_parport_file *pfile,
+			     struct vm_area_struct *vma);
+
+#endif /* __MCS9835_RING_H__ */
@@ -0,0 +1,293 @@
+/***********************************************************************
+*                                                                      *
+* Copyright (C) 2017 Bonden i Nol (hakanbrolin@hotmail.com)            *
+*                                                                      *
+* This program is free software; you can redistribute it and/or modify *
+* it under the terms of the GNU General Public License as published by *
+* the Free Software Foundation; either version 2 of the License, or    *
+* (at your option) any later version.                                  *
+*                                                                      *
+************************************************************************/
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/vmalloc.h>
+#include <linux/version.h>
+#include <asm/uaccess.h>
+
+#include "mcs9835_sample.h"
+#include "mcs9835_log.h"
+#include "mcs9835_hw.h"
+
+/****************************************************************************
+ *
+ * Macros
+ *
+ ****************************************************************************/
+
+/* Ring header area, samples start on the next page */
+#define MCS9835_SAMPLE_HDR_SIZE \
+  PAGE_ALIGN(sizeof(struct mcs9835_sample_ring))
+
+#define MCS9835_SAMPLE_MAP_SIZE \
+  (MCS9835_SAMPLE_HDR_SIZE + MCS9835_SAMPLE_RING_SIZE)
+
+/****************************************************************************
+ *
+ * Function prototypes
+ *
+ ****************************************************************************/
+
+static enum hrtimer_restart sample_timer(struct hrtimer *timer);
+
+static int sample_alloc_ring(struct mcs9835_dev *dev);
+
+static long sample_start(struct mcs9835_dev *dev,
+			 struct mcs9835_sample_start __user *arg);
+
+/****************************************************************************
+ *
+ * Exported functions
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+void mcs9835_sample_initialize(struct mcs9835_dev *dev)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+  hrtimer_setup(&dev->sample_timer, sample_timer, 
+		CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+#else
+  hrtimer_init(&dev->sample_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+  dev->sample_timer.function = sample_timer;
+#endif
+
+  mutex_init(&dev->sample_mutex);
+  dev->sample_ring      = NULL; /* Allocated when first used */
+  dev->sample_data      = NULL;
+  dev->sample_period_ns = 0;
+  dev->sample_running   = 0;
+}
+
+/****************************************************************************/
+
+/*
+ * Release sampling resources.
+ * Called when the last reference to the device is gone,
+ * no mappings of the ring remain.
+ */
+void mcs9835_sample_finalize(struct mcs9835_dev *dev)
+{
+  vfree(dev->sample_ring);
+  dev->sample_ring = NULL;
+  dev->sample_data = NULL;
+}
+
+/****************************************************************************/
+
+/*
+ * Stop sampling.
+ * Returns with the timer stopped, the ring keeps its samples.
+ */
+void mcs9835_sample_stop(struct mcs9835_dev *dev)
+{
+  mutex_lock(&dev->sample_mutex);
+
+  hrtimer_cancel(&dev->sample_timer);
+  dev->sample_running = 0;
+  if (dev->sample_ring != NULL) {
+    dev->sample_ring->running = 0;
+  }
+
+  mutex_unlock(&dev->sample_mutex);
+}
+
+/****************************************************************************/
+
+long mcs9835_sample_ioctl(struct mcs9835_dev *dev,
+			  unsigned int cmd,
+			  unsigned long arg)
+{
+  switch (cmd) {
+  case MCS9835_IOC_SAMPLE_START:
+    return sample_start(dev, (void __user *)arg);
+  case MCS9835_IOC_SAMPLE_STOP:
+    mcs9835_sample_stop(dev);
+    return 0;
+  default:
+    return -ENOTTY;
+  }
+}
+
+/****************************************************************************/
+
+/*
+ * Map the sample ring read-only, header first.
+ */
+int mcs9835_sample_mmap(struct mcs9835_dev *dev,
+			struct vm_area_struct *vma)
+{
+  unsigned long size = vma->vm_end - vma->vm_start;
+  int rc;
+
+  if ( (vma->vm_pgoff != 0) ||
+       (size > MCS9835_SAMPLE_MAP_SIZE) ) {
+    return -EINVAL;
+  }
+  if (vma->vm_flags & VM_WRITE) {
+    return -EPERM;
+  }
+  /* Nor made writable later by mprotect */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+  vm_flags_clear(vma, VM_MAYWRITE);
+#else
+  vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+  mutex_lock(&dev->sample_mutex);
+  rc = sample_alloc_ring(dev);
+  mutex_unlock(&dev->sample_mutex);
+  if (rc) {
+    return rc;
+  }
+
+  LOG(MCS_VMA, "map sample ring, %lu bytes\n", size);
+
+  return remap_vmalloc_range(vma, dev->sample_ring, 0);
+}
+
+/****************************************************************************
+ *
+ * Timer handling
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+/*
+ * Sample the status register into the ring.
+ * Only writer of the ring, readers poll head from user space.
+ */
+static enum hrtimer_restart sample_timer(struct hrtimer *timer)
+{
+  struct mcs9835_dev *dev = container_of(timer, 
+					 struct mcs9835_dev, 
+					 sample_timer);
+  struct mcs9835_sample_ring *ring = dev->sample_ring;
+  u32 head = ring->head;
+  u64 periods;
+  u8 dsr;
+
+  /* Records a nAck interrupt the read takes from the handler */
+  dsr = mcs9835_parport_read_dsr(dev);
+
+  /* Periods since last sample, more than one if the timer was late */
+  periods = hrtimer_forward_now(timer, ns_to_ktime(dev->sample_period_ns));
+  if (periods > 1) {
+    ring->missed += periods - 1;
+  }
+  if (periods > MCS9835_SAMPLE_RING_SIZE) {
+    periods = MCS9835_SAMPLE_RING_SIZE;
+  }
+
+  /* Hold the sample over missed periods, keeps the time base */
+  while (periods--) {
+    dev->sample_data[head & (MCS9835_SAMPLE_RING_SIZE - 1)] = dsr;
+    head++;
+  }
+
+  /* Publish samples after they are written */
+  smp_wmb();
+  ring->head = head;
+
+  return HRTIMER_RESTART;
+}
+
+/****************************************************************************
+ *
+ * Support functions
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+/*
+ * Allocate sample ring on first use, called with sample mutex held.
+ * The ring is kept until the device data is released.
+ */
+static int sample_alloc_ring(struct mcs9835_dev *dev)
+{
+  if (dev->sample_ring != NULL) {
+    return 0;
+  }
+
+  dev->sample_ring = vmalloc_user(MCS9835_SAMPLE_MAP_SIZE);
+  if (dev->sample_ring == NULL) {
+    LOG(MCS_ERR, "allocate sample ring failed\n");
+    return -ENOMEM;
+  }
+  dev->sample_data = (u8 *)dev->sample_ring + MCS9835_SAMPLE_HDR_SIZE;
+
+  dev->sample_ring->size        = MCS9835_SAMPLE_RING_SIZE;
+  dev->sample_ring->data_offset = MCS9835_SAMPLE_HDR_SIZE;
+
+  return 0;
+}
+
+/****************************************************************************/
+
+static long sample_start(struct mcs9835_dev *dev,
+			 struct mcs9835_sample_start __user *arg)
+{
+  struct mcs9835_sample_start start;
+  struct mcs9835_sample_ring *ring;
+  ktime_t first;
+  int rc;
+
+  if (copy_from_user(&start, arg, sizeof(start))) {
+    return -EFAULT;
+  }
+
+  /* Check user input */
+  if (start.period_ns < MCS9835_SAMPLE_MIN_PERIOD_NS) {
+    return -EINVAL;
+  }
+
+  if (mutex_lock_interruptible(&dev->sample_mutex)) {
+    return -ERESTARTSYS;
+  }
+
+  if (!dev->init_done) {
+    rc = -ENODEV;
+    goto start_out;
+  }
+
+  rc = sample_alloc_ring(dev);
+  if (rc) {
+    goto start_out;
+  }
+
+  /* Restart ring at sample 0 */
+  hrtimer_cancel(&dev->sample_timer);
+  first = ktime_add_ns(ktime_get(), start.period_ns);
+
+  ring = dev->sample_ring;
+  ring->head      = 0;
+  ring->missed    = 0;
+  ring->period_ns = start.period_ns;
+  ring->start_ns  = ktime_to_ns(first);
+  ring->running   = 1;
+
+  dev->sample_period_ns = start.period_ns;
+  dev->sample_running   = 1;
+  hrtimer_start(&dev->sample_timer, first, HRTIMER_MODE_ABS);
+
+  LOG(MCS_CDV, "sampling started, period %u ns\n", start.period_ns);
+
+ start_out:
+  mutex_unlock(&dev->sample_mutex);
+
+  return rc;
+}
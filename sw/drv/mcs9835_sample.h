@@ -0,0 +1,39 @@
+/***********************************************************************
+*                                                                      *
+* Copyright (C) 2017 Bonden i Nol (hakanbrolin@hotmail.com)            *
+*                                                                      *
+* This program is free software; you can redistribute it and/or modify *
+* it under the terms of the GNU General Public License as published by *
+* the Free Software Foundation; either version 2 of the License, or    *
+* (at your option) any later version.                                  *
+*                                                                      *
+************************************************************************/
+
+#ifndef __MCS9835_SAMPLE_H__
+#define __MCS9835_SAMPLE_H__
+
+#include <linux/fs.h>
+#include <linux/mm.h>
+
+#include "mcs9835.h"
+
+/****************************************************************************
+ * 
+ * Exported functions
+ *
+ ****************************************************************************/
+
+extern void mcs9835_sample_initialize(struct mcs9835_dev *dev);
+
+extern void mcs9835_sample_finalize(struct mcs9835_dev *dev);
+
+extern void mcs9835_sample_stop(struct mcs9835_dev *dev);
+
+extern long mcs9835_sample_ioctl(struct mcs9835_dev *dev,
+				 unsigned int cmd,
+				 unsigned long arg);
+
+extern int mcs9835_sample_mmap(struct mcs9835_dev *dev,
+			       struct vm_area_struct *vma);
+
+#endif /* __MCS9835_SAMPLE_H__ */
@@ -0,0 +1,248 @@
+/***********************************************************************
+*                                                                      *
+* Copyright (C) 2017 Bonden i Nol (hakanbrolin@hotmail.com)            *
+*                                                                      *
+* This program is free software; you can redistribute it and/or modify *
+* it under the terms of the GNU General Public License as published by *
+* the Free Software Foundation; either version 2 of the License, or    *
+* (at your option) any later version.                                  *
+*                                                                      *
+************************************************************************/
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/err.h>
+
+#include "mcs9835_stats.h"
+#include "mcs9835_log.h"
+
+/****************************************************************************
+ *
+ * Function prototypes
+ *
+ ****************************************************************************/
+
+static int mcs9835_open_stats(struct inode *inode,
+			      struct file *file);
+
+static int mcs9835_show_stats(struct seq_file *m,
+			      void *v);
+
+static void stats_sum(struct mcs9835_stats __percpu *stats,
+		      struct mcs9835_stats *sum);
+
+static void stats_show_hist(struct seq_file *m,
+			    const char *name,
+			    const u64 *hist);
+
+/****************************************************************************
+ *
+ * Debugfs infrastructure
+ *
+ ****************************************************************************/
+
+static const struct file_operations mcs9835_fops_stats = {
+  .owner   = THIS_MODULE,
+  .open    = mcs9835_open_stats,
+  .read    = seq_read,
+  .llseek  = seq_lseek,
+  .release = single_release,
+};
+
+static const char *mcs9835_cdev_names[MCS9835_MAX_CDEVS] = {
+  [MCS9835_CDEV_IDX_UART_A]      = "uart_a",
+  [MCS9835_CDEV_IDX_UART_B]      = "uart_b",
+  [MCS9835_CDEV_IDX_PARPORT]     = "parport",
+  [MCS9835_CDEV_IDX_PARPORT_EVT] = "parport_events",
+};
+
+/****************************************************************************
+ * 
+ * Exported functions
+ *
+ ****************************************************************************/
+
+/*
+ * Allocate per CPU statistics for device and its character devices.
+ * Debugfs is optional, device works without it.
+ */
+int mcs9835_stats_dev_initialize(struct mcs9835_dev *dev,
+				 struct dentry *debugfs_root)
+{
+  char name[16];
+  struct dentry *file;
+  int i;
+
+  dev->reg_stats = alloc_percpu(struct mcs9835_stats);
+  if (!dev->reg_stats) {
+    return -ENOMEM;
+  }
+  for (i=0; i < MCS9835_MAX_CDEVS; i++) {
+    dev->chr[i].stats = alloc_percpu(struct mcs9835_stats);
+    if (!dev->chr[i].stats) {
+      return -ENOMEM; /* Freed by mcs9835_stats_dev_finalize */
+    }
+  }
+
+  if (!debugfs_root) {
+    return 0;
+  }
+
+  snprintf(name, sizeof(name), "%d", dev->dev_idx);
+  dev->debugfs_dir = debugfs_create_dir(name, debugfs_root);
+  if (!dev->debugfs_dir || IS_ERR(dev->debugfs_dir)) {
+    LOG(MCS_WRN, "create debugfs directory %s failed\n", name);
+    dev->debugfs_dir = NULL;
+    return 0;
+  }
+  file = debugfs_create_file("stats", 0444, dev->debugfs_dir,
+			     dev, &mcs9835_fops_stats);
+  if (!file || IS_ERR(file)) {
+    LOG(MCS_WRN, "create debugfs statistics file failed\n");
+  }
+
+  return 0;
+}
+
+/****************************************************************************/
+
+/*
+ * Remove debugfs entries, called when device is removed.
+ */
+void mcs9835_stats_dev_remove(struct mcs9835_dev *dev)
+{
+  debugfs_remove_recursive(dev->debugfs_dir);
+  dev->debugfs_dir = NULL;
+}
+
+/****************************************************************************/
+
+/*
+ * Free per CPU statistics, called when last reference is dropped.
+ */
+void mcs9835_stats_dev_finalize(struct mcs9835_dev *dev)
+{
+  int i;
+
+  for (i=0; i < MCS9835_MAX_CDEVS; i++) {
+    free_percpu(dev->chr[i].stats);
+    dev->chr[i].stats = NULL;
+  }
+  free_percpu(dev->reg_stats);
+  dev->reg_stats = NULL;
+}
+
+/****************************************************************************
+ *
+ * File operation functions
+ *
+ ****************************************************************************/
+
+static int mcs9835_open_stats(struct inode *inode,
+			      struct file *file)
+{
+  return single_open(file, mcs9835_show_stats, inode->i_private);
+}
+
+/****************************************************************************/
+
+static int mcs9835_show_stats(struct seq_file *m,
+			      void *v)
+{
+  struct mcs9835_dev *dev = m->private;
+  struct mcs9835_stats *sum;
+  int i;
+
+  sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+  if (!sum) {
+    return -ENOMEM;
+  }
+
+  for (i=0; i < MCS9835_MAX_CDEVS; i++) {
+    stats_sum(dev->chr[i].stats, sum);
+
+    seq_printf(m, "%s:\n", mcs9835_cdev_names[i]);
+    seq_printf(m, "  read_calls    %llu\n", sum->read_calls);
+    seq_printf(m, "  read_bytes    %llu\n", sum->read_bytes);
+    seq_printf(m, "  write_calls   %llu\n", sum->write_calls);
+    seq_printf(m, "  write_bytes   %llu\n", sum->write_bytes);
+    seq_printf(m, "  efault        %llu\n", sum->efault);
+    seq_printf(m, "  einval        %llu\n", sum->einval);
+    seq_printf(m, "  other_errors  %llu\n", sum->other_errors);
+    stats_show_hist(m, "read", sum->hist[MCS9835_HIST_READ]);
+    stats_show_hist(m, "write", sum->hist[MCS9835_HIST_WRITE]);
+  }
+
+  stats_sum(dev->reg_stats, sum);
+  seq_printf(m, "registers:\n");
+  stats_show_hist(m, "read", sum->hist[MCS9835_HIST_REG_READ]);
+  stats_show_hist(m, "write", sum->hist[MCS9835_HIST_REG_WRITE]);
+
+  kfree(sum);
+
+  return 0;
+}
+
+/****************************************************************************
+ *
+ * Support functions
+ *
+ ****************************************************************************/
+
+/*
+ * Sum counters of all CPUs. Updates on other CPUs may race with
+ * the summing, each counter is still consistent by itself.
+ */
+static void stats_sum(struct mcs9835_stats __percpu *stats,
+		      struct mcs9835_stats *sum)
+{
+  struct mcs9835_stats *s;
+  int cpu;
+  int h;
+  int b;
+
+  memset(sum, 0, sizeof(*sum));
+
+  for_each_possible_cpu(cpu) {
+    s = per_cpu_ptr(stats, cpu);
+    sum->read_calls   += s->read_calls;
+    sum->read_bytes   += s->read_bytes;
+    sum->write_calls  += s->write_calls;
+    sum->write_bytes  += s->write_bytes;
+    sum->efault       += s->efault;
+    sum->einval       += s->einval;
+    sum->other_errors += s->other_errors;
+    for (h=0; h < MCS9835_NUM_HISTS; h++) {
+      for (b=0; b < MCS9835_HIST_BUCKETS; b++) {
+	sum->hist[h][b] += s->hist[h][b];
+      }
+    }
+  }
+}
+
+/****************************************************************************/
+
+/*
+ * Show non-empty histogram buckets as [low, high) nanoseconds.
+ */
+static void stats_show_hist(struct seq_file *m,
+			    const char *name,
+			    const u64 *hist)
+{
+  int b;
+
+  seq_printf(m, "  %s latency (ns):\n", name);
+  for (b=0; b < MCS9835_HIST_BUCKETS; b++) {
+    if (!hist[b]) {
+      continue;
+    }
+    seq_printf(m, "    [%10llu, %10llu) %llu\n",
+	       (b ? 1ULL << (b - 1) : 0ULL),
+	       1ULL << b,
+	       hist[b]);
+  }
+}
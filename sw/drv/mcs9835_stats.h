@@ -0,0 +1,139 @@
+/***********************************************************************
+*                                                                      *
+* Copyright (C) 2017 Bonden i Nol (hakanbrolin@hotmail.com)            *
+*                                                                      *
+* This program is free software; you can redistribute it and/or modify *
+* it under the terms of the GNU General Public License as published by *
+* the Free Software Foundation; either version 2 of the License, or    *
+* (at your option) any later version.                                  *
+*                                                                      *
+************************************************************************/
+
+#ifndef __MCS9835_STATS_H__
+#define __MCS9835_STATS_H__
+
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/bitops.h>
+#include <linux/errno.h>
+#include <linux/debugfs.h>
+
+#include "mcs9835.h"
+
+/****************************************************************************
+ *
+ * Macros
+ *
+ ****************************************************************************/
+
+/* Histogram buckets, bucket n counts [2^(n-1), 2^n) nanoseconds */
+#define MCS9835_HIST_BUCKETS  32
+
+/* Histograms */
+#define MCS9835_HIST_READ       0 /* read() call        */
+#define MCS9835_HIST_WRITE      1 /* write() call       */
+#define MCS9835_HIST_REG_READ   2 /* Register read      */
+#define MCS9835_HIST_REG_WRITE  3 /* Register write     */
+#define MCS9835_NUM_HISTS       4
+
+/****************************************************************************
+ *
+ * Types
+ *
+ ****************************************************************************/
+
+/* 
+ * Statistics, one instance per CPU.
+ * Kept per character device, and per device for register access.
+ */
+struct mcs9835_stats {
+  u64 read_calls;
+  u64 read_bytes;
+  u64 write_calls;
+  u64 write_bytes;
+  u64 efault;
+  u64 einval;
+  u64 other_errors;
+  u64 hist[MCS9835_NUM_HISTS][MCS9835_HIST_BUCKETS];
+};
+
+/****************************************************************************
+ * 
+ * Exported functions
+ *
+ ****************************************************************************/
+
+extern int mcs9835_stats_dev_initialize(struct mcs9835_dev *dev,
+					struct dentry *debugfs_root);
+
+extern void mcs9835_stats_dev_remove(struct mcs9835_dev *dev);
+
+extern void mcs9835_stats_dev_finalize(struct mcs9835_dev *dev);
+
+/****************************************************************************
+ * 
+ * Inline functions, used in I/O paths
+ *
+ ****************************************************************************/
+
+static inline s64 mcs9835_stats_start(void)
+{
+  return ktime_to_ns(ktime_get());
+}
+
+/****************************************************************************/
+
+static inline void mcs9835_stats_hist(struct mcs9835_stats __percpu *stats,
+				      int hist,
+				      s64 start_ns)
+{
+  s64 delta = ktime_to_ns(ktime_get()) - start_ns;
+  int bucket = (delta > 0 ? fls64(delta) : 0);
+
+  if (bucket >= MCS9835_HIST_BUCKETS) {
+    bucket = MCS9835_HIST_BUCKETS - 1;
+  }
+  this_cpu_inc(stats->hist[hist][bucket]);
+}
+
+/****************************************************************************/
+
+/*
+ * Account a failed call.
+ */
+static inline void mcs9835_stats_error(struct mcs9835_stats __percpu *stats,
+				       long rc)
+{
+  if (rc == -EFAULT) {
+    this_cpu_inc(stats->efault);
+  } else if (rc == -EINVAL) {
+    this_cpu_inc(stats->einval);
+  } else {
+    this_cpu_inc(stats->other_errors);
+  }
+}
+
+/****************************************************************************/
+
+/*
+ * Account one read() or write() call with its result.
+ */
+static inline void mcs9835_stats_io(struct mcs9835_stats __percpu *stats,
+				    int hist,
+				    ssize_t rc,
+				    s64 start_ns)
+{
+  if (rc < 0) {
+    mcs9835_stats_error(stats, rc);
+  } else if (hist == MCS9835_HIST_WRITE) {
+    this_cpu_inc(stats->write_calls);
+    this_cpu_add(stats->write_bytes, rc);
+  } else {
+    this_cpu_inc(stats->read_calls);
+    this_cpu_add(stats->read_bytes, rc);
+  }
+
+  mcs9835_stats_hist(stats, hist, start_ns);
+}
+
+#endif /* __MCS9835_STATS_H__ */
@@ -0,0 +1,145 @@
+/***********************************************************************
+*                                                                      *
+* Copyright (C) 2017 Bonden i Nol (hakanbrolin@hotmail.com)            *
+*                                                                      *
+* This program is free software; you can redistribute it and/or modify *
+* it under the terms of the GNU General Public License as published by *
+* the Free Software Foundation; either version 2 of the License, or    *
+* (at your option) any later version.                                  *
+*                                                                      *
+************************************************************************/
+
+/*
+ * Tracepoints for register access and interrupt handling.
+ * A disabled tracepoint is a patched out branch, enabled ones record
+ * binary data into the per CPU ftrace ring buffer without blocking.
+ *
+ * Enable at runtime with:
+ *   echo 1 > /sys/kernel/debug/tracing/events/mcs9835/enable
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM mcs9835
+
+#if !defined(__MCS9835_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __MCS9835_TRACE_H__
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(mcs9835_reg,
+
+  TP_PROTO(int dev_idx, unsigned bar, unsigned offset, u8 value),
+
+  TP_ARGS(dev_idx, bar, offset, value),
+
+  TP_STRUCT__entry(
+    __field(int, dev_idx)
+    __field(u8,  bar)
+    __field(u8,  offset)
+    __field(u8,  value)
+  ),
+
+  TP_fast_assign(
+    __entry->dev_idx = dev_idx;
+    __entry->bar     = bar;
+    __entry->offset  = offset;
+    __entry->value   = value;
+  ),
+
+  TP_printk("dev=%d BAR%u[%u] 0x%02x",
+	    __entry->dev_idx, __entry->bar, __entry->offset, __entry->value)
+);
+
+DEFINE_EVENT(mcs9835_reg, mcs9835_reg_write,
+  TP_PROTO(int dev_idx, unsigned bar, unsigned offset, u8 value),
+  TP_ARGS(dev_idx, bar, offset, value)
+);
+
+DEFINE_EVENT(mcs9835_reg, mcs9835_reg_read,
+  TP_PROTO(int dev_idx, unsigned bar, unsigned offset, u8 value),
+  TP_ARGS(dev_idx, bar, offset, value)
+);
+
+DECLARE_EVENT_CLASS(mcs9835_reg_rep,
+
+  TP_PROTO(int dev_idx, unsigned bar, unsigned offset, size_t count),
+
+  TP_ARGS(dev_idx, bar, offset, count),
+
+  TP_STRUCT__entry(
+    __field(int,    dev_idx)
+    __field(u8,     bar)
+    __field(u8,     offset)
+    __field(size_t, count)
+  ),
+
+  TP_fast_assign(
+    __entry->dev_idx = dev_idx;
+    __entry->bar     = bar;
+    __entry->offset  = offset;
+    __entry->count   = count;
+  ),
+
+  TP_printk("dev=%d BAR%u[%u] %zu bytes",
+	    __entry->dev_idx, __entry->bar, __entry->offset, __entry->count)
+);
+
+DEFINE_EVENT(mcs9835_reg_rep, mcs9835_reg_write_rep,
+  TP_PROTO(int dev_idx, unsigned bar, unsigned offset, size_t count),
+  TP_ARGS(dev_idx, bar, offset, count)
+);
+
+DEFINE_EVENT(mcs9835_reg_rep, mcs9835_reg_read_rep,
+  TP_PROTO(int dev_idx, unsigned bar, unsigned offset, size_t count),
+  TP_ARGS(dev_idx, bar, offset, count)
+);
+
+TRACE_EVENT(mcs9835_uart_irq,
+
+  TP_PROTO(int dev_idx, int uart_idx, u8 iir),
+
+  TP_ARGS(dev_idx, uart_idx, iir),
+
+  TP_STRUCT__entry(
+    __field(int, dev_idx)
+    __field(int, uart_idx)
+    __field(u8,  iir)
+  ),
+
+  TP_fast_assign(
+    __entry->dev_idx  = dev_idx;
+    __entry->uart_idx = uart_idx;
+    __entry->iir      = iir;
+  ),
+
+  TP_printk("dev=%d UART-%c IIR 0x%02x",
+	    __entry->dev_idx, 'A' + __entry->uart_idx, __entry->iir)
+);
+
+TRACE_EVENT(mcs9835_parport_event,
+
+  TP_PROTO(int dev_idx, u8 dsr),
+
+  TP_ARGS(dev_idx, dsr),
+
+  TP_STRUCT__entry(
+    __field(int, dev_idx)
+    __field(u8,  dsr)
+  ),
+
+  TP_fast_assign(
+    __entry->dev_idx = dev_idx;
+    __entry->dsr     = dsr;
+  ),
+
+  TP_printk("dev=%d status 0x%02x", __entry->dev_idx, __entry->dsr)
+);
+
+#endif /* __MCS9835_TRACE_H__ */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE mcs9835_trace
+#include <trace/define_trace.h>
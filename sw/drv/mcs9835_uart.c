@@ -0,0 +1,1851 @@
+/***********************************************************************
+*                                                                      *
+* Copyright (C) 2017 Bonden i Nol (hakanbrolin@hotmail.com)            *
+*                                                                      *
+* This program is free software; you can redistribute it and/or modify *
+* it under the terms of the GNU General Public License as published by *
+* the Free Software Foundation; either version 2 of the License, or    *
+* (at your option) any later version.                                  *
+*                                                                      *
+************************************************************************/
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/bitops.h>
+#include <linux/poll.h>
+#include <linux/hrtimer.h>
+#include <asm/uaccess.h>
+
+#include "mcs9835_uart.h"
+#include "mcs9835_log.h"
+#include "mcs9835_hw.h"
+#include "mcs9835_stats.h"
+#include "mcs9835_trace.h"
+#include "mcs9835_hybrid.h"
+
+/****************************************************************************
+ *
+ * Macros
+ *
+ ****************************************************************************/
+
+/* Max time to wait for transmit ring to drain at close */
+#define MCS9835_UART_CLOSE_WAIT  (2 * HZ)
+
+/* Max interrupt causes handled per interrupt */
+#define MCS9835_UART_ISR_PASSES  16
+
+/* Bits of a character on the line, 8N1 */
+#define MCS9835_UART_CHAR_BITS  10
+
+/* Modbus RTU fixed t3.5 gap above 19200 baud */
+#define MCS9835_UART_MODBUS_BAUD_MAX  19200
+#define MCS9835_UART_MODBUS_T35_US    1750
+
+/****************************************************************************
+ *
+ * Function prototypes
+ *
+ ****************************************************************************/
+static int mcs9835_open_uart(struct inode *inode,
+			     struct file  *file);
+static int mcs9835_close_uart(struct inode *inode,
+			      struct file  *file);
+static ssize_t mcs9835_read_uart(struct file *file,
+				 struct mcs9835_ubuf *ub,
+				 loff_t pos);
+static ssize_t mcs9835_write_uart(struct file *file,
+				  struct mcs9835_ubuf *ub,
+				  loff_t pos);
+static unsigned int mcs9835_poll_uart(struct file *file,
+				      poll_table *wait);
+static long mcs9835_ioctl_uart(struct file *file,
+			       unsigned int cmd,
+			       unsigned long arg);
+
+static long ioctl_set_tuning(struct mcs9835_uart *uart,
+			     void __user *arg);
+
+static void ioctl_get_tuning(struct mcs9835_uart *uart,
+			     struct mcs9835_uart_tuning *tuning);
+
+static long ioctl_set_bridge(struct mcs9835_uart *uart,
+			     void __user *arg);
+
+static void ioctl_get_bridge(struct mcs9835_uart *uart,
+			     struct mcs9835_uart_bridge *bridge);
+
+static long ioctl_set_framing(struct mcs9835_uart *uart,
+			      void __user *arg);
+
+static void ioctl_get_framing(struct mcs9835_uart *uart,
+			      struct mcs9835_uart_framing *framing);
+
+static long ioctl_set_rs485(struct mcs9835_uart *uart,
+			    void __user *arg);
+
+static void ioctl_get_rs485(struct mcs9835_uart *uart,
+			    struct mcs9835_uart_rs485 *rs485);
+
+static long uart_set_framing(struct mcs9835_uart *uart,
+			     const struct mcs9835_uart_framing *framing);
+
+static unsigned uart_rs485_t35_us(struct mcs9835_uart *uart);
+
+static void uart_rs485_direction(struct mcs9835_uart *uart,
+				 int tx);
+
+static enum hrtimer_restart uart_rs485_timer(struct hrtimer *timer);
+
+static ssize_t uart_read_frame(struct mcs9835_uart *uart,
+			       struct mcs9835_ubuf *ub,
+			       size_t count,
+			       u8 *buf,
+			       size_t size);
+
+static enum hrtimer_restart uart_rx_idle_timer(struct hrtimer *timer);
+
+static int uart_rx_ready(struct mcs9835_uart *uart);
+
+static void uart_startup(struct mcs9835_uart *uart);
+
+static void uart_shutdown(struct mcs9835_uart *uart);
+
+static void uart_start_tx(struct mcs9835_uart *uart);
+
+static unsigned uart_rx_chars(struct mcs9835_uart *uart,
+			      u8 iir,
+			      u8 lsr);
+
+static unsigned uart_rx_frame(struct mcs9835_uart *uart,
+			      const u8 *buf,
+			      unsigned n);
+
+static void uart_rx_frame_end(struct mcs9835_uart *uart);
+
+static int uart_rx_poll(struct mcs9835_hybrid *hy);
+
+static void uart_rx_unmask(struct mcs9835_hybrid *hy);
+
+static void uart_bridge_forward(struct mcs9835_uart *uart,
+				const u8 *buf,
+				unsigned n);
+
+static void uart_bridge_kick(struct mcs9835_uart *uart,
+			     int kick);
+
+static void uart_write_ier(struct mcs9835_uart *uart);
+
+static void uart_tx_chars(struct mcs9835_uart *uart);
+
+static void uart_write_reg(struct mcs9835_uart *uart,
+			   unsigned offset,
+			   u8 value);
+
+static u8 uart_read_reg(struct mcs9835_uart *uart,
+			unsigned offset);
+
+/****************************************************************************
+ *
+ * Char driver infrastructure
+ *
+ ****************************************************************************/
+MCS9835_DEFINE_READ_FOP(mcs9835_fop_read_uart, mcs9835_read_uart)
+MCS9835_DEFINE_WRITE_FOP(mcs9835_fop_write_uart, mcs9835_write_uart)
+
+struct file_operations mcs9835_fops_uart = {
+  .owner   = THIS_MODULE,
+  .open    = mcs9835_open_uart,
+  .release = mcs9835_close_uart,
+#ifdef MCS9835_HAVE_ITER
+  .read_iter  = mcs9835_fop_read_uart,
+  .write_iter = mcs9835_fop_write_uart,
+  .splice_write = iter_file_splice_write, /* splice() and sendfile() */
+#else
+  .read    = mcs9835_fop_read_uart,
+  .write   = mcs9835_fop_write_uart,
+#endif
+  .poll    = mcs9835_poll_uart,
+  .unlocked_ioctl = mcs9835_ioctl_uart,
+  .compat_ioctl   = mcs9835_ioctl_uart,
+};
+
+/****************************************************************************
+ *
+ * Exported functions
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+int mcs9835_uart_initialize(struct mcs9835_dev *dev,
+			    int uart_idx,
+			    int cdev_idx,
+			    void __iomem *base,
+			    unsigned baudrate)
+{
+  int rc;
+
+  struct mcs9835_uart *uart = &dev->uart[uart_idx];
+
+  uart->dev      = dev;
+  uart->base     = base;
+  uart->idx      = uart_idx;
+  uart->cdev_idx = cdev_idx;
+  uart->baudrate = baudrate;
+  uart->in_use   = 0;
+
+  spin_lock_init(&uart->lock);
+  uart->ier = 0;
+  uart->ier_masked = 0;
+  uart->fcr = MCS9835_UART_FCR_ENABLE | MCS9835_UART_FCR_TRIGGER_14;
+  uart->mcr = 0;
+
+  /* Wake readers on any data, until tuned */
+  uart->rx_wake     = 1;
+  uart->rx_idle_ns  = 0;
+  uart->low_latency = 0;
+  uart->rx_idle     = 0;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+  hrtimer_setup(&uart->rx_idle_timer, uart_rx_idle_timer,
+		CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+#else
+  hrtimer_init(&uart->rx_idle_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  uart->rx_idle_timer.function = uart_rx_idle_timer;
+#endif
+
+  uart->bridge           = 0;
+  uart->bridge_mirror    = 0;
+  uart->bridge_kick      = 0;
+  uart->bridge_forwarded = 0;
+  uart->bridge_dropped   = 0;
+  spin_lock_init(&uart->tx_in_lock);
+
+  /* Byte stream, until framing is set */
+  uart->frame_mode    = MCS9835_UART_FRAME_NONE;
+  uart->frame_delim   = 0;
+  uart->frame_offset  = 0;
+  uart->frame_size    = 0;
+  uart->frame_be      = 0;
+  uart->frame_idle_ns = 0;
+  uart->frame_max     = MCS9835_UART_RX_BUF_SIZE;
+  uart->frame_len     = 0;
+  uart->frame_expect  = 0;
+  uart->frame_value   = 0;
+  uart->frames        = 0;
+  uart->frame_errors  = 0;
+
+  /* RTS as modem control, until RS-485 is set */
+  uart->rs485          = 0;
+  uart->rs485_txing    = 0;
+  uart->rs485_char_ns  = div_u64((u64)MCS9835_UART_CHAR_BITS * NSEC_PER_SEC,
+				 baudrate);
+  uart->rs485_delay_ns = 0;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+  hrtimer_setup(&uart->rs485_timer, uart_rs485_timer,
+		CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+#else
+  hrtimer_init(&uart->rs485_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  uart->rs485_timer.function = uart_rs485_timer;
+#endif
+
+  /* Polled at 8 character times under load, half the FIFO */
+  mcs9835_hybrid_initialize(&uart->rx_hybrid, dev,
+			    uart_rx_poll, uart_rx_unmask,
+			    div_u64(8ULL * MCS9835_UART_CHAR_BITS * NSEC_PER_SEC,
+				    baudrate),
+			    div_u64((u64)MCS9835_HYBRID_UART_WINDOW_CHARS *
+				    MCS9835_UART_CHAR_BITS * NSEC_PER_SEC,
+				    baudrate),
+			    MCS9835_HYBRID_UART_ENTER_BYTES);
+
+  init_waitqueue_head(&uart->rx_wq);
+  init_waitqueue_head(&uart->tx_wq);
+  mutex_init(&uart->read_mutex);
+  mutex_init(&uart->write_mutex);
+
+  uart->rx_overruns = 0;
+  uart->hw_overruns = 0;
+  uart->rx_errors   = 0;
+
+  /* Allocate ring buffers */
+  rc = kfifo_alloc(&uart->rx_fifo, MCS9835_UART_RX_BUF_SIZE, GFP_KERNEL);
+  if (rc) {
+    LOG(MCS_ERR, "allocate UART-%c receive ring failed\n", 'A' + uart_idx);
+    return rc;
+  }
+  /* A frame has at least one byte, as many lengths as bytes */
+  rc = kfifo_alloc(&uart->rx_frames, MCS9835_UART_RX_BUF_SIZE, GFP_KERNEL);
+  if (rc) {
+    LOG(MCS_ERR, "allocate UART-%c frame ring failed\n", 'A' + uart_idx);
+    kfifo_free(&uart->rx_fifo);
+    return rc;
+  }
+  rc = kfifo_alloc(&uart->tx_fifo, MCS9835_UART_TX_BUF_SIZE, GFP_KERNEL);
+  if (rc) {
+    LOG(MCS_ERR, "allocate UART-%c transmit ring failed\n", 'A' + uart_idx);
+    kfifo_free(&uart->rx_frames);
+    kfifo_free(&uart->rx_fifo);
+    return rc;
+  }
+
+  /* No interrupts until opened */
+  uart_write_reg(uart, MCS9835_UART_REG_IER, 0);
+
+  /* File operations find the UART from the cdev */
+  dev->chr[cdev_idx].private_data = uart;
+
+  return 0;
+}
+
+/****************************************************************************/
+
+/*
+ * Release UART resources.
+ * Called when the last reference to the device is gone.
+ */
+void mcs9835_uart_finalize(struct mcs9835_dev *dev,
+			   int uart_idx)
+{
+  struct mcs9835_uart *uart = &dev->uart[uart_idx];
+
+  kfifo_free(&uart->rx_fifo);
+  kfifo_free(&uart->rx_frames);
+  kfifo_free(&uart->tx_fifo);
+
+  dev->chr[uart->cdev_idx].private_data = NULL;
+}
+
+/****************************************************************************/
+
+/*
+ * Stop all hardware access, the device is being removed.
+ * Device must be marked as not initialized before this call.
+ * File operations still in progress fail with -ENODEV.
+ */
+void mcs9835_uart_remove(struct mcs9835_dev *dev,
+			 int uart_idx)
+{
+  struct mcs9835_uart *uart = &dev->uart[uart_idx];
+  unsigned long flags;
+
+  /* Release any blocked readers and writers */
+  wake_up_interruptible(&uart->rx_wq);
+  wake_up_interruptible(&uart->tx_wq);
+
+  /* Wait for writer in progress */
+  mutex_lock(&uart->write_mutex);
+
+  spin_lock_irqsave(&uart->lock, flags);
+  uart->ier = 0;
+  uart->mcr = 0;
+  uart->rs485_txing = 0;
+  uart_write_reg(uart, MCS9835_UART_REG_IER, 0);
+  uart_write_reg(uart, MCS9835_UART_REG_MCR, 0);
+  spin_unlock_irqrestore(&uart->lock, flags);
+
+  mutex_unlock(&uart->write_mutex);
+
+  mcs9835_hybrid_stop(&uart->rx_hybrid);
+  hrtimer_cancel(&uart->rx_idle_timer);
+  hrtimer_cancel(&uart->rs485_timer);
+}
+
+/****************************************************************************/
+
+/*
+ * UART part of the device interrupt handler.
+ * Returns non-zero if the UART had a pending interrupt.
+ */
+int mcs9835_uart_isr(struct mcs9835_uart *uart)
+{
+  int handled = 0;
+  unsigned rx = 0; /* Bytes received */
+  int kick;
+  int passes = 0;
+  u8 iir;
+  u8 lsr;
+
+  /* Not open, interrupts disabled */
+  if (!uart->ier) {
+    return 0;
+  }
+
+  spin_lock(&uart->lock);
+
+  iir = uart_read_reg(uart, MCS9835_UART_REG_IIR);
+  while ( !(iir & MCS9835_UART_IIR_NO_INT) &&
+	  (passes++ < MCS9835_UART_ISR_PASSES) ) {
+
+    handled = 1;
+    trace_mcs9835_uart_irq(uart->dev->dev_idx, uart->idx, iir);
+
+    lsr = uart_read_reg(uart, MCS9835_UART_REG_LSR);
+    if (lsr & (MCS9835_UART_LSR_DR | MCS9835_UART_LSR_BI)) {
+      rx += uart_rx_chars(uart, iir, lsr);
+    }
+    if ( (lsr & MCS9835_UART_LSR_THRE) &&
+	 (uart->ier & MCS9835_UART_IER_THRI) ) {
+      uart_tx_chars(uart);
+    }
+    if ((iir & MCS9835_UART_IIR_ID) == MCS9835_UART_IIR_MSI) {
+      /* Clear modem status interrupt */
+      uart_read_reg(uart, MCS9835_UART_REG_MSR);
+    }
+
+    iir = uart_read_reg(uart, MCS9835_UART_REG_IIR);
+  }
+
+  /*
+   * Receive interrupts off under sustained load, the timer polls.
+   * Not with idle gap framing, polls would time bytes in bursts
+   * and the gap timer would split frames between them.
+   */
+  if ( rx &&
+       !uart->rx_hybrid.polling &&
+       !uart->low_latency &&
+       (uart->frame_mode != MCS9835_UART_FRAME_IDLE) &&
+       mcs9835_hybrid_irq(&uart->rx_hybrid, rx) ) {
+    uart->ier_masked = MCS9835_UART_IER_RDI | MCS9835_UART_IER_RLSI;
+    uart_write_ier(uart);
+  }
+
+  kick = uart->bridge_kick;
+  uart->bridge_kick = 0;
+
+  spin_unlock(&uart->lock);
+
+  uart_bridge_kick(uart, kick);
+
+  return handled;
+}
+
+/****************************************************************************
+ *
+ * File operation functions
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+static int mcs9835_open_uart(struct inode *inode,
+			     struct file  *file)
+{
+  struct mcs9835_char *chr = NULL;
+  struct mcs9835_uart *uart = NULL;
+
+  /*
+   * Get UART private data
+   * and check that device is ok.
+   */
+  chr = container_of(inode->i_cdev, struct mcs9835_char, cdev);
+  uart = chr->private_data;
+  if (uart == NULL) {
+    return -ENODEV;
+  }
+
+  /* One user at a time */
+  if (test_and_set_bit(0, &uart->in_use)) {
+    return -EBUSY;
+  }
+
+  mutex_lock(&uart->write_mutex);
+  if (!uart->dev->init_done) {
+    mutex_unlock(&uart->write_mutex);
+    clear_bit(0, &uart->in_use);
+    return -ENODEV;
+  }
+  uart_startup(uart);
+  mutex_unlock(&uart->write_mutex);
+
+  /* Keep device data until closed */
+  mcs9835_dev_get(uart->dev);
+
+  /* Store UART data for other methods */
+  file->private_data = uart;
+
+  LOG(MCS_CDV, "open /dev/%s_%d_%d\n",
+      DRV_NAME, uart->dev->dev_idx, uart->cdev_idx);
+
+  return 0;
+}
+
+/****************************************************************************/
+
+static int mcs9835_close_uart(struct inode *inode,
+			      struct file  *file)
+{
+  struct mcs9835_uart *uart = NULL;
+
+  /* Get UART private data */
+  uart = file->private_data;
+  if (uart == NULL) {
+    return -ENODEV;
+  }
+
+  /* Let pending output go out on the line, and RS-485 turn around */
+  wait_event_interruptible_timeout(uart->tx_wq,
+				   (kfifo_is_empty(&uart->tx_fifo) &&
+				    !uart->rs485_txing) ||
+				   !uart->dev->init_done,
+				   MCS9835_UART_CLOSE_WAIT);
+
+  mutex_lock(&uart->write_mutex);
+  if (uart->dev->init_done) {
+    uart_shutdown(uart);
+  }
+  mutex_unlock(&uart->write_mutex);
+
+  /* Interrupts off, nothing restarts the timers */
+  mcs9835_hybrid_stop(&uart->rx_hybrid);
+  hrtimer_cancel(&uart->rx_idle_timer);
+  hrtimer_cancel(&uart->rs485_timer);
+
+  if (uart->rx_overruns || uart->hw_overruns || uart->rx_errors) {
+    LOG(MCS_WRN, "UART-%c overruns ring:%lu fifo:%lu, errors:%lu\n",
+	'A' + uart->idx,
+	uart->rx_overruns, uart->hw_overruns, uart->rx_errors);
+  }
+
+  clear_bit(0, &uart->in_use);
+
+  LOG(MCS_CDV, "close /dev/%s_%d_%d\n",
+      DRV_NAME, uart->dev->dev_idx, uart->cdev_idx);
+
+  mcs9835_dev_put(uart->dev);
+
+  return 0;
+}
+
+/****************************************************************************/
+
+/*
+ * Read transfer, for read() and asynchronous submission.
+ */
+static ssize_t mcs9835_read_uart(struct file *file,
+				 struct mcs9835_ubuf *ub,
+				 loff_t pos)
+{
+  u8 buf[MCS9835_UART_COPY_SIZE];
+  struct mcs9835_uart *uart = NULL;
+  size_t count = mcs9835_ubuf_count(ub);
+  size_t done = 0;
+  unsigned int n;
+  ssize_t rc = 0;
+  s64 start_ns = mcs9835_stats_start();
+
+  /* Get UART private data */
+  uart = file->private_data;
+  if (uart == NULL) {
+    return -ENODEV;
+  }
+
+  if (count == 0) {
+    return 0;
+  }
+
+  if (mutex_lock_interruptible(&uart->read_mutex)) {
+    return -ERESTARTSYS;
+  }
+
+  /* Wait for received data, as much as the wake-up tuning asks for */
+  while (!uart_rx_ready(uart)) {
+
+    /* Non-blocking takes what there is, framed only complete frames */
+    if ( (file->f_flags & O_NONBLOCK) &&
+	 (uart->frame_mode == MCS9835_UART_FRAME_NONE) &&
+	 !kfifo_is_empty(&uart->rx_fifo) ) {
+      break;
+    }
+
+    mutex_unlock(&uart->read_mutex);
+
+    if (!uart->dev->init_done) {
+      return -ENODEV;
+    }
+    if (file->f_flags & O_NONBLOCK) {
+      return -EAGAIN;
+    }
+    if (wait_event_interruptible(uart->rx_wq,
+				 uart_rx_ready(uart) ||
+				 !uart->dev->init_done)) {
+      return -ERESTARTSYS;
+    }
+
+    if (mutex_lock_interruptible(&uart->read_mutex)) {
+      return -ERESTARTSYS;
+    }
+  }
+
+  if (uart->frame_mode != MCS9835_UART_FRAME_NONE) {
+    /* One frame per read */
+    rc = uart_read_frame(uart, ub, count, buf, sizeof(buf));
+  } else {
+    /* Return all available data that fits */
+    while (done < count) {
+      n = kfifo_out_peek(&uart->rx_fifo, 
+			 buf, 
+			 min_t(size_t, count - done, sizeof(buf)));
+      if (n == 0) {
+	break;
+      }
+      rc = mcs9835_ubuf_to_user(ub, buf, n);
+      if (rc) {
+	break;
+      }
+
+      /* Remove data only when delivered */
+      kfifo_out(&uart->rx_fifo, buf, n);
+      done += n;
+    }
+  }
+
+  /* Data of an idle line delivered, wait for the threshold again */
+  uart->rx_idle = 0;
+
+  mutex_unlock(&uart->read_mutex);
+
+  rc = (done ? done : rc);
+  mcs9835_stats_io(uart->dev->chr[uart->cdev_idx].stats,
+		   MCS9835_HIST_READ, rc, start_ns);
+
+  return rc;
+}
+
+/****************************************************************************/
+
+/*
+ * Write transfer, for write() and asynchronous submission.
+ */
+static ssize_t mcs9835_write_uart(struct file *file,
+				  struct mcs9835_ubuf *ub,
+				  loff_t pos)
+{
+  u8 buf[MCS9835_UART_COPY_SIZE];
+  struct mcs9835_uart *uart = NULL;
+  size_t count = mcs9835_ubuf_count(ub);
+  unsigned int off = 0;
+  unsigned int len = 0; /* In buf, not yet in ring */
+  unsigned int n;
+  ssize_t rc = 0;
+  size_t done = 0;
+  s64 start_ns = mcs9835_stats_start();
+
+  /* Get UART private data */
+  uart = file->private_data;
+  if (uart == NULL) {
+    return -ENODEV;
+  }
+
+  if (count == 0) {
+    return 0;
+  }
+
+  if (mutex_lock_interruptible(&uart->write_mutex)) {
+    return -ERESTARTSYS;
+  }
+
+  while (done < count) {
+
+    if (!uart->dev->init_done) {
+      rc = -ENODEV;
+      break;
+    }
+
+    /* Wait for space in transmit ring */
+    if (kfifo_is_full(&uart->tx_fifo)) {
+      if (file->f_flags & O_NONBLOCK) {
+	rc = -EAGAIN;
+	break;
+      }
+      if (wait_event_interruptible(uart->tx_wq,
+				   !kfifo_is_full(&uart->tx_fifo) ||
+				   !uart->dev->init_done)) {
+	rc = -ERESTARTSYS;
+	break;
+      }
+      continue;
+    }
+
+    /* Get data from user, what the ring did not take is still in buf */
+    if (len == 0) {
+      n = min_t(size_t, count - done, sizeof(buf));
+      n = min(n, kfifo_avail(&uart->tx_fifo));
+      rc = mcs9835_ubuf_from_user(ub, buf, n);
+      if (rc) {
+	break;
+      }
+      off = 0;
+      len = n;
+    }
+
+    /* The bridge of the other UART may have taken space since */
+    n = kfifo_in_spinlocked(&uart->tx_fifo, buf + off, len,
+			    &uart->tx_in_lock);
+    off  += n;
+    len  -= n;
+    done += n;
+
+    /* Let the interrupt handler drain the ring */
+    uart_start_tx(uart);
+  }
+
+  mutex_unlock(&uart->write_mutex);
+
+  rc = (done ? done : rc);
+  mcs9835_stats_io(uart->dev->chr[uart->cdev_idx].stats,
+		   MCS9835_HIST_WRITE, rc, start_ns);
+
+  return rc;
+}
+
+/****************************************************************************/
+
+static unsigned int mcs9835_poll_uart(struct file *file,
+				      poll_table *wait)
+{
+  struct mcs9835_uart *uart = NULL;
+  unsigned int mask = 0;
+
+  /* Get UART private data */
+  uart = file->private_data;
+  if (uart == NULL) {
+    return POLLERR;
+  }
+
+  poll_wait(file, &uart->rx_wq, wait);
+  poll_wait(file, &uart->tx_wq, wait);
+
+  if (!uart->dev->init_done) {
+    return POLLERR | POLLHUP;
+  }
+
+  if (uart_rx_ready(uart)) {
+    mask |= POLLIN | POLLRDNORM;
+  }
+  if (!kfifo_is_full(&uart->tx_fifo)) {
+    mask |= POLLOUT | POLLWRNORM;
+  }
+
+  return mask;
+}
+
+/****************************************************************************/
+
+static long mcs9835_ioctl_uart(struct file *file,
+			       unsigned int cmd,
+			       unsigned long arg)
+{
+  struct mcs9835_uart *uart = NULL;
+  struct mcs9835_uart_tuning tuning;
+  struct mcs9835_uart_bridge bridge;
+  struct mcs9835_uart_framing framing;
+  struct mcs9835_uart_rs485 rs485;
+  long rc;
+
+  /* Get UART private data */
+  uart = file->private_data;
+  if (uart == NULL) {
+    return -ENODEV;
+  }
+
+  switch (cmd) {
+  case MCS9835_IOC_UART_SET_TUNING:
+    rc = ioctl_set_tuning(uart, (void __user *)arg);
+    break;
+  case MCS9835_IOC_UART_GET_TUNING:
+    ioctl_get_tuning(uart, &tuning);
+    rc = 0;
+    if (copy_to_user((void __user *)arg, &tuning, sizeof(tuning))) {
+      rc = -EFAULT;
+    }
+    break;
+  case MCS9835_IOC_UART_SET_BRIDGE:
+    rc = ioctl_set_bridge(uart, (void __user *)arg);
+    break;
+  case MCS9835_IOC_UART_GET_BRIDGE:
+    ioctl_get_bridge(uart, &bridge);
+    rc = 0;
+    if (copy_to_user((void __user *)arg, &bridge, sizeof(bridge))) {
+      rc = -EFAULT;
+    }
+    break;
+  case MCS9835_IOC_UART_SET_FRAMING:
+    rc = ioctl_set_framing(uart, (void __user *)arg);
+    break;
+  case MCS9835_IOC_UART_GET_FRAMING:
+    ioctl_get_framing(uart, &framing);
+    rc = 0;
+    if (copy_to_user((void __user *)arg, &framing, sizeof(framing))) {
+      rc = -EFAULT;
+    }
+    break;
+  case MCS9835_IOC_UART_SET_RS485:
+    rc = ioctl_set_rs485(uart, (void __user *)arg);
+    break;
+  case MCS9835_IOC_UART_GET_RS485:
+    ioctl_get_rs485(uart, &rs485);
+    rc = 0;
+    if (copy_to_user((void __user *)arg, &rs485, sizeof(rs485))) {
+      rc = -EFAULT;
+    }
+    break;
+  default:
+    return -ENOTTY;
+  }
+
+  if (rc < 0) {
+    mcs9835_stats_error(uart->dev->chr[uart->cdev_idx].stats, rc);
+  }
+
+  return rc;
+}
+
+/****************************************************************************
+ *
+ * Support functions
+ *
+ ****************************************************************************/
+
+/****************************************************************************/
+
+static void uart_startup(struct mcs9835_uart *uart)
+{
+  unsigned long flags;
+  unsigned divisor;
+
+  divisor = MCS9835_UART_BASE_BAUD / uart->baudrate;
+
+  LOG(MCS_INF, "UART-%c startup, %u baud (divisor %u)\n",
+      'A' + uart->idx, MCS9835_UART_BASE_BAUD / divisor, divisor);
+
+  spin_lock_irqsave(&uart->lock, flags);
+
+  kfifo_reset(&uart->rx_fifo);
+  kfifo_reset(&uart->rx_frames);
+  uart->frame_len    = 0;
+  uart->frame_expect = 0;
+  uart->frame_value  = 0;
+  spin_lock(&uart->tx_in_lock);
+  kfifo_reset(&uart->tx_fifo);
+  spin_unlock(&uart->tx_in_lock);
+  uart->rx_idle = 0;
+
+  /* Baudrate and line settings 8N1 */
+  uart_write_reg(uart, MCS9835_UART_REG_LCR,
+		 MCS9835_UART_LCR_DLAB | MCS9835_UART_LCR_WLEN8);
+  uart_write_reg(uart, MCS9835_UART_REG_DLL, divisor & 0xff);
+  uart_write_reg(uart, MCS9835_UART_REG_DLM, (divisor >> 8) & 0xff);
+  uart_write_reg(uart, MCS9835_UART_REG_LCR, MCS9835_UART_LCR_WLEN8);
+
+  /* Enable and clear FIFOs */
+  uart_write_reg(uart, MCS9835_UART_REG_FCR,
+		 uart->fcr |
+		 MCS9835_UART_FCR_CLEAR_RCVR |
+		 MCS9835_UART_FCR_CLEAR_XMIT);
+
+  /* RS-485 starts out receiving */
+  uart->mcr = (MCS9835_UART_MCR_DTR |
+	       MCS9835_UART_MCR_RTS |
+	       MCS9835_UART_MCR_OUT2);
+  uart->rs485_txing = 0;
+  if (uart->rs485) {
+    uart_rs485_direction(uart, 0);
+  } else {
+    uart_write_reg(uart, MCS9835_UART_REG_MCR, uart->mcr);
+  }
+
+  /* Clear any pending interrupts */
+  uart_read_reg(uart, MCS9835_UART_REG_LSR);
+  uart_read_reg(uart, MCS9835_UART_REG_RBR);
+  uart_read_reg(uart, MCS9835_UART_REG_IIR);
+  uart_read_reg(uart, MCS9835_UART_REG_MSR);
+
+  /* Receive interrupts, transmit enabled when there is data */
+  uart->ier = MCS9835_UART_IER_RDI | MCS9835_UART_IER_RLSI;
+  uart->ier_masked = 0;
+  uart_write_ier(uart);
+
+  spin_unlock_irqrestore(&uart->lock, flags);
+}
+
+/****************************************************************************/
+
+static void uart_shutdown(struct mcs9835_uart *uart)
+{
+  unsigned long flags;
+
+  LOG(MCS_INF, "UART-%c shutdown\n", 'A' + uart->idx);
+
+  spin_lock_irqsave(&uart->lock, flags);
+
+  uart->ier = 0;
+  uart->mcr = 0;
+  uart->rs485_txing = 0;
+  uart_write_reg(uart, MCS9835_UART_REG_IER, 0);
+  uart_write_reg(uart, MCS9835_UART_REG_MCR, 0);
+  uart_write_reg(uart, MCS9835_UART_REG_FCR,
+		 MCS9835_UART_FCR_CLEAR_RCVR |
+		 MCS9835_UART_FCR_CLEAR_XMIT);
+
+  spin_unlock_irqrestore(&uart->lock, flags);
+}
+
+/****************************************************************************/
+
+static void uart_start_tx(struct mcs9835_uart *uart)
+{
+  unsigned long flags;
+
+  spin_lock_irqsave(&uart->lock, flags);
+
+  /*
+   * Enabling THRI with an empty FIFO raises the interrupt at once.
+   * Closed, nothing to transmit, the bridge may still add data.
+   */
+  if ( uart->ier &&
+       !(uart->ier & MCS9835_UART_IER_THRI) ) {
+    /* RS-485, driver enabled before the first bit */
+    if ( uart->rs485 &&
+	 !uart->rs485_txing ) {
+      uart_rs485_direction(uart, 1);
+    }
+    uart->ier |= MCS9835_UART_IER_THRI;
+    uart_write_ier(uart);
+  }
+
+  spin_unlock_irqrestore(&uart->lock, flags);
+}
+
+/****************************************************************************/
+
+/*
+ * Move received data from the hardware FIFO to the receive ring.
+ * Called from interrupt handler or poll timer with UART lock held.
+ * Returns bytes taken from the FIFO.
+ */
+static unsigned uart_rx_chars(struct mcs9835_uart *uart,
+			      u8 iir,
+			      u8 lsr)
+{
+  u8 buf[MCS9835_UART_FIFO_SIZE];
+  unsigned n = 0;
+  unsigned in;
+
+  if (lsr & MCS9835_UART_LSR_OE) {
+    uart->hw_overruns++;
+  }
+  if (lsr & (MCS9835_UART_LSR_PE |
+	     MCS9835_UART_LSR_FE |
+	     MCS9835_UART_LSR_BI)) {
+    uart->rx_errors++;
+  }
+
+  /*
+   * Trigger level reached, at least that many bytes
+   * are available and can be read back to back.
+   */
+  if ((iir & MCS9835_UART_IIR_ID) == MCS9835_UART_IIR_RDI) {
+    switch (uart->fcr & MCS9835_UART_FCR_TRIGGER_14) {
+    case MCS9835_UART_FCR_TRIGGER_14:
+      n = 14;
+      break;
+    case MCS9835_UART_FCR_TRIGGER_8:
+      n = 8;
+      break;
+    case MCS9835_UART_FCR_TRIGGER_4:
+      n = 4;
+      break;
+    default:
+      n = 1;
+    }
+    ioread8_rep(uart->base + MCS9835_UART_REG_RBR, buf, n);
+    trace_mcs9835_reg_read_rep(uart->dev->dev_idx, uart->idx,
+			       MCS9835_UART_REG_RBR, n);
+    lsr = uart_read_reg(uart, MCS9835_UART_REG_LSR);
+  }
+
+  /* Remaining bytes, check data ready for each */
+  while ( (lsr & MCS9835_UART_LSR_DR) &&
+	  (n < MCS9835_UART_FIFO_SIZE) ) {
+    buf[n++] = uart_read_reg(uart, MCS9835_UART_REG_RBR);
+    lsr = uart_read_reg(uart, MCS9835_UART_REG_LSR);
+  }
+
+  /* RS-485 half duplex, the echo of our own transmission */
+  if ( uart->rs485_txing &&
+       !(uart->rs485 & MCS9835_UART_RS485_RX_DURING_TX) ) {
+    return n;
+  }
+
+  /* Bridged, the other UART transmits the data */
+  if (uart->bridge) {
+    uart_bridge_forward(uart, buf, n);
+    if (!uart->bridge_mirror) {
+      return n;
+    }
+  }
+
+  /* Single producer, no locking needed */
+  in = kfifo_in(&uart->rx_fifo, buf, n);
+  if (in < n) {
+    uart->rx_overruns += n - in;
+  }
+
+  /*
+   * Framed, wake readers on complete frames. With idle gap
+   * framing, each reception restarts the gap timer.
+   */
+  if (uart->frame_mode != MCS9835_UART_FRAME_NONE) {
+    if (uart_rx_frame(uart, buf, in)) {
+      wake_up_interruptible(&uart->rx_wq);
+    }
+    if ( (uart->frame_mode == MCS9835_UART_FRAME_IDLE) &&
+	 uart->frame_len ) {
+      hrtimer_start(&uart->rx_idle_timer,
+		    ns_to_ktime(uart->frame_idle_ns), HRTIMER_MODE_REL);
+    }
+    return n;
+  }
+
+  /*
+   * Wake readers at the threshold. Below it, each reception
+   * restarts the idle timer, which wakes them when the line
+   * goes quiet.
+   */
+  if (kfifo_len(&uart->rx_fifo) >= uart->rx_wake) {
+    wake_up_interruptible(&uart->rx_wq);
+  } else if (uart->rx_idle_ns) {
+    hrtimer_start(&uart->rx_idle_timer,
+		  ns_to_ktime(uart->rx_idle_ns), HRTIMER_MODE_REL);
+  }
+
+  return n;
+}
+
+/****************************************************************************/
+
+/*
+ * Find frame ends in data added to the receive ring.
+ * Called with UART lock held. Returns frames completed.
+ */
+static unsigned uart_rx_frame(struct mcs9835_uart *uart,
+			      const u8 *buf,
+			      unsigned n)
+{
+  unsigned ended = 0;
+  unsigned pos;
+  unsigned i;
+
+  for (i = 0; i < n; i++) {
+    pos = uart->frame_len++;
+
+    switch (uart->frame_mode) {
+    case MCS9835_UART_FRAME_DELIM:
+      if (buf[i] == uart->frame_delim) {
+	uart_rx_frame_end(uart);
+	ended++;
+	continue;
+      }
+      break;
+    case MCS9835_UART_FRAME_LENGTH:
+      /* Collect the prefix, the frame length is then known */
+      if ( (pos >= uart->frame_offset) &&
+	   (pos < uart->frame_offset + uart->frame_size) ) {
+	if (uart->frame_be) {
+	  uart->frame_value = (uart->frame_value << 8) | buf[i];
+	} else {
+	  uart->frame_value |= buf[i] << (8 * (pos - uart->frame_offset));
+	}
+	if (pos + 1 == uart->frame_offset + uart->frame_size) {
+	  uart->frame_expect = pos + 1 + uart->frame_value;
+	}
+      }
+      if ( uart->frame_expect &&
+	   (uart->frame_len == uart->frame_expect) ) {
+	uart_rx_frame_end(uart);
+	ended++;
+	continue;
+      }
+      break;
+    default:
+      /* Idle gap, ended by the timer */
+      break;
+    }
+
+    /* Too long, end it here */
+    if (uart->frame_len >= uart->frame_max) {
+      uart->frame_errors++;
+      uart_rx_frame_end(uart);
+      ended++;
+    }
+  }
+
+  return ended;
+}
+
+/****************************************************************************/
+
+/*
+ * Complete the frame being received.
+ * Called with UART lock held.
+ */
+static void uart_rx_frame_end(struct mcs9835_uart *uart)
+{
+  /* Never full, there are at least as many bytes in the receive ring */
+  kfifo_put(&uart->rx_frames, (u16)uart->frame_len);
+  uart->frames++;
+
+  uart->frame_len    = 0;
+  uart->frame_expect = 0;
+  uart->frame_value  = 0;
+}
+
+/****************************************************************************/
+
+/*
+ * Poll for received data, receive interrupts masked.
+ * At most one FIFO per poll.
+ */
+static int uart_rx_poll(struct mcs9835_hybrid *hy)
+{
+  struct mcs9835_uart *uart = container_of(hy,
+					   struct mcs9835_uart,
+					   rx_hybrid);
+  unsigned long flags;
+  unsigned n = 0;
+  int kick;
+  u8 lsr;
+
+  spin_lock_irqsave(&uart->lock, flags);
+
+  /* Closed, nothing to poll */
+  if (uart->ier) {
+    lsr = uart_read_reg(uart, MCS9835_UART_REG_LSR);
+    if (lsr & (MCS9835_UART_LSR_DR | MCS9835_UART_LSR_BI)) {
+      n = uart_rx_chars(uart, MCS9835_UART_IIR_NO_INT, lsr);
+    }
+  }
+
+  kick = uart->bridge_kick;
+  uart->bridge_kick = 0;
+
+  spin_unlock_irqrestore(&uart->lock, flags);
+
+  uart_bridge_kick(uart, kick);
+
+  return n;
+}
+
+/****************************************************************************/
+
+/*
+ * Receive traffic drained, back to interrupts.
+ */
+static void uart_rx_unmask(struct mcs9835_hybrid *hy)
+{
+  struct mcs9835_uart *uart = container_of(hy,
+					   struct mcs9835_uart,
+					   rx_hybrid);
+  unsigned long flags;
+
+  spin_lock_irqsave(&uart->lock, flags);
+
+  uart->ier_masked = 0;
+  if (uart->ier) {
+    uart_write_ier(uart);
+  }
+
+  spin_unlock_irqrestore(&uart->lock, flags);
+}
+
+/****************************************************************************/
+
+/*
+ * Move received data into the transmit ring of the other UART.
+ * Called from interrupt handler or poll timer with UART lock held,
+ * the other UART is started by uart_bridge_kick() when unlocked.
+ */
+static void uart_bridge_forward(struct mcs9835_uart *uart,
+				const u8 *buf,
+				unsigned n)
+{
+  struct mcs9835_uart *peer = &uart->dev->uart[uart->idx ^ 1];
+  unsigned in = 0;
+
+  /* Other UART closed, nothing would drain its ring */
+  if (READ_ONCE(peer->ier)) {
+    spin_lock(&peer->tx_in_lock);
+    in = kfifo_in(&peer->tx_fifo, buf, n);
+    spin_unlock(&peer->tx_in_lock);
+  }
+
+  uart->bridge_forwarded += in;
+  uart->bridge_dropped   += n - in;
+  if (in) {
+    uart->bridge_kick = 1;
+  }
+}
+
+/****************************************************************************/
+
+/*
+ * Start transmit on the other UART after forwarding.
+ * Called without UART lock, the locks of both UARTs
+ * are never held at the same time.
+ */
+static void uart_bridge_kick(struct mcs9835_uart *uart,
+			     int kick)
+{
+  if (kick) {
+    uart_start_tx(&uart->dev->uart[uart->idx ^ 1]);
+  }
+}
+
+/****************************************************************************/
+
+/*
+ * Write the interrupt enable register, without bits masked
+ * while polling. Called with UART lock held.
+ */
+static void uart_write_ier(struct mcs9835_uart *uart)
+{
+  uart_write_reg(uart, MCS9835_UART_REG_IER, uart->ier & ~uart->ier_masked);
+}
+
+/****************************************************************************/
+
+/*
+ * Fill the empty hardware FIFO from the transmit ring.
+ * Called from interrupt handler with UART lock held.
+ */
+static void uart_tx_chars(struct mcs9835_uart *uart)
+{
+  u8 buf[MCS9835_UART_FIFO_SIZE];
+  unsigned n;
+
+  /* Single consumer, no locking needed */
+  n = kfifo_out(&uart->tx_fifo, buf, MCS9835_UART_FIFO_SIZE);
+  if (n) {
+    iowrite8_rep(uart->base + MCS9835_UART_REG_THR, buf, n);
+    trace_mcs9835_reg_write_rep(uart->dev->dev_idx, uart->idx,
+				MCS9835_UART_REG_THR, n);
+  }
+
+  /*
+   * Ring empty, stop transmit interrupts. RS-485 takes one more,
+   * with the FIFO empty, then times out the last character
+   * before the driver is disabled.
+   */
+  if ( kfifo_is_empty(&uart->tx_fifo) &&
+       (!uart->rs485_txing || (n == 0)) ) {
+    uart->ier &= ~MCS9835_UART_IER_THRI;
+    uart_write_ier(uart);
+    if (uart->rs485_txing) {
+      hrtimer_start(&uart->rs485_timer,
+		    ns_to_ktime(uart->rs485_char_ns + uart->rs485_delay_ns),
+		    HRTIMER_MODE_REL);
+    }
+  }
+
+  wake_up_interruptible(&uart->tx_wq);
+}
+
+/****************************************************************************/
+
+/*
+ * Receive line idle with data below the wake-up threshold.
+ */
+static enum hrtimer_restart uart_rx_idle_timer(struct hrtimer *timer)
+{
+  struct mcs9835_uart *uart = container_of(timer,
+					   struct mcs9835_uart,
+					   rx_idle_timer);
+  unsigned long flags;
+
+  if (uart->frame_mode == MCS9835_UART_FRAME_IDLE) {
+    spin_lock_irqsave(&uart->lock, flags);
+    /* Restarted by a reception while waiting for the lock */
+    if ( !hrtimer_is_queued(timer) &&
+	 uart->frame_len ) {
+      uart_rx_frame_end(uart);
+    }
+    spin_unlock_irqrestore(&uart->lock, flags);
+  } else {
+    uart->rx_idle = 1;
+  }
+  wake_up_interruptible(&uart->rx_wq);
+
+  return HRTIMER_NORESTART;
+}
+
+/****************************************************************************/
+
+/*
+ * Received data for readers, per wake-up tuning.
+ */
+static int uart_rx_ready(struct mcs9835_uart *uart)
+{
+  unsigned len = kfifo_len(&uart->rx_fifo);
+
+  /* Framed, complete frames only */
+  if (uart->frame_mode != MCS9835_UART_FRAME_NONE) {
+    return !kfifo_is_empty(&uart->rx_frames);
+  }
+
+  return (len >= uart->rx_wake) || (len && uart->rx_idle);
+}
+
+/****************************************************************************/
+
+/*
+ * Set receive tuning, the FIFO trigger level applies at once
+ * when the UART is open.
+ */
+static long ioctl_set_tuning(struct mcs9835_uart *uart,
+			     void __user *arg)
+{
+  struct mcs9835_uart_tuning tuning;
+  unsigned long flags;
+  u8 trigger;
+
+  if (copy_from_user(&tuning, arg, sizeof(tuning))) {
+    return -EFAULT;
+  }
+
+  /* Every byte, no coalescing in hardware or driver */
+  if (tuning.low_latency) {
+    tuning.trigger        = 1;
+    tuning.wake_threshold = 1;
+    tuning.rx_idle_us     = 0;
+  }
+
+  switch (tuning.trigger) {
+  case 1:
+    trigger = MCS9835_UART_FCR_TRIGGER_1;
+    break;
+  case 4:
+    trigger = MCS9835_UART_FCR_TRIGGER_4;
+    break;
+  case 8:
+    trigger = MCS9835_UART_FCR_TRIGGER_8;
+    break;
+  case 14:
+    trigger = MCS9835_UART_FCR_TRIGGER_14;
+    break;
+  default:
+    return -EINVAL;
+  }
+  if ( (tuning.wake_threshold == 0) ||
+       (tuning.wake_threshold > kfifo_size(&uart->rx_fifo)) ||
+       (tuning.rx_idle_us > MCS9835_UART_RX_IDLE_MAX_US) ) {
+    return -EINVAL;
+  }
+
+  /* Serialize with open and close */
+  if (mutex_lock_interruptible(&uart->write_mutex)) {
+    return -ERESTARTSYS;
+  }
+
+  /* Device removed */
+  if (!uart->dev->init_done) {
+    mutex_unlock(&uart->write_mutex);
+    return -ENODEV;
+  }
+
+  spin_lock_irqsave(&uart->lock, flags);
+
+  uart->rx_wake     = tuning.wake_threshold;
+  uart->rx_idle_ns  = (u64)tuning.rx_idle_us * NSEC_PER_USEC;
+  uart->low_latency = (tuning.low_latency != 0);
+
+  uart->fcr = (uart->fcr & ~MCS9835_UART_FCR_TRIGGER_14) | trigger;
+  if (uart->ier) {
+    /* Keeps the FIFO contents, no clear bits */
+    uart_write_reg(uart, MCS9835_UART_REG_FCR, uart->fcr);
+  }
+
+  spin_unlock_irqrestore(&uart->lock, flags);
+
+  mutex_unlock(&uart->write_mutex);
+
+  /* Readers may already have enough under the new threshold */
+  wake_up_interruptible(&uart->rx_wq);
+
+  LOG(MCS_INF, "UART-%c trigger %u, wake %u, idle %u us%s\n",
+      'A' + uart->idx, tuning.trigger, tuning.wake_threshold,
+      tuning.rx_idle_us, uart->low_latency ? ", low latency" : "");
+
+  return 0;
+}
+
+/****************************************************************************/
+
+static void ioctl_get_tuning(struct mcs9835_uart *uart,
+			     struct mcs9835_uart_tuning *tuning)
+{
+  switch (uart->fcr & MCS9835_UART_FCR_TRIGGER_14) {
+  case MCS9835_UART_FCR_TRIGGER_14:
+    tuning->trigger = 14;
+    break;
+  case MCS9835_UART_FCR_TRIGGER_8:
+    tuning->trigger = 8;
+    break;
+  case MCS9835_UART_FCR_TRIGGER_4:
+    tuning->trigger = 4;
+    break;
+  default:
+    tuning->trigger = 1;
+  }
+  tuning->wake_threshold = uart->rx_wake;
+  tuning->rx_idle_us     = (__u32)div_u64(uart->rx_idle_ns, NSEC_PER_USEC);
+  tuning->low_latency    = uart->low_latency;
+}
+
+/****************************************************************************/
+
+/*
+ * Set forwarding to the other UART, takes effect
+ * with the next received data.
+ */
+static long ioctl_set_bridge(struct mcs9835_uart *uart,
+			     void __user *arg)
+{
+  struct mcs9835_uart_bridge bridge;
+  unsigned long flags;
+
+  if (copy_from_user(&bridge, arg, sizeof(bridge))) {
+    return -EFAULT;
+  }
+
+  spin_lock_irqsave(&uart->lock, flags);
+
+  if (bridge.enable && !uart->bridge) {
+    uart->bridge_forwarded = 0;
+    uart->bridge_dropped   = 0;
+  }
+  uart->bridge        = (bridge.enable != 0);
+  uart->bridge_mirror = (bridge.mirror != 0);
+
+  spin_unlock_irqrestore(&uart->lock, flags);
+
+  LOG(MCS_INF, "UART-%c bridge to UART-%c %s%s\n",
+      'A' + uart->idx, 'A' + (uart->idx ^ 1),
+      uart->bridge ? "on" : "off",
+      (uart->bridge && uart->bridge_mirror) ? ", mirrored" : "");
+
+  return 0;
+}
+
+/****************************************************************************/
+
+static void ioctl_get_bridge(struct mcs9835_uart *uart,
+			     struct mcs9835_uart_bridge *bridge)
+{
+  unsigned long flags;
+
+  spin_lock_irqsave(&uart->lock, flags);
+
+  bridge->enable    = uart->bridge;
+  bridge->mirror    = uart->bridge_mirror;
+  bridge->forwarded = uart->bridge_forwarded;
+  bridge->dropped   = uart->bridge_dropped;
+
+  spin_unlock_irqrestore(&uart->lock, flags);
+}
+
+/****************************************************************************/
+
+static long ioctl_set_framing(struct mcs9835_uart *uart,
+			      void __user *arg)
+{
+  struct mcs9835_uart_framing framing;
+
+  if (copy_from_user(&framing, arg, sizeof(framing))) {
+    return -EFAULT;
+  }
+
+  return uart_set_framing(uart, &framing);
+}
+
+/****************************************************************************/
+
+static void ioctl_get_framing(struct mcs9835_uart *uart,
+			      struct mcs9835_uart_framing *framing)
+{
+  unsigned long flags;
+
+  memset(framing, 0, sizeof(*framing));
+
+  spin_lock_irqsave(&uart->lock, flags);
+
+  framing->mode          = uart->frame_mode;
+  framing->flags         = (uart->frame_be ? MCS9835_UART_FRAME_BE : 0);
+  framing->delimiter     = uart->frame_delim;
+  framing->length_offset = uart->frame_offset;
+  framing->length_size   = uart->frame_size;
+  framing->idle_us       = (__u32)div_u64(uart->frame_idle_ns, NSEC_PER_USEC);
+  framing->max_len       = uart->frame_max;
+  framing->frames        = uart->frames;
+  framing->errors        = uart->frame_errors;
+
+  spin_unlock_irqrestore(&uart->lock, flags);
+}
+
+/****************************************************************************/
+
+/*
+ * Set RS-485 mode. Direction changes at once when the UART is open,
+ * Modbus framing discards received data.
+ */
+static long ioctl_set_rs485(struct mcs9835_uart *uart,
+			    void __user *arg)
+{
+  struct mcs9835_uart_rs485 rs485;
+  struct mcs9835_uart_framing framing;
+  unsigned long flags;
+  unsigned mode;
+  long rc;
+
+  if (copy_from_user(&rs485, arg, sizeof(rs485))) {
+    return -EFAULT;
+  }
+
+  if ( (rs485.flags & ~(MCS9835_UART_RS485_ENABLED |
+			MCS9835_UART_RS485_RTS_ON_SEND |
+			MCS9835_UART_RS485_RX_DURING_TX |
+			MCS9835_UART_RS485_MODBUS)) ||
+       (rs485.delay_after_us > MCS9835_UART_RS485_DELAY_MAX_US) ) {
+    return -EINVAL;
+  }
+  mode = rs485.flags;
+  if (!(mode & MCS9835_UART_RS485_ENABLED)) {
+    mode = 0;
+  }
+
+  /* Modbus RTU frames end with a t3.5 silence, receive kept off polls */
+  if (mode & MCS9835_UART_RS485_MODBUS) {
+    memset(&framing, 0, sizeof(framing));
+    framing.mode    = MCS9835_UART_FRAME_IDLE;
+    framing.idle_us = uart_rs485_t35_us(uart);
+    rc = uart_set_framing(uart, &framing);
+    if (rc) {
+      return rc;
+    }
+  }
+
+  /* Serialize with open and close */
+  if (mutex_lock_interruptible(&uart->write_mutex)) {
+    return -ERESTARTSYS;
+  }
+
+  /* Device removed */
+  if (!uart->dev->init_done) {
+    mutex_unlock(&uart->write_mutex);
+    return -ENODEV;
+  }
+
+  spin_lock_irqsave(&uart->lock, flags);
+
+  uart->rs485          = mode;
+  uart->rs485_delay_ns = (u64)rs485.delay_after_us * NSEC_PER_USEC;
+
+  /* Each byte timed when it arrives, not at the FIFO timeout */
+  if (mode & MCS9835_UART_RS485_MODBUS) {
+    uart->fcr = ((uart->fcr & ~MCS9835_UART_FCR_TRIGGER_14) |
+		 MCS9835_UART_FCR_TRIGGER_1);
+    if (uart->ier) {
+      uart_write_reg(uart, MCS9835_UART_REG_FCR, uart->fcr);
+    }
+  }
+
+  if (uart->ier) {
+    if (mode) {
+      /* Transmitting, or waiting for the last character */
+      uart_rs485_direction(uart,
+			   uart->rs485_txing ||
+			   (uart->ier & MCS9835_UART_IER_THRI));
+    } else {
+      /* RTS back to modem control */
+      uart->rs485_txing = 0;
+      uart->mcr |= MCS9835_UART_MCR_RTS;
+      uart_write_reg(uart, MCS9835_UART_REG_MCR, uart->mcr);
+    }
+  }
+
+  spin_unlock_irqrestore(&uart->lock, flags);
+
+  mutex_unlock(&uart->write_mutex);
+
+  /* Close may wait for the turn around */
+  if (!mode) {
+    hrtimer_cancel(&uart->rs485_timer);
+    wake_up_interruptible(&uart->tx_wq);
+  }
+
+  LOG(MCS_INF, "UART-%c RS-485 flags 0x%x, delay %u us, t3.5 %u us\n",
+      'A' + uart->idx, mode, rs485.delay_after_us, uart_rs485_t35_us(uart));
+
+  return 0;
+}
+
+/****************************************************************************/
+
+static void ioctl_get_rs485(struct mcs9835_uart *uart,
+			    struct mcs9835_uart_rs485 *rs485)
+{
+  memset(rs485, 0, sizeof(*rs485));
+
+  rs485->flags          = uart->rs485;
+  rs485->delay_after_us = (__u32)div_u64(uart->rs485_delay_ns,
+					 NSEC_PER_USEC);
+  rs485->t35_us         = uart_rs485_t35_us(uart);
+}
+
+/****************************************************************************/
+
+/*
+ * Set receive framing. Received data not read is discarded,
+ * it may end in the middle of a frame.
+ */
+static long uart_set_framing(struct mcs9835_uart *uart,
+			     const struct mcs9835_uart_framing *framing)
+{
+  unsigned long flags;
+  unsigned max_len;
+
+  max_len = (framing->max_len ?
+	     framing->max_len : kfifo_size(&uart->rx_fifo));
+  if ( (max_len > kfifo_size(&uart->rx_fifo)) ||
+       (framing->flags & ~MCS9835_UART_FRAME_BE) ) {
+    return -EINVAL;
+  }
+
+  switch (framing->mode) {
+  case MCS9835_UART_FRAME_NONE:
+    break;
+  case MCS9835_UART_FRAME_DELIM:
+    if (framing->delimiter > 0xff) {
+      return -EINVAL;
+    }
+    break;
+  case MCS9835_UART_FRAME_LENGTH:
+    if ( ((framing->length_size != 1) && (framing->length_size != 2)) ||
+	 (framing->length_offset > MCS9835_UART_FRAME_OFFSET_MAX) ) {
+      return -EINVAL;
+    }
+    break;
+  case MCS9835_UART_FRAME_IDLE:
+    if ( (framing->idle_us == 0) ||
+	 (framing->idle_us > MCS9835_UART_FRAME_IDLE_MAX_US) ) {
+      return -EINVAL;
+    }
+    break;
+  default:
+    return -EINVAL;
+  }
+
+  /* No reader while the receive ring is reset */
+  if (mutex_lock_interruptible(&uart->read_mutex)) {
+    return -ERESTARTSYS;
+  }
+
+  spin_lock_irqsave(&uart->lock, flags);
+
+  uart->frame_mode    = framing->mode;
+  uart->frame_delim   = (u8)framing->delimiter;
+  uart->frame_offset  = framing->length_offset;
+  uart->frame_size    = framing->length_size;
+  uart->frame_be      = ((framing->flags & MCS9835_UART_FRAME_BE) != 0);
+  uart->frame_idle_ns = (u64)framing->idle_us * NSEC_PER_USEC;
+  uart->frame_max     = max_len;
+  uart->frame_len     = 0;
+  uart->frame_expect  = 0;
+  uart->frame_value   = 0;
+  uart->frames        = 0;
+  uart->frame_errors  = 0;
+
+  kfifo_reset(&uart->rx_fifo);
+  kfifo_reset(&uart->rx_frames);
+  uart->rx_idle = 0;
+
+  spin_unlock_irqrestore(&uart->lock, flags);
+
+  mutex_unlock(&uart->read_mutex);
+
+  /* Gap or idle timeout of the previous setting */
+  hrtimer_cancel(&uart->rx_idle_timer);
+
+  /* Idle gap framing times each reception, back to interrupts */
+  if ( (framing->mode == MCS9835_UART_FRAME_IDLE) &&
+       uart->rx_hybrid.polling ) {
+    mcs9835_hybrid_stop(&uart->rx_hybrid);
+    uart_rx_unmask(&uart->rx_hybrid);
+  }
+
+  LOG(MCS_INF, "UART-%c framing mode %u, max %u\n",
+      'A' + uart->idx, framing->mode, max_len);
+
+  return 0;
+}
+
+/****************************************************************************/
+
+/*
+ * Modbus RTU t3.5, 3.5 character times.
+ */
+static unsigned uart_rs485_t35_us(struct mcs9835_uart *uart)
+{
+  if (uart->baudrate > MCS9835_UART_MODBUS_BAUD_MAX) {
+    return MCS9835_UART_MODBUS_T35_US;
+  }
+
+  return DIV_ROUND_UP(35 * MCS9835_UART_CHAR_BITS * USEC_PER_SEC,
+		      10 * uart->baudrate);
+}
+
+/****************************************************************************/
+
+/*
+ * Drive RTS for transmit or receive.
+ * Called with UART lock held.
+ */
+static void uart_rs485_direction(struct mcs9835_uart *uart,
+				 int tx)
+{
+  int rts_on_send = ((uart->rs485 & MCS9835_UART_RS485_RTS_ON_SEND) != 0);
+
+  if ((tx != 0) == rts_on_send) {
+    uart->mcr |= MCS9835_UART_MCR_RTS;
+  } else {
+    uart->mcr &= ~MCS9835_UART_MCR_RTS;
+  }
+  uart->rs485_txing = (tx != 0);
+
+  uart_write_reg(uart, MCS9835_UART_REG_MCR, uart->mcr);
+}
+
+/****************************************************************************/
+
+/*
+ * Last character timed out after the transmit FIFO emptied.
+ * Switch to receive when the transmitter is empty, else check
+ * again a bit time later.
+ */
+static enum hrtimer_restart uart_rs485_timer(struct hrtimer *timer)
+{
+  struct mcs9835_uart *uart = container_of(timer,
+					   struct mcs9835_uart,
+					   rs485_timer);
+  enum hrtimer_restart restart = HRTIMER_NORESTART;
+  unsigned long flags;
+  int done = 0;
+
+  spin_lock_irqsave(&uart->lock, flags);
+
+  /* Transmitting again, or closed */
+  if ( uart->rs485_txing &&
+       !(uart->ier & MCS9835_UART_IER_THRI) ) {
+    if (uart_read_reg(uart, MCS9835_UART_REG_LSR) & MCS9835_UART_LSR_TEMT) {
+      uart_rs485_direction(uart, 0);
+      if (!(uart->rs485 & MCS9835_UART_RS485_RX_DURING_TX)) {
+	/* Echo of the last character */
+	uart_write_reg(uart, MCS9835_UART_REG_FCR,
+		       uart->fcr | MCS9835_UART_FCR_CLEAR_RCVR);
+      }
+      done = 1;
+    } else {
+      hrtimer_forward_now(timer,
+			  ns_to_ktime(div_u64(uart->rs485_char_ns,
+					      MCS9835_UART_CHAR_BITS)));
+      restart = HRTIMER_RESTART;
+    }
+  }
+
+  spin_unlock_irqrestore(&uart->lock, flags);
+
+  /* Close waits for the turn around */
+  if (done) {
+    wake_up_interruptible(&uart->tx_wq);
+  }
+
+  return restart;
+}
+
+/****************************************************************************/
+
+/*
+ * Deliver one received frame, truncated to the read buffer.
+ * Called with read mutex held and a complete frame received.
+ * The frame is removed also when the copy fails.
+ */
+static ssize_t uart_read_frame(struct mcs9835_uart *uart,
+			       struct mcs9835_ubuf *ub,
+			       size_t count,
+			       u8 *buf,
+			       size_t size)
+{
+  size_t done = 0;
+  unsigned left;
+  unsigned n;
+  int rc = 0;
+  u16 len;
+
+  /* Length first, keeps the frame ring within the byte ring */
+  if (!kfifo_get(&uart->rx_frames, &len)) {
+    return 0;
+  }
+
+  left = len;
+  while (left) {
+    n = kfifo_out(&uart->rx_fifo, buf, min_t(size_t, left, size));
+    if (n == 0) {
+      break;
+    }
+    left -= n;
+
+    /* Copy what fits, discard the rest */
+    if ( !rc && (done < count) ) {
+      n = min_t(size_t, count - done, n);
+      rc = mcs9835_ubuf_to_user(ub, buf, n);
+      if (!rc) {
+	done += n;
+      }
+    }
+  }
+
+  return (done ? done : rc);
+}
+
+/****************************************************************************/
+
+static void uart_write_reg(struct mcs9835_uart *uart,
+			   unsigned offset,
+			   u8 value)
+{
+  s64 start_ns;
+
+  trace_mcs9835_reg_write(uart->dev->dev_idx, uart->idx, offset, value);
+
+  start_ns = mcs9835_stats_start();
+  iowrite8(value, uart->base + offset);
+  mcs9835_stats_hist(uart->dev->reg_stats, MCS9835_HIST_REG_WRITE, start_ns);
+}
+
+/****************************************************************************/
+
+static u8 uart_read_reg(struct mcs9835_uart *uart,
+			unsigned offset)
+{
+  u8 value;
+  s64 start_ns;
+
+  start_ns = mcs9835_stats_start();
+  value = ioread8(uart->base + offset);
+  mcs9835_stats_hist(uart->dev->reg_stats, MCS9835_HIST_REG_READ, start_ns);
+
+  trace_mcs9835_reg_read(uart->dev->dev_idx, uart->idx, offset, value);
+
+  return value;
+}
@@ -0,0 +1,47 @@
+/***********************************************************************
+*                                                                      *
+* Copyright (C) 2017 Bonden i Nol (hakanbrolin@hotmail.com)            *
+*                                                                      *
+* This program is free software; you can redistribute it and/or modify *
+* it under the terms of the GNU General Public License as published by *
+* the Free Software Foundation; either version 2 of the License, or    *
+* (at your option) any later version.                                  *
+*                                                                      *
+************************************************************************/
+
+#ifndef __MCS9835_UART_H__
+#define __MCS9835_UART_H__
+
+#include <linux/fs.h>
+
+#include "mcs9835.h"
+
+/****************************************************************************
+ * 
+ * Exported variables
+ *
+ ****************************************************************************/
+
+extern struct file_operations mcs9835_fops_uart;
+
+/****************************************************************************
+ * 
+ * Exported functions
+ *
+ ****************************************************************************/
+
+extern int mcs9835_uart_initialize(struct mcs9835_dev *dev,
+				   int uart_idx,
+				   int cdev_idx,
+				   void __iomem *base,
+				   unsigned baudrate);
+
+extern void mcs9835_uart_finalize(struct mcs9835_dev *dev,
+				  int uart_idx);
+
+extern void mcs9835_uart_remove(struct mcs9835_dev *dev,
+				int uart_idx);
+
+extern int mcs9835_uart_isr(struct mcs9835_uart *uart);
+
+#endif /* __MCS9835_UART_H__ */
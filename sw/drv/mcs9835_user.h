@@ -0,0 +1,555 @@
+/***********************************************************************
+*                                                                      *
+* Copyright (C) 2017 Bonden i Nol (hakanbrolin@hotmail.com)            *
+*                                                                      *
+* This program is free software; you can redistribute it and/or modify *
+* it under the terms of the GNU General Public License as published by *
+* the Free Software Foundation; either version 2 of the License, or    *
+* (at your option) any later version.                                  *
+*                                                                      *
+************************************************************************/
+
+#ifndef __MCS9835_USER_H__
+#define __MCS9835_USER_H__
+
+/*
+ * Definitions shared between the driver and user space.
+ * This file must be possible to include from user space.
+ */
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/****************************************************************************
+ *
+ * Parallel port status events
+ * Read from /dev/mcs9835_<dev_idx>_3, one or more records per read.
+ *
+ * The parallel port interrupts only on a nAck pulse, one record is
+ * made for each such interrupt. Changes of the other status lines are
+ * not captured by themselves, only seen in the status of the next
+ * record. While status capture is polled (see the hybrid sysfs group),
+ * records are made when the status differs from the last record.
+ * A status read through the driver (read(), sampling, GPIO, register
+ * access) that finds the interrupt pending makes the record itself,
+ * timestamped at that read.
+ *
+ ****************************************************************************/
+struct mcs9835_parport_event {
+  __s64 timestamp_ns; /* Time of interrupt (CLOCK_MONOTONIC)   */
+  __u8  dsr;          /* Status register read with the record  */
+  __u8  reserved[7];
+};
+
+/****************************************************************************
+ *
+ * Register operation batches
+ * Executed in order by the driver, with an optional delay after each
+ * operation. Delays below 10 us busy wait, longer delays sleep and may
+ * last somewhat longer. Values read are returned in the same array.
+ *
+ ****************************************************************************/
+#define MCS9835_REG_OP_READ   0
+#define MCS9835_REG_OP_WRITE  1
+
+/* Max operations in one batch */
+#define MCS9835_REG_BATCH_MAX  256
+
+/* Max delay after one operation */
+#define MCS9835_REG_DELAY_MAX_NS  100000
+
+struct mcs9835_reg_op {
+  __u8  bar;      /* 0:UART-A, 1:UART-B, 2:Parallel port, 3:Config/ECR */
+  __u8  offset;   /* Register offset within BAR                      */
+  __u8  op;       /* MCS9835_REG_OP_x                                */
+  __u8  value;    /* Value to write, or value read                   */
+  __u32 delay_ns; /* Delay after operation, sleeps from 10 us        */
+};
+
+struct mcs9835_reg_batch {
+  __u64 ops;      /* User pointer to array of struct mcs9835_reg_op */
+  __u32 count;    /* Number of operations in array                 */
+  __u32 reserved;
+};
+
+/****************************************************************************
+ *
+ * Register window
+ * Binary sysfs attribute "regs" of the PCI device, root only.
+ * The pread/pwrite offset is bar * MCS9835_REG_WINDOW_STRIDE + register.
+ * Offsets past the end of a BAR read as zero and ignore writes, so the
+ * window can be dumped sequentially, e.g. with hexdump.
+ * Reads have the side effects of the registers read, e.g. reading
+ * the UART receive buffer takes data from the driver.
+ *
+ ****************************************************************************/
+#define MCS9835_REG_WINDOW_STRIDE  0x100
+
+#define MCS9835_REG_WINDOW_OFFSET(bar, reg) \
+  ((bar) * MCS9835_REG_WINDOW_STRIDE + (reg))
+
+/****************************************************************************
+ *
+ * Parallel port modes
+ * SPP  - Data register written by programmed I/O, one byte at a time.
+ * FIFO - ECP parallel port FIFO mode, output only. The hardware
+ *        generates the strobe handshake from its FIFO.
+ * EPP  - EPP address and data cycles, handshake by the hardware.
+ *        The pread/pwrite offset selects the cycle type, read/write
+ *        use data cycles.
+ *
+ ****************************************************************************/
+#define MCS9835_PARPORT_MODE_SPP   0
+#define MCS9835_PARPORT_MODE_FIFO  1
+#define MCS9835_PARPORT_MODE_EPP   2
+
+/* EPP cycle type, pread/pwrite offset */
+#define MCS9835_EPP_CYCLE_DATA  0
+#define MCS9835_EPP_CYCLE_ADDR  1
+
+/****************************************************************************
+ *
+ * Parallel port playback
+ * Steps are queued to the driver and clocked out to the data register
+ * by a kernel timer, independent of the scheduling of the process.
+ * Queue more steps while playing to keep long streams going.
+ *
+ ****************************************************************************/
+
+/* Shortest time between steps, shorter intervals are extended */
+#define MCS9835_PLAY_MIN_INTERVAL_NS  2000
+
+struct mcs9835_play_step {
+  __u32 interval_ns; /* Time from this step to next step */
+  __u8  data;        /* Data register value              */
+  __u8  reserved[3];
+};
+
+struct mcs9835_play_queue {
+  __u64 steps;       /* User pointer to array of struct mcs9835_play_step */
+  __u32 count;       /* Number of steps in array                          */
+  __u32 reserved;
+};
+
+struct mcs9835_play_start {
+  __u32 period_ns;   /* Fixed sample period, 0 uses step intervals */
+  __u32 reserved;
+};
+
+struct mcs9835_play_status {
+  __u32 running;     /* Non-zero while playing                     */
+  __u32 queued;      /* Steps queued and not yet played            */
+  __u32 late;        /* Steps played more than one interval late   */
+  __u32 reserved;
+};
+
+/****************************************************************************
+ *
+ * Parallel port status sampling
+ * The status register is sampled at a fixed period by a kernel timer,
+ * into a ring mapped read-only by mmap() of the parallel port device,
+ * offset 0. The mapping starts with struct mcs9835_sample_ring, the
+ * samples follow at data_offset.
+ *
+ * Sample n is at data[n % size], taken period_ns * n after start_ns.
+ * A late timer holds the last sample over the periods it missed,
+ * keeping the time base, and counts them in missed.
+ *
+ ****************************************************************************/
+
+/* Sample ring size (samples, power of 2) */
+#define MCS9835_SAMPLE_RING_SIZE  (4 * 1024 * 1024)
+
+/* Shortest sample period, 1 MHz */
+#define MCS9835_SAMPLE_MIN_PERIOD_NS  1000
+
+struct mcs9835_sample_ring {
+  __u32 head;        /* Samples written, wraps, read after the data */
+  __u32 size;        /* Ring size (samples)                         */
+  __u32 data_offset; /* Sample data offset in mapping (bytes)       */
+  __u32 period_ns;   /* Sample period                               */
+  __s64 start_ns;    /* Time of sample 0 (CLOCK_MONOTONIC)          */
+  __u32 missed;      /* Periods missed by a late timer              */
+  __u32 running;     /* Non-zero while sampling                     */
+};
+
+struct mcs9835_sample_start {
+  __u32 period_ns;   /* Sample period, MCS9835_SAMPLE_MIN_PERIOD_NS or more */
+  __u32 reserved;
+};
+
+/****************************************************************************
+ *
+ * Parallel port sharing
+ * Several files may have the parallel port device open. A read or
+ * write reaches the port MCS9835_PARPORT_ATOMIC_SIZE bytes at a time,
+ * transfers of other files only get in between these blocks.
+ *
+ * Opening with O_EXCL, or MCS9835_IOC_SET_EXCL on an open file, gives
+ * one file exclusive use. Other opens then fail with EBUSY until the
+ * file is closed or gives up exclusive use.
+ *
+ ****************************************************************************/
+
+/* Bytes transferred without other files in between */
+#define MCS9835_PARPORT_ATOMIC_SIZE  4096
+
+/* Transfers through one open file */
+struct mcs9835_file_stats {
+  __u64 read_calls;
+  __u64 read_bytes;
+  __u64 write_calls;
+  __u64 write_bytes;
+  __u64 errors;      /* Failed read/write calls */
+};
+
+/****************************************************************************
+ *
+ * Parallel port pin operations
+ * Set, clear or toggle bits of the data or control register in one
+ * call. The driver keeps a copy of both registers, each operation is
+ * a single register write. The value written is returned, a zero
+ * mask only returns the current value.
+ *
+ * Interrupt enable in the control register belongs to the driver.
+ * Data register operations fail with EBUSY during playback.
+ *
+ ****************************************************************************/
+
+#define MCS9835_PIN_REG_DATA     0 /* Data register (DPR)    */
+#define MCS9835_PIN_REG_CONTROL  1 /* Control register (DCR) */
+
+/* Control register bits available to pin operations */
+#define MCS9835_PIN_CONTROL_MASK  0x2f
+
+struct mcs9835_pin_op {
+  __u32 reg;         /* MCS9835_PIN_REG_x                       */
+  __u32 mask;        /* Bits to set, clear or toggle            */
+  __u32 value;       /* Returned, register value after the call */
+  __u32 reserved;
+};
+
+/****************************************************************************
+ *
+ * Parallel port GPIO lines
+ * With GPIO support in the kernel, the parallel port pins are also
+ * a GPIO chip, labelled with the name of the PCI device. Values are
+ * pin levels, the hardware inversion of Busy, nStrobe, nAutoFd and
+ * nSelectIn is undone by the driver. Lines of one register are set
+ * or read in one register access, as with pin operations.
+ *
+ ****************************************************************************/
+#define MCS9835_GPIO_LINE_DATA     0  /* D0-D7, output                  */
+#define MCS9835_GPIO_LINE_STATUS   8  /* nError, Select, PaperOut, nAck,
+					 Busy, input                    */
+#define MCS9835_GPIO_LINE_CONTROL  13 /* nStrobe, nAutoFd, nInit,
+					 nSelectIn, output              */
+#define MCS9835_GPIO_LINES         17
+
+/****************************************************************************
+ *
+ * Parallel port submission and completion rings
+ * Shared memory rings of one open parallel port file, set up by
+ * MCS9835_IOC_RING_SETUP and mapped read/write by mmap() at offset
+ * MCS9835_RING_MMAP_OFFSET. The mapping starts with struct
+ * mcs9835_ring_hdr, the entries follow at sq_offset and cq_offset.
+ *
+ * Entries are posted at sq[sq_tail & sq_mask] and published by
+ * advancing sq_tail, with a write barrier in between. Each entry
+ * gives one completion at cq[cq_head & cq_mask], consumed by
+ * advancing cq_head. Completions are in submission order.
+ *
+ * Posted entries are executed by MCS9835_IOC_RING_ENTER, which
+ * returns when they are done or the completion ring is full.
+ * With MCS9835_RING_SETUP_POLL a kernel thread executes entries
+ * as they are posted, without system calls. When idle for
+ * poll_idle_us it sets MCS9835_RING_NEED_WAKEUP in flags and
+ * sleeps, MCS9835_IOC_RING_ENTER then wakes it.
+ *
+ ****************************************************************************/
+
+/* mmap() offset of the rings on the parallel port device */
+#define MCS9835_RING_MMAP_OFFSET  0x10000000
+
+/* Max entries of each ring */
+#define MCS9835_RING_MAX_ENTRIES  4096
+
+/* Longest poll thread idle time */
+#define MCS9835_RING_POLL_IDLE_MAX_US  1000000
+
+/* Setup flags */
+#define MCS9835_RING_SETUP_POLL  0x01 /* Kernel thread polls the ring */
+
+/* Header flags, set by the driver */
+#define MCS9835_RING_NEED_WAKEUP  0x01 /* Poll thread sleeps */
+
+/* Operations */
+#define MCS9835_RING_OP_NOP        0
+#define MCS9835_RING_OP_REG_READ   1 /* Result is value read      */
+#define MCS9835_RING_OP_REG_WRITE  2
+#define MCS9835_RING_OP_PLAY_STEP  3 /* Queue one playback step   */
+
+/*
+ * PLAY_STEP does not block, it completes with -ENOSPC when the play
+ * queue is full and -EAGAIN while a PLAY_QUEUE ioctl is queueing.
+ */
+
+struct mcs9835_ring_setup {
+  __u32 sq_entries;   /* Submission entries, power of 2             */
+  __u32 cq_entries;   /* Completion entries, power of 2, sq or more */
+  __u32 flags;        /* MCS9835_RING_SETUP_x                       */
+  __u32 poll_idle_us; /* Poll thread idle time before sleeping      */
+  __u32 map_size;     /* Returned, bytes to map                     */
+  __u32 reserved;
+};
+
+struct mcs9835_ring_hdr {
+  __u32 sq_head;      /* Entries taken, written by driver           */
+  __u32 sq_tail;      /* Entries posted, written by user            */
+  __u32 sq_mask;
+  __u32 sq_offset;    /* Submission entries offset in mapping       */
+  __u32 cq_head;      /* Completions consumed, written by user      */
+  __u32 cq_tail;      /* Completions added, written by driver       */
+  __u32 cq_mask;
+  __u32 cq_offset;    /* Completion entries offset in mapping       */
+  __u32 flags;        /* MCS9835_RING_x header flags                */
+  __u32 reserved;
+};
+
+struct mcs9835_ring_sqe {
+  __u8  opcode;       /* MCS9835_RING_OP_x                          */
+  __u8  bar;          /* Register operations, as mcs9835_reg_op     */
+  __u8  offset;
+  __u8  value;        /* Value to write, or step data               */
+  __u32 arg;          /* Delay after register operation (ns),
+			 or step interval (ns)                      */
+  __u64 user_data;    /* Returned in the completion                 */
+};
+
+struct mcs9835_ring_cqe {
+  __u64 user_data;
+  __s32 result;       /* Value read, 0, or negative errno           */
+  __u32 reserved;
+};
+
+/****************************************************************************
+ *
+ * UART receive tuning
+ * Set per port on the UART devices, kept while the driver is loaded.
+ * The FIFO trigger level sets how many bytes the hardware collects
+ * before it interrupts, fewer bytes are delivered by the character
+ * timeout. Blocked readers, and poll, wait for wake_threshold bytes,
+ * or for the line to be idle rx_idle_us with fewer bytes received.
+ * A rx_idle_us of 0 waits for wake_threshold bytes without timeout.
+ *
+ * low_latency sets trigger level 1 and wake_threshold 1, readers
+ * are woken for every byte. The other fields are then ignored.
+ *
+ ****************************************************************************/
+
+/* Longest idle timeout */
+#define MCS9835_UART_RX_IDLE_MAX_US  1000000
+
+struct mcs9835_uart_tuning {
+  __u32 trigger;        /* FIFO trigger level, 1, 4, 8 or 14     */
+  __u32 wake_threshold; /* Bytes in receive ring to wake readers */
+  __u32 rx_idle_us;     /* Wake with fewer bytes after idle time */
+  __u32 low_latency;    /* Non-zero wakes readers on every byte  */
+};
+
+/****************************************************************************
+ *
+ * UART bridge
+ * Set per port on the UART devices, kept while the driver is loaded.
+ * When enabled, data received on the port goes straight into the
+ * transmit ring of the other UART of the device, without a relay
+ * in user space. Forwarding runs while the port is open and the other
+ * UART is open, received data is dropped while the other UART is closed
+ * or its transmit ring is full. Enable on both ports for both directions.
+ *
+ * With mirror set, forwarded data is also kept for readers of the port,
+ * a capture reader sees the same bytes as the other UART. Without it,
+ * readers of the port get no data while bridged.
+ *
+ ****************************************************************************/
+struct mcs9835_uart_bridge {
+  __u32 enable;    /* Forward received data to the other UART   */
+  __u32 mirror;    /* Also keep forwarded data for readers      */
+  __u64 forwarded; /* Returned, bytes forwarded since enabled   */
+  __u64 dropped;   /* Returned, bytes dropped since enabled     */
+};
+
+/****************************************************************************
+ *
+ * UART receive framing
+ * Set per port on the UART devices, kept while the driver is loaded.
+ * Setting it discards received data not yet read.
+ *
+ * With a framing mode set, the driver splits received data into frames,
+ * readers and poll are woken when a frame is complete and each read()
+ * returns one frame. A frame longer than the read buffer is truncated,
+ * the rest of it is discarded. The wake-up tuning is not used.
+ *
+ * DELIM   A frame ends with the delimiter byte, which is part of it.
+ * LENGTH  A frame starts with length_offset bytes, then a length_size
+ *         byte length prefix, then as many bytes as the prefix says.
+ *         Little endian prefix unless MCS9835_UART_FRAME_BE is set.
+ * IDLE    A frame ends when nothing is received for idle_us. Data is
+ *         timed when it leaves the hardware FIFO, with a trigger level
+ *         above 1 the gap must exceed the FIFO character timeout of
+ *         four character times. Receive stays on interrupts, it is
+ *         not switched to hybrid polling.
+ *
+ * A frame reaching max_len bytes ends there and is counted as an error.
+ *
+ ****************************************************************************/
+#define MCS9835_UART_FRAME_NONE    0 /* Byte stream */
+#define MCS9835_UART_FRAME_DELIM   1
+#define MCS9835_UART_FRAME_LENGTH  2
+#define MCS9835_UART_FRAME_IDLE    3
+
+/* Framing flags */
+#define MCS9835_UART_FRAME_BE  0x01 /* Big endian length prefix */
+
+/* Longest idle gap and length offset */
+#define MCS9835_UART_FRAME_IDLE_MAX_US  1000000
+#define MCS9835_UART_FRAME_OFFSET_MAX   255
+
+struct mcs9835_uart_framing {
+  __u32 mode;          /* MCS9835_UART_FRAME_x                  */
+  __u32 flags;         /* MCS9835_UART_FRAME_BE                 */
+  __u32 delimiter;     /* DELIM, byte ending a frame            */
+  __u32 length_offset; /* LENGTH, bytes before the prefix       */
+  __u32 length_size;   /* LENGTH, prefix bytes, 1 or 2          */
+  __u32 idle_us;       /* IDLE, gap ending a frame              */
+  __u32 max_len;       /* Longest frame, 0 for receive ring size */
+  __u32 pad;
+  __u64 frames;        /* Returned, frames received             */
+  __u64 errors;        /* Returned, frames ended at max_len     */
+};
+
+/****************************************************************************
+ *
+ * UART RS-485 mode
+ * Set per port on the UART devices, kept while the driver is loaded.
+ * RTS drives the driver enable of the transceiver. It is switched to
+ * transmit when data is queued, and back to receive by the transmit
+ * interrupt handling once the transmitter is empty and delay_after_us
+ * has passed. With RTS_ON_SEND the MCR RTS bit is set while transmitting,
+ * else it is set while receiving.
+ *
+ * Data received while transmitting, the echo of a half duplex bus,
+ * is discarded unless RX_DURING_TX is set.
+ *
+ * MODBUS also sets idle gap framing with the Modbus RTU t3.5 gap and
+ * FIFO trigger level 1, each read() returns one RTU frame. The gap is
+ * 3.5 character times, fixed 1750 us above 19200 baud. Clearing MODBUS
+ * leaves the framing as it is.
+ *
+ ****************************************************************************/
+#define MCS9835_UART_RS485_ENABLED       0x01
+#define MCS9835_UART_RS485_RTS_ON_SEND   0x02
+#define MCS9835_UART_RS485_RX_DURING_TX  0x04
+#define MCS9835_UART_RS485_MODBUS        0x08
+
+/* Longest driver enable delay after the last character */
+#define MCS9835_UART_RS485_DELAY_MAX_US  100000
+
+struct mcs9835_uart_rs485 {
+  __u32 flags;          /* MCS9835_UART_RS485_x, 0 when off       */
+  __u32 delay_after_us; /* Driver enabled after the last character */
+  __u32 t35_us;         /* Returned, Modbus t3.5 gap at the baudrate */
+  __u32 pad;
+};
+
+/****************************************************************************
+ *
+ * ioctl commands
+ *
+ ****************************************************************************/
+#define MCS9835_IOC_MAGIC  0x98
+
+/* Parallel port device */
+#define MCS9835_IOC_REG_BATCH \
+  _IOWR(MCS9835_IOC_MAGIC, 1, struct mcs9835_reg_batch)
+
+#define MCS9835_IOC_SET_MODE \
+  _IOW(MCS9835_IOC_MAGIC, 2, __u32) /* MCS9835_PARPORT_MODE_x */
+
+#define MCS9835_IOC_GET_MODE \
+  _IOR(MCS9835_IOC_MAGIC, 3, __u32) /* MCS9835_PARPORT_MODE_x */
+
+/* Queue steps, returns number of steps queued */
+#define MCS9835_IOC_PLAY_QUEUE \
+  _IOW(MCS9835_IOC_MAGIC, 4, struct mcs9835_play_queue)
+
+#define MCS9835_IOC_PLAY_START \
+  _IOW(MCS9835_IOC_MAGIC, 5, struct mcs9835_play_start)
+
+/* Stop playing and discard queued steps */
+#define MCS9835_IOC_PLAY_STOP \
+  _IO(MCS9835_IOC_MAGIC, 6)
+
+#define MCS9835_IOC_PLAY_STATUS \
+  _IOR(MCS9835_IOC_MAGIC, 7, struct mcs9835_play_status)
+
+/* Start sampling, restarts the ring at sample 0 */
+#define MCS9835_IOC_SAMPLE_START \
+  _IOW(MCS9835_IOC_MAGIC, 8, struct mcs9835_sample_start)
+
+#define MCS9835_IOC_SAMPLE_STOP \
+  _IO(MCS9835_IOC_MAGIC, 9)
+
+/* Non-zero takes exclusive use, fails if others have the device open */
+#define MCS9835_IOC_SET_EXCL \
+  _IOW(MCS9835_IOC_MAGIC, 10, __u32)
+
+#define MCS9835_IOC_FILE_STATS \
+  _IOR(MCS9835_IOC_MAGIC, 11, struct mcs9835_file_stats)
+
+#define MCS9835_IOC_PIN_SET \
+  _IOWR(MCS9835_IOC_MAGIC, 12, struct mcs9835_pin_op)
+
+#define MCS9835_IOC_PIN_CLEAR \
+  _IOWR(MCS9835_IOC_MAGIC, 13, struct mcs9835_pin_op)
+
+#define MCS9835_IOC_PIN_TOGGLE \
+  _IOWR(MCS9835_IOC_MAGIC, 14, struct mcs9835_pin_op)
+
+/* Allocate rings of the file, once */
+#define MCS9835_IOC_RING_SETUP \
+  _IOWR(MCS9835_IOC_MAGIC, 17, struct mcs9835_ring_setup)
+
+/* Execute posted entries, or wake the poll thread */
+#define MCS9835_IOC_RING_ENTER \
+  _IO(MCS9835_IOC_MAGIC, 18)
+
+/* UART devices */
+#define MCS9835_IOC_UART_SET_TUNING \
+  _IOW(MCS9835_IOC_MAGIC, 15, struct mcs9835_uart_tuning)
+
+#define MCS9835_IOC_UART_GET_TUNING \
+  _IOR(MCS9835_IOC_MAGIC, 16, struct mcs9835_uart_tuning)
+
+/* Enabling restarts the counters, these are ignored */
+#define MCS9835_IOC_UART_SET_BRIDGE \
+  _IOW(MCS9835_IOC_MAGIC, 19, struct mcs9835_uart_bridge)
+
+#define MCS9835_IOC_UART_GET_BRIDGE \
+  _IOR(MCS9835_IOC_MAGIC, 20, struct mcs9835_uart_bridge)
+
+/* Discards received data, returned counters are ignored */
+#define MCS9835_IOC_UART_SET_FRAMING \
+  _IOW(MCS9835_IOC_MAGIC, 21, struct mcs9835_uart_framing)
+
+#define MCS9835_IOC_UART_GET_FRAMING \
+  _IOR(MCS9835_IOC_MAGIC, 22, struct mcs9835_uart_framing)
+
+/* MODBUS flag also sets framing, discarding received data */
+#define MCS9835_IOC_UART_SET_RS485 \
+  _IOW(MCS9835_IOC_MAGIC, 23, struct mcs9835_uart_rs485)
+
+#define MCS9835_IOC_UART_GET_RS485 \
+  _IOR(MCS9835_IOC_MAGIC, 24, struct mcs9835_uart_rs485)
+
+#endif /* __MCS9835_USER_H__ */
@@ -14,10 +14,13 @@
 function print_usage_and_die()
 ################################################################
 {
-    echo "Usage: $0 <rel|dbg>"
+    echo "Usage: $0 <rel|dbg> [loopback|bench [dev_idx]]"
     echo ""
-    echo "rel   Run test executable, no debug support"
-    echo "dbg   Run test executable with debug support"
+    echo "rel       Run test executable, no debug support"
+    echo "dbg       Run test executable with debug support"
+    echo "loopback  Run driver loopback test instead, on emulated"
+    echo "          device or card with loopback plugs"
+    echo "bench     Run parallel port throughput benchmark"
     exit 1  
 }
 
@@ -27,6 +30,14 @@ function print_usage_and_die()
 
 case "$1" in
     rel | dbg)
+	if [ "$2" = "loopback" ]; then
+	    ./obj/test_loopback_$1.i386 $3
+	    exit $?
+	fi
+	if [ "$2" = "bench" ]; then
+	    ./obj/test_bench_$1.i386 $3
+	    exit $?
+	fi
 	export LD_LIBRARY_PATH=./obj/
 	./obj/test_libspio_$1.i386
         ;;
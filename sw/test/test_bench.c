@@ -0,0 +1,227 @@
+/************************************************************************
+ *                                                                      *
+ * Copyright (C) 2017 Bonden i Nol (hakanbrolin@hotmail.com)            *
+ *                                                                      *
+ * This program is free software; you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation; either version 2 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ ************************************************************************/
+
+/*
+ * Throughput benchmark of the mcs9835 parallel port device.
+ * Compares bytes/s of per-byte and bulk read()/write(), and bulk
+ * writes in standard (SPP) and ECP FIFO mode.
+ * Writes drive the data lines, reads sample the status register,
+ * no loopback plug is needed. FIFO mode needs a peripheral that
+ * acknowledges the strobes, or the emulated device, else it times out.
+ *
+ * Usage: test_bench [dev_idx [bytes]]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "mcs9835_user.h"
+
+/*
+ * ---------------------------------
+ *       Macros
+ * ---------------------------------
+ */
+#define BENCH_DEV_NAME  "/dev/mcs9835_%d_%d"
+
+/* Character device index, as in the driver */
+#define BENCH_CDEV_PARPORT  2
+
+#define BENCH_BYTES       65536 /* Default bytes per run  */
+#define BENCH_BULK_CHUNK  4096  /* Bytes per bulk syscall */
+
+/*
+ * ---------------------------------
+ *       Function prototypes
+ * ---------------------------------
+ */
+static double now_s(void);
+static int bench_xfer(int fd,
+		      unsigned char *buf,
+		      size_t bytes,
+		      size_t chunk,
+		      int write_dir,
+		      double *rate);
+static void bench_report(const char *name,
+			 int fd,
+			 unsigned char *buf,
+			 size_t bytes,
+			 size_t chunk,
+			 int write_dir);
+static void bench_mode(const char *name,
+		       int fd,
+		       unsigned char *buf,
+		       size_t bytes,
+		       __u32 mode);
+
+/*****************************************************************/
+
+static double now_s(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*****************************************************************/
+
+/*
+ * Transfer bytes in chunk sized calls.
+ * Returns 0 with rate in bytes/s, or -1.
+ */
+static int bench_xfer(int fd,
+		      unsigned char *buf,
+		      size_t bytes,
+		      size_t chunk,
+		      int write_dir,
+		      double *rate)
+{
+  size_t done = 0;
+  size_t n;
+  ssize_t rc;
+  double start;
+  double elapsed;
+
+  start = now_s();
+  while (done < bytes) {
+    n = (bytes - done < chunk ? bytes - done : chunk);
+    if (write_dir) {
+      rc = write(fd, buf + done, n);
+    } else {
+      rc = read(fd, buf + done, n);
+    }
+    if (rc <= 0) {
+      printf("*** %s failed at %zu bytes, %s\n",
+	     write_dir ? "write" : "read", done, strerror(errno));
+      return -1;
+    }
+    done += rc;
+  }
+  elapsed = now_s() - start;
+
+  *rate = (elapsed > 0 ? bytes / elapsed : 0);
+
+  return 0;
+}
+
+/*****************************************************************/
+
+static void bench_report(const char *name,
+			 int fd,
+			 unsigned char *buf,
+			 size_t bytes,
+			 size_t chunk,
+			 int write_dir)
+{
+  double rate;
+
+  if (bench_xfer(fd, buf, bytes, chunk, write_dir, &rate) == 0) {
+    printf("%-28s %12.0f bytes/s\n", name, rate);
+  } else {
+    printf("%-28s %12s\n", name, "FAIL");
+  }
+}
+
+/*****************************************************************/
+
+/*
+ * Bulk write in one parallel port mode, the mode is restored.
+ */
+static void bench_mode(const char *name,
+		       int fd,
+		       unsigned char *buf,
+		       size_t bytes,
+		       __u32 mode)
+{
+  __u32 old_mode;
+
+  if (ioctl(fd, MCS9835_IOC_GET_MODE, &old_mode)) {
+    printf("*** get mode failed, %s\n", strerror(errno));
+    return;
+  }
+  if (ioctl(fd, MCS9835_IOC_SET_MODE, &mode)) {
+    printf("%-28s %12s, %s\n", name, "FAIL", strerror(errno));
+    return;
+  }
+
+  bench_report(name, fd, buf, bytes, BENCH_BULK_CHUNK, 1);
+
+  if (ioctl(fd, MCS9835_IOC_SET_MODE, &old_mode)) {
+    printf("*** restore mode failed, %s\n", strerror(errno));
+  }
+}
+
+/*****************************************************************/
+
+int main(int argc,
+	 char *argv[])
+{
+  char name[64];
+  unsigned char *buf;
+  size_t bytes = BENCH_BYTES;
+  size_t i;
+  int dev_idx = 0;
+  int fd;
+
+  if (argc > 1) {
+    dev_idx = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    bytes = strtoul(argv[2], NULL, 0);
+  }
+  if (bytes == 0) {
+    printf("*** no bytes to transfer\n");
+    return 1;
+  }
+
+  buf = malloc(bytes);
+  if (buf == NULL) {
+    printf("*** no memory for %zu bytes\n", bytes);
+    return 1;
+  }
+  for (i=0; i < bytes; i++) {
+    buf[i] = (unsigned char)i;
+  }
+
+  snprintf(name, sizeof(name), BENCH_DEV_NAME, dev_idx, BENCH_CDEV_PARPORT);
+  fd = open(name, O_RDWR);
+  if (fd < 0) {
+    printf("*** open %s failed, %s\n", name, strerror(errno));
+    free(buf);
+    return 1;
+  }
+
+  printf("%s, %zu bytes per run\n", name, bytes);
+
+  bench_report("write, per byte", fd, buf, bytes, 1, 1);
+  bench_report("write, bulk", fd, buf, bytes, BENCH_BULK_CHUNK, 1);
+  bench_report("read, per byte", fd, buf, bytes, 1, 0);
+  bench_report("read, bulk", fd, buf, bytes, BENCH_BULK_CHUNK, 0);
+  bench_mode("write, bulk, SPP mode", fd, buf, bytes,
+	     MCS9835_PARPORT_MODE_SPP);
+  bench_mode("write, bulk, FIFO mode", fd, buf, bytes,
+	     MCS9835_PARPORT_MODE_FIFO);
+
+  close(fd);
+  free(buf);
+
+  return 0;
+}
@@ -0,0 +1,652 @@
+/************************************************************************
+ *                                                                      *
+ * Copyright (C) 2017 Bonden i Nol (hakanbrolin@hotmail.com)            *
+ *                                                                      *
+ * This program is free software; you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation; either version 2 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ ************************************************************************/
+
+/*
+ * Loopback test of the mcs9835 character devices.
+ * Runs against the emulated device (driver built with FAKE_HW=1),
+ * or a card with loopback plugs:
+ *   UART       TX looped to RX
+ *   Parallel   data lines D0-D4 looped to status lines 3-7
+ *
+ * Usage: test_loopback [dev_idx]
+ * Exit status 0 when all tests pass.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "mcs9835_user.h"
+
+/*
+ * ---------------------------------
+ *       Macros
+ * ---------------------------------
+ */
+#define TEST_DEV_NAME  "/dev/mcs9835_%d_%d"
+#define TEST_HYBRID_ATTR \
+  "/sys/class/mcs9835/mcs9835_%d_0/device/hybrid/%s"
+
+/* Character device index, as in the driver */
+#define TEST_CDEV_UART_A       0
+#define TEST_CDEV_UART_B       1
+#define TEST_CDEV_PARPORT      2
+#define TEST_CDEV_PARPORT_EVT  3
+
+#define TEST_UART_BYTES    200  /* More than the hardware FIFO */
+#define TEST_HYBRID_BYTES  1024 /* Line rate for many windows   */
+#define TEST_TIMEOUT_MS    1000
+
+#define TEST_FRAME_BYTES   100  /* Frame longer than the FIFO    */
+#define TEST_FRAME_IDLE_US 2000 /* Gap ending an idle frame      */
+#define TEST_FRAME_GAP_MS  20   /* Pause between two idle frames */
+
+#define TEST_SAMPLE_PERIOD_NS  10000 /* Status sampled every 10 us */
+#define TEST_SAMPLE_PULSES     32
+
+/* Status register bits */
+#define TEST_DSR_LOOPBACK  0xf8 /* Status lines 3-7 */
+#define TEST_DSR_NIRQ      0x04 /* Low with nAck interrupt pending */
+#define TEST_DPR_NACK      0x08 /* D3, looped to nAck */
+
+/*
+ * ---------------------------------
+ *       Function prototypes
+ * ---------------------------------
+ */
+static int open_cdev(int dev_idx,
+		     int cdev_idx,
+		     int flags);
+static int read_timeout(int fd,
+			void *buf,
+			size_t count);
+static int read_hybrid_attr(int dev_idx,
+			    const char *attr,
+			    unsigned long *value);
+static int test_uart_echo(int dev_idx,
+			  int cdev_idx);
+static int test_uart_hybrid(int dev_idx);
+static int read_frame(int fd,
+		      const unsigned char *expect,
+		      size_t len);
+static int test_uart_frame_delim(int dev_idx);
+static int test_uart_frame_idle(int dev_idx);
+static int test_uart_modbus(int dev_idx);
+static int test_parport_status(int dev_idx);
+static int test_parport_nack(int dev_idx);
+static int test_parport_nack_sampling(int dev_idx);
+
+/*****************************************************************/
+
+static int open_cdev(int dev_idx,
+		     int cdev_idx,
+		     int flags)
+{
+  char name[64];
+  int fd;
+
+  snprintf(name, sizeof(name), TEST_DEV_NAME, dev_idx, cdev_idx);
+  fd = open(name, flags);
+  if (fd < 0) {
+    printf("*** open %s failed, %s\n", name, strerror(errno));
+  }
+
+  return fd;
+}
+
+/*****************************************************************/
+
+/*
+ * Read exactly count bytes, or fail after TEST_TIMEOUT_MS
+ * without data.
+ */
+static int read_timeout(int fd,
+			void *buf,
+			size_t count)
+{
+  struct pollfd pfd;
+  size_t done = 0;
+  ssize_t n;
+
+  pfd.fd     = fd;
+  pfd.events = POLLIN;
+
+  while (done < count) {
+    if (poll(&pfd, 1, TEST_TIMEOUT_MS) != 1) {
+      printf("*** timeout, %zu of %zu bytes\n", done, count);
+      return -1;
+    }
+    n = read(fd, (char *)buf + done, count - done);
+    if (n <= 0) {
+      printf("*** read failed, %s\n", strerror(errno));
+      return -1;
+    }
+    done += n;
+  }
+
+  return 0;
+}
+
+/*****************************************************************/
+
+static int read_hybrid_attr(int dev_idx,
+			    const char *attr,
+			    unsigned long *value)
+{
+  char name[128];
+  FILE *fp;
+  int rc = 0;
+
+  snprintf(name, sizeof(name), TEST_HYBRID_ATTR, dev_idx, attr);
+  fp = fopen(name, "r");
+  if (fp == NULL) {
+    printf("*** open %s failed, %s\n", name, strerror(errno));
+    return -1;
+  }
+  if (fscanf(fp, "%lu", value) != 1) {
+    printf("*** read %s failed\n", name);
+    rc = -1;
+  }
+  fclose(fp);
+
+  return rc;
+}
+
+/*****************************************************************/
+
+static int test_uart_echo(int dev_idx,
+			  int cdev_idx)
+{
+  unsigned char tx[TEST_UART_BYTES];
+  unsigned char rx[TEST_UART_BYTES];
+  int fd;
+  int i;
+  int rc = -1;
+
+  fd = open_cdev(dev_idx, cdev_idx, O_RDWR);
+  if (fd < 0) {
+    return -1;
+  }
+
+  for (i=0; i < TEST_UART_BYTES; i++) {
+    tx[i] = (unsigned char)(i * 7 + cdev_idx);
+  }
+
+  if (write(fd, tx, sizeof(tx)) != (ssize_t)sizeof(tx)) {
+    printf("*** write failed, %s\n", strerror(errno));
+    goto out;
+  }
+  if (read_timeout(fd, rx, sizeof(rx))) {
+    goto out;
+  }
+  for (i=0; i < TEST_UART_BYTES; i++) {
+    if (rx[i] != tx[i]) {
+      printf("*** byte %d, got 0x%02x expected 0x%02x\n", i, rx[i], tx[i]);
+      goto out;
+    }
+  }
+  rc = 0;
+
+ out:
+  close(fd);
+  return rc;
+}
+
+/*****************************************************************/
+
+/*
+ * Receive at line rate switches UART-A to polling,
+ * the hybrid to_poll counter increments.
+ */
+static int test_uart_hybrid(int dev_idx)
+{
+  unsigned char buf[TEST_HYBRID_BYTES];
+  unsigned long before;
+  unsigned long after;
+  int fd;
+  int rc = -1;
+
+  if (read_hybrid_attr(dev_idx, "uart_a_to_poll", &before)) {
+    return -1;
+  }
+
+  fd = open_cdev(dev_idx, TEST_CDEV_UART_A, O_RDWR);
+  if (fd < 0) {
+    return -1;
+  }
+
+  memset(buf, 0x55, sizeof(buf));
+  if (write(fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf)) {
+    printf("*** write failed, %s\n", strerror(errno));
+    goto out;
+  }
+  if (read_timeout(fd, buf, sizeof(buf))) {
+    goto out;
+  }
+
+  if (read_hybrid_attr(dev_idx, "uart_a_to_poll", &after)) {
+    goto out;
+  }
+  if (after == before) {
+    printf("*** no switch to polling, to_poll %lu\n", after);
+    goto out;
+  }
+  rc = 0;
+
+ out:
+  close(fd);
+  return rc;
+}
+
+/*****************************************************************/
+
+/*
+ * One read() returns exactly the expected frame.
+ */
+static int read_frame(int fd,
+		      const unsigned char *expect,
+		      size_t len)
+{
+  unsigned char buf[TEST_FRAME_BYTES * 2];
+  struct pollfd pfd;
+  ssize_t n;
+
+  pfd.fd     = fd;
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, TEST_TIMEOUT_MS) != 1) {
+    printf("*** timeout, no frame\n");
+    return -1;
+  }
+  n = read(fd, buf, sizeof(buf));
+  if (n != (ssize_t)len) {
+    printf("*** frame of %zd bytes, expected %zu\n", n, len);
+    return -1;
+  }
+  if (memcmp(buf, expect, len)) {
+    printf("*** frame data differs\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+/*****************************************************************/
+
+/*
+ * Delimiter framing, two frames in one write read back one
+ * frame per read().
+ */
+static int test_uart_frame_delim(int dev_idx)
+{
+  static const char data[] =
+    "first\nsecond frame, longer than the hardware FIFO\n";
+  struct mcs9835_uart_framing framing;
+  size_t first = strlen("first\n");
+  int fd;
+  int rc = -1;
+
+  fd = open_cdev(dev_idx, TEST_CDEV_UART_A, O_RDWR);
+  if (fd < 0) {
+    return -1;
+  }
+
+  memset(&framing, 0, sizeof(framing));
+  framing.mode      = MCS9835_UART_FRAME_DELIM;
+  framing.delimiter = '\n';
+  if (ioctl(fd, MCS9835_IOC_UART_SET_FRAMING, &framing)) {
+    printf("*** set framing failed, %s\n", strerror(errno));
+    goto out;
+  }
+
+  if (write(fd, data, strlen(data)) != (ssize_t)strlen(data)) {
+    printf("*** write failed, %s\n", strerror(errno));
+    goto out;
+  }
+  if ( read_frame(fd, (const unsigned char *)data, first) ||
+       read_frame(fd, (const unsigned char *)data + first,
+		  strlen(data) - first) ) {
+    goto out;
+  }
+  rc = 0;
+
+ out:
+  memset(&framing, 0, sizeof(framing));
+  ioctl(fd, MCS9835_IOC_UART_SET_FRAMING, &framing);
+  close(fd);
+  return rc;
+}
+
+/*****************************************************************/
+
+/*
+ * Idle gap framing, frames longer than the FIFO received at line
+ * rate are not split, a pause longer than the gap ends a frame.
+ */
+static int test_uart_frame_idle(int dev_idx)
+{
+  struct mcs9835_uart_framing framing;
+  struct timespec pause = { 0, TEST_FRAME_GAP_MS * 1000000L };
+  unsigned char frame[2][TEST_FRAME_BYTES];
+  int fd;
+  int i;
+  int rc = -1;
+
+  fd = open_cdev(dev_idx, TEST_CDEV_UART_A, O_RDWR);
+  if (fd < 0) {
+    return -1;
+  }
+
+  memset(&framing, 0, sizeof(framing));
+  framing.mode    = MCS9835_UART_FRAME_IDLE;
+  framing.idle_us = TEST_FRAME_IDLE_US;
+  if (ioctl(fd, MCS9835_IOC_UART_SET_FRAMING, &framing)) {
+    printf("*** set framing failed, %s\n", strerror(errno));
+    goto out;
+  }
+
+  for (i=0; i < TEST_FRAME_BYTES; i++) {
+    frame[0][i] = (unsigned char)i;
+    frame[1][i] = (unsigned char)(0xff - i);
+  }
+
+  for (i=0; i < 2; i++) {
+    if (write(fd, frame[i], TEST_FRAME_BYTES) != TEST_FRAME_BYTES) {
+      printf("*** write failed, %s\n", strerror(errno));
+      goto out;
+    }
+    nanosleep(&pause, NULL);
+  }
+  if ( read_frame(fd, frame[0], TEST_FRAME_BYTES) ||
+       read_frame(fd, frame[1], TEST_FRAME_BYTES) ) {
+    goto out;
+  }
+  rc = 0;
+
+ out:
+  memset(&framing, 0, sizeof(framing));
+  ioctl(fd, MCS9835_IOC_UART_SET_FRAMING, &framing);
+  close(fd);
+  return rc;
+}
+
+/*****************************************************************/
+
+/*
+ * Modbus RTU mode, frames longer than the FIFO end only at the
+ * t3.5 gap. The loopback echo is kept with RX_DURING_TX.
+ */
+static int test_uart_modbus(int dev_idx)
+{
+  struct mcs9835_uart_rs485 rs485;
+  struct mcs9835_uart_framing framing;
+  struct timespec pause = { 0, TEST_FRAME_GAP_MS * 1000000L };
+  unsigned char frame[2][TEST_FRAME_BYTES];
+  int fd;
+  int i;
+  int rc = -1;
+
+  fd = open_cdev(dev_idx, TEST_CDEV_UART_A, O_RDWR);
+  if (fd < 0) {
+    return -1;
+  }
+
+  memset(&rs485, 0, sizeof(rs485));
+  rs485.flags = (MCS9835_UART_RS485_ENABLED |
+		 MCS9835_UART_RS485_RX_DURING_TX |
+		 MCS9835_UART_RS485_MODBUS);
+  if (ioctl(fd, MCS9835_IOC_UART_SET_RS485, &rs485)) {
+    printf("*** set rs485 failed, %s\n", strerror(errno));
+    goto out;
+  }
+
+  for (i=0; i < TEST_FRAME_BYTES; i++) {
+    frame[0][i] = (unsigned char)(i * 3);
+    frame[1][i] = (unsigned char)(i ^ 0x5a);
+  }
+
+  for (i=0; i < 2; i++) {
+    if (write(fd, frame[i], TEST_FRAME_BYTES) != TEST_FRAME_BYTES) {
+      printf("*** write failed, %s\n", strerror(errno));
+      goto out;
+    }
+    nanosleep(&pause, NULL);
+  }
+  if ( read_frame(fd, frame[0], TEST_FRAME_BYTES) ||
+       read_frame(fd, frame[1], TEST_FRAME_BYTES) ) {
+    goto out;
+  }
+  rc = 0;
+
+ out:
+  /* Clearing MODBUS leaves the framing, reset both */
+  memset(&rs485, 0, sizeof(rs485));
+  ioctl(fd, MCS9835_IOC_UART_SET_RS485, &rs485);
+  memset(&framing, 0, sizeof(framing));
+  ioctl(fd, MCS9835_IOC_UART_SET_FRAMING, &framing);
+  close(fd);
+  return rc;
+}
+
+/*****************************************************************/
+
+/*
+ * Every pattern on D0-D4 reads back on status lines 3-7,
+ * one bulk read samples the status register.
+ */
+static int test_parport_status(int dev_idx)
+{
+  unsigned char dsr[4];
+  unsigned char value;
+  int fd;
+  int i;
+  int rc = -1;
+
+  fd = open_cdev(dev_idx, TEST_CDEV_PARPORT, O_RDWR);
+  if (fd < 0) {
+    return -1;
+  }
+
+  for (value=0; value < 32; value++) {
+    if (write(fd, &value, 1) != 1) {
+      printf("*** write failed, %s\n", strerror(errno));
+      goto out;
+    }
+    if (read(fd, dsr, sizeof(dsr)) != (ssize_t)sizeof(dsr)) {
+      printf("*** read failed, %s\n", strerror(errno));
+      goto out;
+    }
+    for (i=0; i < (int)sizeof(dsr); i++) {
+      if ((dsr[i] & TEST_DSR_LOOPBACK) != (value << 3)) {
+	printf("*** data 0x%02x, status 0x%02x\n", value, dsr[i]);
+	goto out;
+      }
+    }
+  }
+  rc = 0;
+
+ out:
+  close(fd);
+  return rc;
+}
+
+/*****************************************************************/
+
+/*
+ * A nAck pulse (D3 low, then high) gives one status event,
+ * recorded with the interrupt pending bit low.
+ */
+static int test_parport_nack(int dev_idx)
+{
+  struct mcs9835_parport_event event;
+  struct pollfd pfd;
+  unsigned char pulse[2] = { 0, TEST_DPR_NACK };
+  int fd;
+  int fd_evt;
+  int rc = -1;
+
+  fd = open_cdev(dev_idx, TEST_CDEV_PARPORT, O_RDWR);
+  if (fd < 0) {
+    return -1;
+  }
+  fd_evt = open_cdev(dev_idx, TEST_CDEV_PARPORT_EVT, O_RDONLY | O_NONBLOCK);
+  if (fd_evt < 0) {
+    close(fd);
+    return -1;
+  }
+
+  /* Drain events of earlier tests */
+  while (read(fd_evt, &event, sizeof(event)) == (ssize_t)sizeof(event)) {
+    ;
+  }
+
+  if (write(fd, pulse, sizeof(pulse)) != (ssize_t)sizeof(pulse)) {
+    printf("*** write failed, %s\n", strerror(errno));
+    goto out;
+  }
+
+  pfd.fd     = fd_evt;
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, TEST_TIMEOUT_MS) != 1) {
+    printf("*** no event for nAck pulse\n");
+    goto out;
+  }
+  if (read(fd_evt, &event, sizeof(event)) != (ssize_t)sizeof(event)) {
+    printf("*** event read failed, %s\n", strerror(errno));
+    goto out;
+  }
+  if (event.dsr & TEST_DSR_NIRQ) {
+    printf("*** event status 0x%02x, interrupt not pending\n", event.dsr);
+    goto out;
+  }
+
+  /* One pulse, one event */
+  if (read(fd_evt, &event, sizeof(event)) > 0) {
+    printf("*** more than one event for one pulse\n");
+    goto out;
+  }
+  rc = 0;
+
+ out:
+  close(fd_evt);
+  close(fd);
+  return rc;
+}
+
+/*****************************************************************/
+
+/*
+ * nAck pulses while the status register is sampled, each pulse
+ * gives one event even when a sample reads the pending bit first.
+ */
+static int test_parport_nack_sampling(int dev_idx)
+{
+  struct mcs9835_parport_event event;
+  struct mcs9835_sample_start start;
+  struct timespec gap = { 0, 200000 }; /* Some samples between pulses */
+  unsigned char pulse[2] = { 0, TEST_DPR_NACK };
+  int events = 0;
+  int fd;
+  int fd_evt;
+  int i;
+  int rc = -1;
+
+  fd = open_cdev(dev_idx, TEST_CDEV_PARPORT, O_RDWR);
+  if (fd < 0) {
+    return -1;
+  }
+  fd_evt = open_cdev(dev_idx, TEST_CDEV_PARPORT_EVT, O_RDONLY | O_NONBLOCK);
+  if (fd_evt < 0) {
+    close(fd);
+    return -1;
+  }
+
+  /* Drain events of earlier tests */
+  while (read(fd_evt, &event, sizeof(event)) == (ssize_t)sizeof(event)) {
+    ;
+  }
+
+  memset(&start, 0, sizeof(start));
+  start.period_ns = TEST_SAMPLE_PERIOD_NS;
+  if (ioctl(fd, MCS9835_IOC_SAMPLE_START, &start)) {
+    printf("*** sample start failed, %s\n", strerror(errno));
+    goto out;
+  }
+
+  for (i=0; i < TEST_SAMPLE_PULSES; i++) {
+    if (write(fd, pulse, sizeof(pulse)) != (ssize_t)sizeof(pulse)) {
+      printf("*** write failed, %s\n", strerror(errno));
+      ioctl(fd, MCS9835_IOC_SAMPLE_STOP);
+      goto out;
+    }
+    nanosleep(&gap, NULL);
+  }
+
+  if (ioctl(fd, MCS9835_IOC_SAMPLE_STOP)) {
+    printf("*** sample stop failed, %s\n", strerror(errno));
+    goto out;
+  }
+
+  while (read(fd_evt, &event, sizeof(event)) == (ssize_t)sizeof(event)) {
+    events++;
+  }
+  if (events != TEST_SAMPLE_PULSES) {
+    printf("*** %d events for %d pulses\n", events, TEST_SAMPLE_PULSES);
+    goto out;
+  }
+  rc = 0;
+
+ out:
+  close(fd_evt);
+  close(fd);
+  return rc;
+}
+
+/*****************************************************************/
+
+int main(int argc,
+	 char *argv[])
+{
+  int dev_idx = 0;
+  int failed = 0;
+
+  if (argc > 1) {
+    dev_idx = atoi(argv[1]);
+  }
+
+#define RUN(name, call)						\
+  do {								\
+    int _rc = (call);						\
+    printf("%-24s %s\n", name, _rc ? "FAIL" : "PASS");		\
+    failed += (_rc != 0);					\
+  } while (0)
+
+  RUN("uart-a echo", test_uart_echo(dev_idx, TEST_CDEV_UART_A));
+  RUN("uart-b echo", test_uart_echo(dev_idx, TEST_CDEV_UART_B));
+  RUN("uart-a hybrid poll", test_uart_hybrid(dev_idx));
+  RUN("uart-a delimiter frames", test_uart_frame_delim(dev_idx));
+  RUN("uart-a idle frames", test_uart_frame_idle(dev_idx));
+  RUN("uart-a modbus frames", test_uart_modbus(dev_idx));
+  RUN("parport data->status", test_parport_status(dev_idx));
+  RUN("parport nAck event", test_parport_nack(dev_idx));
+  RUN("parport nAck, sampling", test_parport_nack_sampling(dev_idx));
+
+  printf("%d test(s) failed\n", failed);
+
+  return (failed ? 1 : 0);
+}